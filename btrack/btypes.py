@@ -95,6 +95,14 @@ class PyTrackingInfo(ctypes.Structure):
         t_total_time: total time to track objects
         p_link: typical probability of association
         p_lost: typical probability of losing track
+        gate_hit_rate: fraction of candidate linkages inside the gate in the
+            last frame
+        n_allocations: heap allocations made in the last frame (only counted
+            in debug builds with COUNT_ALLOCATIONS). Once the scratch buffers
+            have grown to the size of the frame, the belief update does not
+            allocate, while linking and storing the results still do
+        n_belief_allocations: heap allocations made by the belief update in
+            the last frame, which should be zero once the buffers have grown
 
     Notes:
         TODO(arl): should update to give more useful statistics, perhaps
@@ -112,6 +120,9 @@ class PyTrackingInfo(ctypes.Structure):
                 ('t_total_time', ctypes.c_float),
                 ('p_link', ctypes.c_float),
                 ('p_lost', ctypes.c_float),
+                ('gate_hit_rate', ctypes.c_float),
+                ('n_allocations', ctypes.c_uint),
+                ('n_belief_allocations', ctypes.c_uint),
                 ('complete', ctypes.c_bool)]
 
 
@@ -129,6 +140,46 @@ class PyTrackingInfo(ctypes.Structure):
 
 
 
+class PyTrackProgress(ctypes.Structure):
+    """ PyTrackProgress
+
+    Progress of an asynchronous tracking run, which can be polled while the
+    tracking is running.
+
+    Params:
+        current_frame: the frame currently being tracked
+        last_frame: the last frame to be tracked
+        n_active: number of active tracks
+        n_tracks: total number of tracks so far
+        t_update_belief: time to update belief matrix in the last frame, in ms
+        t_update_link: time to update links in the last frame, in ms
+        t_elapsed: time since the tracking was started, in seconds
+        running: is the tracking still running?
+        complete: has the tracking finished all of the frames?
+
+    """
+
+    _fields_ = [('current_frame', ctypes.c_uint),
+                ('last_frame', ctypes.c_uint),
+                ('n_active', ctypes.c_uint),
+                ('n_tracks', ctypes.c_uint),
+                ('t_update_belief', ctypes.c_float),
+                ('t_update_link', ctypes.c_float),
+                ('t_elapsed', ctypes.c_float),
+                ('running', ctypes.c_bool),
+                ('complete', ctypes.c_bool)]
+
+    def to_dict(self):
+        """ Return a dictionary of the progress """
+        return {k:getattr(self, k) for k,typ in PyTrackProgress._fields_}
+
+
+
+
+
+
+
+
 class MotionModel(object):
     """ MotionModel
 
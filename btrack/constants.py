@@ -11,8 +11,21 @@ ERRORS = {901: 'ERROR_empty_queue',
           906: 'ERROR_max_lost_out_of_range',
           907: 'ERROR_accuracy_out_of_range',
           908: 'ERROR_prob_not_assign_out_of_range',
-          909: 'ERROR_not_defined'}
+          909: 'ERROR_not_defined',
+          911: 'ERROR_stream_out_of_order',
+          912: 'ERROR_stream_mixed_modes',
+          913: 'ERROR_file_IO',
+          914: 'ERROR_precision_not_supported',
+          915: 'ERROR_cancelled',
+          916: 'ERROR_tracking_in_progress',
+          917: 'ERROR_frame_times_not_increasing'}
 EXPORT_FORMATS = frozenset(['.json','.mat','.hdf5'])
+TRACK_STORE_EXT = '.btrk'
+GATE_PROBABILITY = 0.
+PRECISION = frozenset([32,64])
+CHUNK_OVERLAP = 10
+PROGRESS_INTERVAL = 0.1
+TRACK_STORE_VERSION = 1
 NEW_COLORS = ['#1f77b4', '#ff7f0e', '#2ca02c', '#d62728', '#9467bd', '#8c564b',
                 '#e377c2', '#7f7f7f', '#bcbd22', '#17becf']
 VOLUME = ((0,1024), (0,1024), (-100,100))
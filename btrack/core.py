@@ -156,6 +156,14 @@ class BayesianTracker(object):
         xyzt(): set an entire array of data
         track(): run the tracking algorithm
         track_interactive(): run the tracking in interactive mode
+        track_async(): start the tracking on a worker thread, see also
+            progress, cancel() and wait()
+        track_many(): track several independent datasets in parallel
+        stream(): track a single frame of objects as they are acquired
+        finalise(): finish streaming and finalise the tracks
+        retire(): retire finished tracks to an archive on disk
+        checkpoint(): write the state of the tracker to disk
+        restore(): restore the state of the tracker from a checkpoint
         export(): export the data to a JSON format
         cleanup(): clean up the tracks according to some metrics
         optimise(): run the optimiser
@@ -173,6 +181,8 @@ class BayesianTracker(object):
         frame_range: the frame range for tracking, essentially the last
             dimension of volume
         max_search_radius: maximum search radius when using fast cost update
+        gate_probability: probability floor for gating candidate linkages
+        precision: precision (32 or 64 bits) of the belief matrix
 
     Notes:
         TODO(arl): lower precision for tracking output?
@@ -202,6 +212,8 @@ class BayesianTracker(object):
         self.__object_model = None
         self.__frame_range = [0,0]
         self.__max_search_radius = 100.0
+        self.__gate_probability = constants.GATE_PROBABILITY
+        self.__precision = 64
         self.return_kalman = False
 
         # do not initialise until the init() has been run
@@ -278,15 +290,52 @@ class BayesianTracker(object):
     def max_search_radius(self, max_search_radius):
         """ Set the maximum search radius for fast cost updates """
         assert(max_search_radius>0. and max_search_radius<=100.)
+        self.__check_idle()
         logger.info('Setting maximum XYZ search radius to {0:2.2f}...'
                     .format(max_search_radius))
         lib.max_search_radius(self.__engine, max_search_radius)
 
+    @property
+    def gate_probability(self):
+        return self.__gate_probability
+    @gate_probability.setter
+    def gate_probability(self, gate_probability):
+        """ Set the probability floor for gating. Candidate objects which lie
+        further from the prediction of a track than a true match would with
+        this probability (using the squared Mahalanobis distance) are rejected
+        before scoring. Zero (the default) disables gating. """
+        assert(gate_probability>=0. and gate_probability<1.)
+        self.__check_idle()
+        logger.info('Setting gating probability to {0:.2E}...'
+                    .format(gate_probability))
+        self.__gate_probability = gate_probability
+        lib.set_gating(self.__engine, gate_probability)
+
+    @property
+    def precision(self):
+        return self.__precision
+    @precision.setter
+    def precision(self, precision):
+        """ Set the precision of the belief matrix, in bits. Single precision
+        (32) halves the memory used by the Bayesian updates, which is usually
+        sufficient for pixel coordinates. The tracks themselves are always
+        stored in double precision. """
+        if precision not in constants.PRECISION:
+            raise ValueError('Precision must be one of {0:s}'
+                             .format(str(sorted(constants.PRECISION))))
+        self.__check_idle()
+        logger.info('Setting belief precision to {0:d} bits...'
+                    .format(precision))
+        ret = lib.set_precision(self.__engine, precision)
+        if not utils.log_error(ret):
+            self.__precision = precision
+
 
 
     @property
     def n_tracks(self):
         """ Return the number of tracks found """
+        self.__check_idle()
         return lib.size( self.__engine )
     @property
     def n_dummies(self):
@@ -325,9 +374,34 @@ class BayesianTracker(object):
         """ Return the imaging volume in the format xyzt. This is effectively
         the range of each dimension: [(xlo,xhi),...,(zlo,zhi),(tlo,thi)]
         """
+        self.__check_idle()
         vol = np.zeros((3,2),dtype='float')
         lib.get_volume(self.__engine, vol)
         return [tuple(vol[i,:].tolist()) for i in xrange(3)]+[self.frame_range]
+    @volume.setter
+    def volume(self, volume):
+        """ Set the imaging volume, in the format [(xlo,xhi),...,(zlo,zhi)].
+        This is useful when streaming, since the volume cannot be inferred from
+        the observations in advance. """
+        if len(volume) < 3:
+            raise ValueError('Volume must be specified as [(xlo,xhi),...]')
+        self.__check_idle()
+        vol = np.array(volume[:3], dtype='float').reshape(3,2)
+        lib.set_volume(self.__engine, vol)
+
+    def set_frame_times(self, times):
+        """ Set the acquisition time of each frame, for movies where the frames
+        are not regularly spaced in time. The times are in the same units as
+        the time step (dt) of the motion model, and must not decrease. Frames
+        without a time are assumed to be one time step apart.
+
+        Args:
+            times: a list of times, one for each frame starting at frame zero
+        """
+        self.__check_idle()
+        t = np.array(times, dtype='float').reshape(1,-1)
+        ret = lib.set_frame_times(self.__engine, t, t.shape[1])
+        utils.log_error(ret)
 
     @property
     def motion_model(self):
@@ -355,6 +429,7 @@ class BayesianTracker(object):
         else:
             raise TypeError('Motion model needs to be defined in /models/ or'
             'provided as a MotionModel object')
+        self.__check_idle()
 
         self.__motion_model = model
         logger.info('Loading motion model: {0:s}'.format(model.name))
@@ -427,6 +502,7 @@ class BayesianTracker(object):
         order here does not matter. This means several datasets can be
         concatenated easily, by running this a few times. """
 
+        self.__check_idle()
         if not isinstance(objects, list):
             objects = [objects]
 
@@ -450,17 +526,34 @@ class BayesianTracker(object):
 
         return info_ptr.contents
 
+    def __check_idle(self):
+        """ Raise an error if asynchronous tracking is running, since the
+        tracker cannot be used until it has finished """
+        if self.progress.running:
+            raise RuntimeError('Tracking is in progress, call wait() first.')
 
 
-    def track(self):
-        """ Run the actual tracking algorithm """
+    def track(self, threads=1, overlap=constants.CHUNK_OVERLAP, tiles=None):
+        """ Run the actual tracking algorithm. With more than one thread, the
+        movie is split into temporal chunks (overlapping by a number of frames)
+        which are tracked in parallel and stitched together afterwards.
+        Alternatively, tiles=(nx, ny) splits the field of view into spatial
+        tiles, which is better suited to very large fields of view. """
 
+        self.__check_idle()
         if not self.__initialised:
             logger.info('Using default parameters')
             self.configure({'MotionModel':'constant_velocity.json'})
 
         logger.info('Starting tracking... ')
-        ret, tm = timeit( lib.track,  self.__engine )
+        if tiles is not None:
+            ret, tm = timeit( lib.track_tiled, self.__engine, tiles[0],
+                tiles[1], threads )
+        elif threads > 1:
+            ret, tm = timeit( lib.track_chunked, self.__engine, threads,
+                overlap )
+        else:
+            ret, tm = timeit( lib.track,  self.__engine )
 
         # get the statistics
         stats = self.__stats(ret)
@@ -473,71 +566,302 @@ class BayesianTracker(object):
         # can log the statistics as well
         utils.log_stats(stats.to_dict())
 
-    def track_interactive(self, step_size=100):
-        """ Run the tracking in an interactive mode """
+    @staticmethod
+    def track_many(trackers, threads=1):
+        """ Track several independent datasets (e.g. the positions of a
+        multi-well experiment) in parallel, one BayesianTracker per dataset.
+        Trackers which have not been configured share the configuration of
+        the first tracker. Returns a list of the statistics of each dataset.
+        """
 
-        # TODO(arl): this needs cleaning up to have some decent output
-        if not self.__initialised:
+        if not trackers:
+            return []
+
+        for trk in trackers:
+            trk.__check_idle()
+
+        template = trackers[0]
+        if not template.__initialised:
             logger.info('Using default parameters')
-            self.configure({'MotionModel':'constant_velocity.json'})
+            template.configure({'MotionModel':'constant_velocity.json'})
 
-        logger.info('Starting tracking... ')
+        for trk in trackers[1:]:
+            if not trk.__initialised:
+                lib.copy_configuration(trk.__engine, template.__engine)
+                trk.__motion_model = template.__motion_model
+                trk.__object_model = template.__object_model
+                trk.__initialised = True
+
+        engines = (ctypes.c_void_p * len(trackers))(
+            *[trk.__engine for trk in trackers])
+        stats = (btypes.PyTrackingInfo * len(trackers))()
 
-        stats = self.step()
-        frm = 0
-        # while not stats.complete and stats.error == 910:
-        while not stats.complete and stats.error not in constants.ERRORS:
-            logger.info('Tracking objects in frames {0:d} to '
-                '{1:d} (of {2:d})...'.format(frm, min(frm+step_size-1,
-                self.__frame_range[1]+1), self.__frame_range[1]+1))
+        logger.info('Starting tracking of {0:d} datasets... '.format(
+            len(trackers)))
+        ret, tm = timeit( lib.track_many, engines, len(trackers), threads,
+            None, stats )
 
-            stats = self.step(step_size)
-            utils.log_stats(stats.to_dict())
-            frm+=step_size
+        if not utils.log_error(ret):
+            logger.info('SUCCESS. Tracked {0:d} datasets (in {1:.2f}s)'.format(
+                len(trackers), tm))
 
+        return [s for s in stats]
+
+    def track_interactive(self, step_size=100):
+        """ Run the tracking in an interactive mode, reporting the progress
+        every step_size frames """
+
+        if not self.track_async():
+            return
+
+        logged = 0
+        while True:
+            progress = self.progress
+            if progress.current_frame >= logged + step_size:
+                logged = progress.current_frame - progress.current_frame % \
+                    step_size
+                logger.info('Tracked {0:d} of {1:d} frames ({2:d} active '
+                    'tracks)...'.format(progress.current_frame,
+                    progress.last_frame, progress.n_active))
+            if not progress.running: break
+            time.sleep(constants.PROGRESS_INTERVAL)
+
+        stats = self.wait()
         if not utils.log_error(stats.error):
             logger.info('SUCCESS.')
             logger.info(' - Found {0:d} tracks in {1:d} frames (in '
                 '{2:.2f}s)'.format(self.n_tracks, 1+self.__frame_range[1],
-                stats.t_total_time))
+                progress.t_elapsed))
             logger.info(' - Inserted {0:d} dummy objects to fill '
                 'tracking gaps'.format(self.n_dummies))
 
+    def track_async(self):
+        """ Start the tracking on a worker thread and return immediately. The
+        progress can be polled using the progress property, and the tracking
+        can be cancelled using cancel(). Call wait() to finish, before using
+        the tracker for anything else, otherwise a RuntimeError is raised.
+        Returns True if the tracking started.
+        """
+
+        if not self.__initialised:
+            logger.info('Using default parameters')
+            self.configure({'MotionModel':'constant_velocity.json'})
+
+        logger.info('Starting tracking... ')
+        ret = lib.track_async(self.__engine)
+        return not utils.log_error(ret)
+
+    @property
+    def progress(self):
+        """ Return the progress of asynchronous tracking """
+        progress = btypes.PyTrackProgress()
+        lib.get_progress(self.__engine, ctypes.byref(progress))
+        return progress
+
+    def cancel(self):
+        """ Ask asynchronous tracking to stop after the current frame. The
+        tracks found so far are finalised, and calling track_async() again
+        resumes the tracking """
+        lib.cancel(self.__engine)
+
+    def wait(self):
+        """ Wait for asynchronous tracking to finish, and return the tracking
+        statistics """
+        stats = self.__stats(lib.wait(self.__engine))
+        utils.log_stats(stats.to_dict())
+        return stats
+
 
 
     def step(self, n_steps=1):
         """ Run an iteration (or more) of the tracking. Mostly for
         interactive mode tracking """
         if not self.__initialised: return None
+        self.__check_idle()
         return self.__stats(lib.step( self.__engine, n_steps ))
 
-    def hypotheses(self, params=None):
-        """ Calculate and return hypotheses using the hypothesis engine """
+    def stream(self, objects, frame):
+        """ Streaming mode. Track a single frame of objects as it is acquired,
+        rather than appending every object up front. Frames must be supplied in
+        increasing order, empty frames can simply be skipped. Only the live
+        tracks are maintained by the tracker, the objects are not stored.
+
+        Args:
+            objects: a list of PyTrackObjects found in this frame
+            frame: the frame number
+
+        Returns:
+            a list of the track IDs that each object was assigned to
+        """
+
+        if not self.__initialised:
+            logger.info('Using default parameters')
+            self.configure({'MotionModel':'constant_velocity.json'})
+
+        self.__check_idle()
+        if not isinstance(objects, list):
+            objects = [objects]
+
+        for obj in objects:
+            if not isinstance(obj, btypes.PyTrackObject):
+                raise TypeError('track_object must be a PyTrackObject')
+
+        n_objects = len(objects)
+        obj_array = (btypes.PyTrackObject * n_objects)(*objects)
+        track_IDs = np.zeros((1, max(n_objects,1)), dtype='uint32')
+
+        ret = lib.stream(self.__engine, obj_array, n_objects, frame, track_IDs)
+        stats = self.__stats(ret)
+        utils.log_error(stats.error)
+
+        self.__frame_range[1] = max(frame, self.__frame_range[1])
+        return track_IDs[0,:n_objects].tolist()
+
+    def finalise(self):
+        """ Finish streaming and finalise the tracks """
+        self.__check_idle()
+        lib.finalise(self.__engine)
+
+    def retire(self, filename, window=10):
+        """ Retire tracks which have not been updated for a number of frames to
+        an archive file on disk. This bounds the memory used by the tracker for
+        very long experiments, since only the live tracks are kept in memory.
+        Archived tracks are loaded back on demand. Must be called after the
+        tracker has been configured.
+
+        Args:
+            filename: the archive file, which is removed when the tracker is
+                destroyed
+            window: the number of frames since the last update of a track
+                before it is retired, zero disables retirement
+        """
+        if not self.__initialised:
+            raise AttributeError('Tracker must be configured first.')
+        self.__check_idle()
+        ret = lib.set_retirement(self.__engine, str(filename), int(window))
+        utils.log_error(ret)
+
+    def checkpoint(self, filename, every=None):
+        """ Write the complete state of the tracker to a binary checkpoint, so
+        that long runs can be resumed. Optionally, write the checkpoint every
+        n frames while tracking, rather than just now. Finished tracks are
+        appended once to a second file (filename.tracks), so later checkpoints
+        to the same file only rewrite the live state.
+
+        Args:
+            filename: the checkpoint file
+            every: write a checkpoint every n frames during tracking, zero
+                disables periodic checkpoints
+        """
+        self.__check_idle()
+        if every is not None:
+            lib.set_checkpoint(self.__engine, str(filename), int(every))
+            return
+        ret = lib.checkpoint(self.__engine, str(filename))
+        utils.log_error(ret)
+
+    def restore(self, filename):
+        """ Restore the state of the tracker from a checkpoint. The tracker
+        must be configured first, with the same models used for the original
+        run. Tracking can then continue using track(), step() or stream().
+        Retirement of tracks needs to be set up again after restoring.
+        """
+        if not self.__initialised:
+            raise AttributeError('Tracker must be configured first.')
+        self.__check_idle()
+        ret = lib.restore(self.__engine, str(filename))
+        if utils.log_error(ret):
+            raise IOError('Unable to restore from {0:s}'.format(filename))
+
+    def hypotheses(self, params=None, frame_range=None):
+        """ Calculate and return hypotheses using the hypothesis engine. By
+        default, these are calculated for the tracks in the frame range of the
+        tracker """
         # raise NotImplementedError
         if not self.hypothesis_model:
             raise AttributeError('Hypothesis model has not been specified.')
 
-        n_hypotheses = lib.create_hypotheses(self.__engine,
-            self.hypothesis_model, self.frame_range[0], self.frame_range[1])
+        self.__check_idle()
 
-        # now get all of the hypotheses
-        h = [lib.get_hypothesis(self.__engine, h) for h in xrange(n_hypotheses)]
+        if frame_range is None:
+            frame_range = self.frame_range
+
+        n_hypotheses = lib.create_hypotheses(self.__engine,
+            self.hypothesis_model, frame_range[0], frame_range[1])
+
+        # report any divisions which were pruned
+        n_types = len(hypothesis.H_TYPES)
+        before = np.zeros((1,n_types),dtype='uint32')
+        after = np.zeros((1,n_types),dtype='uint32')
+        lib.get_hypothesis_counts(self.__engine, before, after)
+        for i, h_type in enumerate(hypothesis.H_TYPES):
+            if before[0,i] != after[0,i]:
+                logger.info(' - {0:s}: {1:d} (pruned from {2:d})'.format(h_type,
+                            after[0,i], before[0,i]))
+
+        # now get all of the hypotheses. If the hypotheses were updated rather
+        # than created, some IDs may be unused, so keep the ID of each one
+        h = []
+        for h_ID in xrange(n_hypotheses):
+            hypo = lib.get_hypothesis(self.__engine, h_ID)
+            if hypo.hypothesis >= len(hypothesis.H_TYPES): continue
+            hypo.hypothesis_ID = h_ID
+            h.append(hypo)
         return h
 
 
-    def optimise(self):
+    def optimise(self, window=None, overlap=None, time_limit=None,
+                 max_iterations=None):
         """ Optimise the tracks. This generates the hypotheses for track merges,
         branching etc, runs the optimiser and then performs track merging,
         removal of track fragments, renumbering and assignment of branches.
 
+        For long movies, the optimisation can be run over a sliding window of
+        frames. Each window overlaps the next, and only the hypotheses of the
+        tracks which end before the overlap are used to merge the tracks. A
+        merge is used once either of its parents ends before the overlap.
+        These decisions are then fixed when optimising the next window.
+
+        The optimisation can also be given a budget, in which case the best
+        feasible solution found within the budget is used. See TrackOptimiser.
+
+        Args:
+            window: (optional) the number of frames in each window
+            overlap: (optional) the number of frames shared with the next
+                window, which must be at least the time_thresh and theta_time
+                of the hypothesis model. Defaults to a quarter of the window.
+            time_limit: (optional) the time budget for the optimisation in
+                seconds, which is shared between the windows
+            max_iterations: (optional) the maximum number of local search
+                moves for each optimisation
+
         TODO(arl): need to check whether optimiser parameters have been
         specified
         """
+        if window is not None:
+            return self.__optimise_windows(window, overlap, time_limit,
+                                           max_iterations)
+
         logger.info('Calculating hypotheses from tracklets...')
         hypotheses = self.hypotheses()
+        optimised = self.__optimise_hypotheses(hypotheses, time_limit,
+                                               max_iterations)
+
+        # now that we have generated the optimal sequence, merge all of the
+        # tracks, delete fragments and assign divisions
+        h_array = np.array([h.hypothesis_ID for h in optimised], dtype='uint32')
+        h_array = h_array[np.newaxis,...]
+        lib.merge(self.__engine, h_array, len(optimised))
+
+        return optimised
+
+    def __optimise_hypotheses(self, hypotheses, time_limit=None,
+                              max_iterations=None):
+        """ Run the optimiser and return the selected hypotheses """
+        if not hypotheses: return []
 
         # set up the track optimiser
-        track_linker = optimiser.TrackOptimiser()
+        track_linker = optimiser.TrackOptimiser(time_limit, max_iterations)
         track_linker.hypotheses = hypotheses
         selected_hypotheses = track_linker.optimise()
         optimised = [hypotheses[i] for i in selected_hypotheses]
@@ -549,12 +873,61 @@ class BayesianTracker(object):
             logger.info(' - {0:s}: {1:d} (of {2:d})'.format(h_type,
                         h_optimise.count(h_type), h_original.count(h_type)))
         logger.info(' - TOTAL: {0:d} hypotheses'.format(len(hypotheses)))
+        if track_linker.status != 'optimal':
+            logger.info(' - GAP: {0:.3f} (log likelihood)'.format(
+                        track_linker.gap))
 
-        # now that we have generated the optimal sequence, merge all of the
-        # tracks, delete fragments and assign divisions
-        h_array = np.array(selected_hypotheses, dtype='uint32')
-        h_array = h_array[np.newaxis,...]
-        lib.merge(self.__engine, h_array, len(selected_hypotheses))
+        return optimised
+
+    def __optimise_windows(self, window, overlap, time_limit,
+                           max_iterations):
+        """ Optimise the tracks over a sliding window of frames """
+        model = self.hypothesis_model
+        if not model:
+            raise AttributeError('Hypothesis model has not been specified.')
+
+        # the decisions made before the overlap must not depend on the tracks
+        # after the window, or on the end of the window itself
+        min_overlap = int(np.ceil(max(model.time_thresh, model.theta_time)))
+        if overlap is None:
+            overlap = max(window // 4, min_overlap)
+        if overlap < min_overlap or overlap >= window:
+            raise ValueError('Window overlap must be between {0:d} and {1:d} '
+                             'frames'.format(min_overlap, window-1))
+
+        optimised = []
+        start, end = self.frame_range
+        if time_limit is not None:
+            deadline = time.time() + time_limit
+
+        while start <= end:
+            stop = min(start+window-1, end)
+            logger.info('Optimising frames {0:d} to {1:d}...'.format(start,
+                        stop))
+
+            # in the last window, everything is decided
+            decided = stop-overlap+1 if stop < end else end+1
+
+            # share the remaining time between the remaining windows
+            window_limit = None
+            if time_limit is not None:
+                n_windows = 1 + int(np.ceil(float(end-stop)/(window-overlap)))
+                window_limit = max(0., deadline-time.time()) / n_windows
+
+            hypotheses = self.hypotheses(frame_range=(start, stop))
+            selected = self.__optimise_hypotheses(hypotheses, window_limit,
+                                                  max_iterations)
+
+            # merge the tracks using the decisions before the overlap
+            h_array = np.array([h.hypothesis_ID for h in selected],
+                               dtype='uint32')
+            h_array = h_array[np.newaxis,...]
+            n_decided = lib.merge_before(self.__engine, h_array, len(selected),
+                                         decided)
+
+            decided_IDs = set(h_array[0,:n_decided].tolist())
+            optimised += [h for h in selected if h.hypothesis_ID in decided_IDs]
+            start = decided
 
         return optimised
 
@@ -567,6 +940,8 @@ class BayesianTracker(object):
         probably overkill.
         """
 
+        self.__check_idle()
+
         # get the size of the Kalman arrays
         sz_mu = self.motion_model.measurements + 1
         sz_cov = self.motion_model.measurements**2 + 1
@@ -614,12 +989,14 @@ class BayesianTracker(object):
         The user shouldn't really need this function, it should only be used
         when exporting to HDF5 files, since we need to make a new dummy group.
         """
+        self.__check_idle()
         return lib.get_dummy(self.__engine, dummy_idx)
 
     def get_fate(self, index):
         """ Return the fate of the track. The fates can be used to sort tracks
         by type, for example by tracks that terminate in division or apoptosis.
         """
+        self.__check_idle()
         return lib.get_fate(self.__engine, index)
 
     @property
@@ -639,7 +1016,11 @@ class BayesianTracker(object):
         """
         # log the output
         logger.info('Exporting {0:d} tracks to file...'.format(self.n_tracks))
-        if not filename.endswith('hdf5'):
+        if filename.endswith(constants.TRACK_STORE_EXT):
+            # the binary track store is written directly by the tracker
+            ret = lib.write_store(self.__engine, str(filename))
+            utils.log_error(ret)
+        elif not filename.endswith('hdf5'):
             utils.export(filename, self.tracks)
         else:
             utils.export_HDF(filename, self.refs, dummies=self.dummies)
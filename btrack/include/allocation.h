@@ -0,0 +1,34 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+
+#ifndef _ALLOCATION_H_INCLUDED_
+#define _ALLOCATION_H_INCLUDED_
+
+#include "defs.h"
+
+
+
+// Return the number of heap allocations made by the calling thread since the
+// library was loaded.
+// Counting is only enabled in builds with COUNT_ALLOCATIONS, otherwise this
+// always returns zero. The counting build replaces the global operator new,
+// and on Linux wraps malloc (which is used directly by Eigen) when linked with
+// -Wl,--wrap=malloc. Since these replacements affect the whole process, this
+// is intended for debugging only.
+unsigned long allocation_count();
+
+#endif
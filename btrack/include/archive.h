@@ -0,0 +1,101 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+
+#ifndef _ARCHIVE_H_INCLUDED_
+#define _ARCHIVE_H_INCLUDED_
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "motion.h"
+#include "tracklet.h"
+#include "io.h"
+
+
+
+// TrackArchive stores tracklets that have finished (i.e. are no longer active)
+// in an append-only file on disk, so that the memory used by the tracker is
+// bounded by the number of live tracks rather than the length of the
+// experiment. Tracklets are loaded back on demand from a memory mapping of the
+// file. While a loaded tracklet is referenced elsewhere, further loads return
+// the same instance, so that the track manager and the hypothesis engine
+// always see the same object. If the file cannot be written or read, the
+// archive records an error, and loads return a null pointer.
+class TrackArchive
+{
+  public:
+    TrackArchive() {};
+    ~TrackArchive() { close(); };
+
+    // open a new archive, the motion model is used as a template when
+    // restoring tracklets
+    bool open(const std::string &a_filename, const MotionModel &a_model);
+
+    // close the archive and remove the file
+    void close();
+
+    // is the archive open?
+    bool is_open() const { return m_writer.is_open(); }
+
+    // return false if the archive could not be written or read
+    bool good() const { return m_writer.good() && !m_error; }
+
+    // append a tracklet to the archive, returns the index of the tracklet
+    size_t store(const TrackletPtr &a_trk);
+
+    // load a tracklet by index, returns a null pointer on error
+    TrackletPtr load(const size_t a_idx);
+
+    // rewrite the archive, one tracklet at a time, keeping those for which
+    // a_keep returns true. a_keep may modify the tracklet before it is
+    // written, and is given its new index. Tracklets which are loaded keep
+    // their instances
+    bool compact(const std::function<bool(const TrackletPtr&,
+                                          const size_t)> &a_keep);
+
+    // return the number of tracklets in the archive
+    size_t size() const { return m_offsets.size(); }
+
+  private:
+    // the filename and a template motion model
+    std::string m_filename;
+    MotionModel m_model;
+
+    // writer and memory mapping of the archive file
+    BinaryWriter m_writer;
+    MappedFile m_mapping;
+
+    // offsets of each tracklet in the file
+    std::vector<uint64_t> m_offsets;
+
+    // set if the file could not be mapped or a record could not be read
+    bool m_error = false;
+
+    // references to tracklets which have been loaded, and the most recent one,
+    // which we keep alive since the same tracklet is usually requested
+    // several times in a row
+    std::vector<std::weak_ptr<Tracklet>> m_loaded;
+    TrackletPtr m_last;
+
+    // no copying of archives
+    TrackArchive(const TrackArchive&);
+    TrackArchive& operator=(const TrackArchive&);
+};
+
+#endif
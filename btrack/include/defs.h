@@ -19,6 +19,7 @@
 
 
 #include <limits>
+#include <cmath>
 
 // errors
 #define SUCCESS 900
@@ -32,6 +33,13 @@
 #define ERROR_prob_not_assign_out_of_range 908
 #define ERROR_not_defined 909
 #define ERROR_none 910
+#define ERROR_stream_out_of_order 911
+#define ERROR_stream_mixed_modes 912
+#define ERROR_file_IO 913
+#define ERROR_precision_not_supported 914
+#define ERROR_cancelled 915
+#define ERROR_tracking_in_progress 916
+#define ERROR_frame_times_not_increasing 917
 
 // constants
 const double kInfinity = std::numeric_limits<double>::infinity();
@@ -48,8 +56,21 @@ const double kRootTwoPi = std::sqrt(2.0*M_PI);
 #define DYNAMIC_ACCURACY false
 #define DIMS 3
 //#define FAST_COST_UPDATE false
+#ifndef BATCH_MOTION_UPDATE
+#define BATCH_MOTION_UPDATE true
+#endif
+#ifndef COUNT_ALLOCATIONS
+#define COUNT_ALLOCATIONS false
+#endif
 #define MAX_LOST 5
 #define MAX_SEARCH_RADIUS 10
+#define GATE_PROBABILITY 0. // disabled by default
+#define CHUNK_OVERLAP 10
+
+// precision (in bits) of the belief matrix
+#define PRECISION_single 32
+#define PRECISION_double 64
+#define DEFAULT_PRECISION PRECISION_double
 
 
 // reserve space for objects and tracks
@@ -73,6 +94,7 @@ const double kRootTwoPi = std::sqrt(2.0*M_PI);
 #define TYPE_Pdivn 4
 #define TYPE_Papop 5
 #define TYPE_Pmrge 6
+#define HYPOTHESIS_TYPES 7
 #define TYPE_Pdead 666
 #define TYPE_undef 999
 
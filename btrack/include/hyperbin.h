@@ -23,12 +23,13 @@
 #include <map>
 #include <cmath>
 #include <limits>
+#include <algorithm>
 
 #include "types.h"
 #include "tracklet.h"
 
 
-// Hash index for use with the hash cube
+// Hash index for use with the spatial hash
 struct HashIndex {
   int x = 0;
   int y = 0;
@@ -47,144 +48,97 @@ struct HashIndex {
 
 
 
-// A 4D hash (hyper) cube object.
-//
-// Essentially a way of binsorting trajectory data for easy lookup,
-// thus preventing excessive searching over non-local trajectories.
-// This is the primitive class which can be inherited for further
-// functionality
-//
-//
-template <typename T> class HashBin
-{
-public:
-
-  // constructors and desctructors
-  HashBin();
-  ~HashBin();
-
-  // set up a hashbin with specific xyz and n sized bins
-  HashBin(const unsigned int bin_xyz,
-          const unsigned int bin_n);
-
-  // return a 4D index into the hypercube using cartesian coordinates (and time)
-  HashIndex hash_index(const float x,
-                       const float y,
-                       const float z,
-                       const float n) const;
-
-  std::vector<T> get_contents(const HashIndex a_idx);
-
-//private:
-  // bin size x,y,z,t
-  float m_bin_size[4] = {0., 0., 0., 0.};
-
-  // a map to the tracks found in a certain bin
-  std::map<HashIndex, std::vector<T>> m_cube;
-
-};
-
-
+// a type to maintain the object index, object_ptr pair
+typedef std::pair<TrackObjectPtr, unsigned int> TrackObjectPtr_and_Index;
 
 
 
+// number of objects below which a branch of the ObjectTree is searched by
+// brute force
+#define OBJECT_TREE_LEAF_SIZE 8
 
 
 
-// A 4D hash (hyper) cube object.
-//
-// Essentially a way of binsorting trajectory data for easy lookup,
-// thus preventing excessive searching over non-local trajectories.
-//
-class HypercubeBin
+// A k-d tree of objects, built for each frame. Unlike a hash of fixed size
+// bins, the tree can return the objects within any radius of a point, so each
+// track can use a search radius matched to the uncertainty of its prediction.
+class ObjectTree
 {
 public:
-
   // constructors and destructors
-  HypercubeBin();
-  HypercubeBin(const unsigned int bin_xyz, const unsigned int bin_n);
-  ~HypercubeBin();
-
-  // return a 4D index into the hypercube using the object at the start or
-  // end of an exisiting track
-  HashIndex hash_index(TrackletPtr a_trk, const bool a_start) const;
-
-  // return a 4D index into the hypercube using an object
-  HashIndex hash_index(TrackObjectPtr a_obj) const {
-    return hash_index(a_obj->x, a_obj->y, a_obj->z, a_obj->t);
-  };
+  ObjectTree() {};
+  ~ObjectTree() {};
 
-  // return a 4D index into the hypercube using cartesian coordinates (and time)
-  HashIndex hash_index( const float x,
-                        const float y,
-                        const float z,
-                        const float n ) const;
+  // build the tree from a list of objects, the index of the object in the
+  // list is returned with each object
+  void build(const std::vector<TrackObjectPtr> &a_objects);
 
-  // bin sort a track in the hypercube, default behaviour is to add the tracks
-  // so that the bin stores the first object of the track. Use the full version
-  // with the a_start flag (set to false) to store the last known position of
-  // the track during lookup
-  void add_tracklet(TrackletPtr a_trk);
-  void add_tracklet(TrackletPtr a_trk, const bool a_start);
-
-  // return tracks found in a bin
-  std::vector<TrackletPtr> get(TrackletPtr a_trk, const bool a_start);
-  std::vector<TrackletPtr> get(TrackObjectPtr a_obj);
+  // return the objects within a_radius of a_point, ordered by index
+  void get(const Eigen::Vector3d &a_point,
+           const double a_radius,
+           std::vector<TrackObjectPtr_and_Index> &a_found) const;
 
 private:
-  // bin size x,y,z,t
-  float m_bin_size[4] = {0., 0., 0., 0.};
+  // a node of the tree, storing a copy of the position for fast lookup
+  struct Node {
+    double xyz[3];
+    unsigned int index;
+  };
 
-  // a map to the tracks found in a certain bin
-  std::map<HashIndex, std::vector<TrackletPtr>> m_cube;
+  // the nodes, in k-d order, and the objects
+  std::vector<Node> m_nodes;
+  std::vector<TrackObjectPtr> m_objects;
+
+  // recursively build and search the tree, for the range of nodes [lo, hi)
+  void build(const size_t lo, const size_t hi, const unsigned int a_depth);
+  void search(const size_t lo,
+              const size_t hi,
+              const unsigned int a_depth,
+              const double* a_point,
+              const double a_radius,
+              std::vector<TrackObjectPtr_and_Index> &a_found) const;
 };
 
 
 
-// a type to maintain the object index, object_ptr pair
-typedef std::pair<TrackObjectPtr, unsigned int> TrackObjectPtr_and_Index;
-
 
-
-class ObjectBin
+// A spatial hash of the tracklets which start (or end) within a moving window
+// of time. Tracklets are added when their start enters the window and removed
+// when it leaves, so that the memory used depends on the length of the window
+// rather than the length of the movie. Tracklets are referred to by their
+// index.
+class SweepLineBin
 {
 public:
   // constructors and destructors
-  ObjectBin();
-  ObjectBin(const unsigned int bin_xyz, const unsigned int bin_n);
-  ~ObjectBin();
+  SweepLineBin() {};
+  SweepLineBin(const float a_bin_xyz) : m_bin_size(a_bin_xyz) {};
+  ~SweepLineBin() {};
 
-  // return a 4D index into the hypercube using an object
-  HashIndex hash_index(TrackObjectPtr a_obj) const {
-    return hash_index(a_obj->x, a_obj->y, a_obj->z, a_obj->t);
-  };
+  // add or remove the start (or end) of a tracklet
+  void add(const Eigen::Vector3d &a_xyz, const unsigned int a_index);
+  void remove(const Eigen::Vector3d &a_xyz, const unsigned int a_index);
 
-  // return a 4D index into the hypercube using the object at the start or
-  // end of an exisiting track
-  HashIndex hash_index(TrackletPtr a_trk, const bool a_start) const;
+  // return the tracklets starting in the bins surrounding a point, ordered by
+  // index
+  void get(const Eigen::Vector3d &a_xyz,
+           std::vector<unsigned int> &a_found) const;
 
-  // return a 4D index into the hypercube using cartesian coordinates (and time)
-  HashIndex hash_index( const float x,
-                        const float y,
-                        const float z,
-                        const float n ) const;
-
-  // add an object
-  void add_object(TrackObjectPtr a_obj);
-
-  // return tracks found in a bin
-  std::vector<TrackObjectPtr_and_Index> get(TrackletPtr a_trk,
-                                            const bool a_start);
+  // number of tracklets in the window
+  size_t size() const { return m_size; };
 
 private:
-  // bin size x,y,z,t
-  float m_bin_size[4] = {0., 0., 0., 0.};
+  // return a 3D index into the bins, the time index is always zero
+  HashIndex hash_index(const Eigen::Vector3d &a_xyz) const;
+
+  // bin size xyz
+  float m_bin_size = 1.;
 
-  // number of objects
-  unsigned int n_objects = 0;
+  // number of tracklets
+  size_t m_size = 0;
 
-  // a map to the tracks found in a certain bin
-  std::map<HashIndex, std::vector<TrackObjectPtr_and_Index>> m_cube;
+  // a map to the tracklets found in a certain bin
+  std::map<HashIndex, std::vector<unsigned int>> m_bins;
 };
 
 
@@ -23,6 +23,8 @@
 #include <map>
 #include <cmath>
 #include <limits>
+#include <array>
+#include <unordered_map>
 
 #include "types.h"
 #include "tracklet.h"
@@ -102,8 +104,8 @@ class Hypothesis
                 trk_ID(a_trk) {};
 
     unsigned int hypothesis = TYPE_undef;
-    unsigned int ID;
-    double probability;
+    unsigned int ID = 0;
+    double probability = 0.;
 
     // store pointers to the tracks
     TrackletPtr trk_ID;
@@ -208,6 +210,77 @@ extern "C" struct PyHypothesisParams {
   double apoptosis_rate;
   bool relax;
   unsigned int hypotheses_to_generate;
+  unsigned int max_children;
+  unsigned int max_divisions;
+  double prune_absolute;
+  double prune_relative;
+  bool prune_dominated;
+};
+
+
+
+
+// Features of a tracklet used to score the hypotheses. These are calculated
+// once for each tracklet, rather than for every candidate pair
+struct TrackletFeatures {
+  // position, time and label of the first and last objects
+  Eigen::Vector3d first;
+  Eigen::Vector3d last;
+  unsigned int t_first;
+  unsigned int t_last;
+  unsigned int label_first;
+  unsigned int label_last;
+
+  // distance of the first and last objects from the border of the volume
+  float d_start;
+  float d_stop;
+
+  // false positive probability and log true positive probability
+  double P_FP;
+  double log_P_TP;
+
+  // number of apoptotic observations at the end of the track, and the
+  // resulting apoptosis probability
+  unsigned int n_apoptosis;
+  double P_dead;
+
+  // the start of the track has already been decided, either because it
+  // starts before the frame range or it is the child of a division or merge
+  bool fixed_start;
+
+  // the end of the track has already been decided, because it is a parent of
+  // a merge
+  bool fixed_end;
+
+  // tracks with the same features have the same hypotheses
+  bool operator==(const TrackletFeatures &o) const {
+    return first == o.first && last == o.last &&
+           t_first == o.t_first && t_last == o.t_last &&
+           label_first == o.label_first && label_last == o.label_last &&
+           d_start == o.d_start && d_stop == o.d_stop &&
+           P_FP == o.P_FP && n_apoptosis == o.n_apoptosis &&
+           P_dead == o.P_dead && fixed_start == o.fixed_start &&
+           fixed_end == o.fixed_end;
+  }
+};
+
+
+
+
+// A pair of tracks, the children of a putative division or the parents of a
+// putative merge, used when selecting the best pairs for a track
+struct TrackPair {
+  double probability;
+  unsigned int track_one;
+  unsigned int track_two;
+
+  // order by probability, ties are broken by the tracks so that the
+  // selection is reproducible
+  bool operator>(const TrackPair &o) const {
+    if (probability != o.probability) return probability > o.probability;
+    if (track_one != o.track_one) return track_one < o.track_one;
+    return track_two < o.track_two;
+  }
 };
 
 
@@ -236,7 +309,9 @@ double safe_log(double value);
 // HypothesisEngine
 //
 // Hypothesis generation for global track optimisation. Uses the tracks from
-// BayesianTracker to generate hypotheses.
+// BayesianTracker to generate hypotheses. The tracks are swept in order of
+// the time of their last object, with the starts of the tracks that could
+// follow on (within time_thresh) held in a spatial hash.
 //
 // Generates six different hypotheses, based on the track data provided:
 //
@@ -249,6 +324,34 @@ double safe_log(double value);
 //      one-to-one mapping
 //   5. P_branch: a division event where two new trajectories initialise
 //   6. P_dead: an apoptosis event
+//   7. P_merge: a merge event where two trajectories converge onto a third
+//
+// Every pair of link candidates of a track is a putative division (or merge),
+// which can produce a very large number of hypotheses in dense regions.
+// Setting max_children limits the pairs to the tracks with the best links, and
+// max_divisions keeps only the most probable pairs of each track.
+//
+// Once created, the hypotheses can be pruned before optimisation. Link,
+// division, apoptosis and merge hypotheses are removed if their log
+// probability is below prune_absolute, or more than prune_relative below the
+// best such hypothesis of the same track. With prune_dominated, hypotheses
+// which can be replaced by other hypotheses covering the same tracks with at
+// least the same probability (e.g. a link by a termination and an
+// initialisation) are also removed. The FP, init and term hypotheses are
+// never pruned, so the optimisation always has a feasible solution.
+//
+// Tracks which start before the frame range, or which are already the
+// children of a division, have a fixed start. These are given an
+// initialisation with a probability of one, and are not used as the children
+// of links, divisions or merges. This allows the hypotheses to be created for
+// a window of frames, following decisions made in earlier windows.
+//
+// The hypotheses can be updated after the tracks have changed, rather than
+// created again. Tracks are compared with the previous update using their
+// features, and only the hypotheses of the changed tracks, and of the tracks
+// which could link to or from them, are regenerated. The other hypotheses keep
+// their IDs, the IDs of removed hypotheses are reused by the new ones, and any
+// which are left over are returned as TYPE_undef.
 
 class HypothesisEngine
 {
@@ -263,8 +366,22 @@ class HypothesisEngine
     // add a track to the hypothesis engine
     void add_track(TrackletPtr a_trk);
 
+    // remove the tracks, before adding the tracks for an update
+    void clear_tracks() {
+      m_tracks.clear();
+    }
+
     // process the trajectories
     void create();
+
+    // update the hypotheses created previously, using the current tracks and
+    // frame range
+    void update(const unsigned int a_start_frame,
+                const unsigned int a_stop_frame);
+
+    // test whether the hypotheses have been created with these parameters,
+    // in which case they can be updated
+    bool compatible(const PyHypothesisParams &a_params) const;
     //void log_error(Hypothesis *h);
 
     // return the number of hypotheses
@@ -275,9 +392,16 @@ class HypothesisEngine
     // test whether we need to generate this hypothesis
     bool hypothesis_allowed(const unsigned int a_hypothesis_type) const;
 
+    // return the number of hypotheses of each type, before and after the
+    // divisions were pruned
+    void counts(unsigned int* a_before, unsigned int* a_after) const;
+
     // get a hypothesis
     // TODO(arl): return a reference?
     const PyHypothesis get_hypothesis(const unsigned int a_ID) const {
+      if (m_hypotheses[a_ID].hypothesis == TYPE_undef) {
+        return PyHypothesis(TYPE_undef, 0);
+      }
       return m_hypotheses[a_ID].get_hypothesis();
     }
 
@@ -292,36 +416,91 @@ class HypothesisEngine
     ImagingVolume volume;
 
   private:
+    // calculate the features of a track used by the probabilities
+    TrackletFeatures features(const TrackletPtr &a_trk) const;
+
     // calculation of probabilities
-    double P_TP(TrackletPtr a_trk) const;
-    double P_FP(TrackletPtr a_trk) const;
-    double P_init(TrackletPtr a_trk) const;
-    double P_term(TrackletPtr a_trk) const;
-    double P_link(TrackletPtr a_trk,
-                  TrackletPtr a_trk_link) const;
-    double P_link(TrackletPtr a_trk,
-                  TrackletPtr a_trk_link,
+    double P_FP(const TrackletPtr &a_trk) const;
+    double P_init(const TrackletFeatures &a_trk) const;
+    double P_term(const TrackletFeatures &a_trk) const;
+    double P_link(const TrackletFeatures &a_trk,
+                  const TrackletFeatures &a_trk_link,
                   float d,
                   float dt) const;
-    double P_branch(TrackletPtr a_trk,
-                    TrackletPtr a_trk_c0,
-                    TrackletPtr a_trk_c1) const;
-    double P_dead(TrackletPtr a_trk,
-                  const unsigned int n_dead) const;
-    double P_dead(TrackletPtr a_trk) const;
-    double P_merge(TrackletPtr a_trk_m0,
-                   TrackletPtr a_trk_m1,
-                   TrackletPtr a_trk) const;
-
-    // calculate the distance of a track from the border of the imaging volume
-    float dist_from_border( TrackletPtr a_trk, bool a_start ) const;
+    double P_branch(const TrackletFeatures &a_trk,
+                    const TrackletFeatures &a_trk_c0,
+                    const TrackletFeatures &a_trk_c1) const;
+    double P_dead(const TrackletFeatures &a_trk) const;
+    double P_merge(const TrackletFeatures &a_trk_m0,
+                   const TrackletFeatures &a_trk_m1,
+                   const TrackletFeatures &a_trk) const;
+
+    // calculate the distance of a point from the border of the imaging volume
+    float dist_from_border( const Eigen::Vector3d &a_xyz ) const;
 
     // storage for the trajectories
     unsigned int m_num_tracks = 0;
     std::vector<TrackletPtr> m_tracks;
 
-    // space to store a hash cube
-    HypercubeBin m_cube;
+    // the features of each of the trajectories, in the same order, and the
+    // index of each trajectory by ID
+    std::vector<TrackletFeatures> m_features;
+    std::unordered_map<unsigned int, unsigned int> m_index;
+
+    // calculate the features of all of the tracks
+    void calculate_features();
+
+    // sweep through the tracks, creating the hypotheses of the tracks which
+    // are flagged
+    void sweep(const std::vector<bool> &a_create);
+
+    // create the hypotheses of a track, using the tracks which start in the
+    // window following it as candidates for linking and division
+    void create_for_track(const unsigned int a_trk,
+                          const SweepLineBin &a_window);
+
+    // create the merge hypotheses of a track, using the tracks which end in
+    // the window preceding it as the candidate parents
+    void create_merges(const unsigned int a_trk,
+                       const SweepLineBin &a_window);
+
+    // remove unlikely and dominated hypotheses, starting from a_first. The
+    // hypotheses before a_first are kept
+    void prune(const size_t a_first);
+
+    // move the hypotheses added since a_first into the IDs which are free,
+    // and shorten the list if the IDs at the end are free
+    void reuse_free(const size_t a_first);
+
+    // count hypotheses of a track which were pruned
+    void count_pruned(const unsigned int a_ID,
+                      const unsigned int a_type,
+                      const unsigned int a_n);
+
+    // keep only the max_children candidates with the most probable links
+    void best_candidates();
+
+    // add a pair to m_pairs, keeping only the max_divisions most probable,
+    // and return the kept pairs to the order in which they were enumerated
+    void keep_pair(const TrackPair &a_pair);
+    void sort_pairs();
+
+    // candidate tracks with their link probabilities, and the pairs kept
+    std::vector<unsigned int> m_candidates;
+    std::vector<std::pair<double, unsigned int>> m_conflicts;
+    std::vector<TrackPair> m_pairs;
+
+    // number of hypotheses of each type which were pruned, in total and for
+    // each track so that they can be removed when the track is updated
+    unsigned int m_pruned[HYPOTHESIS_TYPES] = {0};
+    std::unordered_map<unsigned int,
+                       std::array<unsigned int, HYPOTHESIS_TYPES>> m_track_pruned;
+
+    // IDs of the hypotheses removed by an update which have not been reused
+    std::vector<size_t> m_free;
+
+    // have the hypotheses been created?
+    bool m_created = false;
 
     // store the hypothesis generation parameters
     PyHypothesisParams m_params;
@@ -19,6 +19,7 @@
 
 #include "eigen/Eigen/Dense"
 #include "types.h"
+#include "io.h"
 
 #include <vector>
 
@@ -45,6 +46,10 @@ class ObjectModel
     // make a prediction from the model
     Eigen::VectorXd predict();
 
+    // write or read the model matrices and the start state
+    void write_model(BinaryWriter &a_writer) const;
+    void read_model(BinaryReader &a_reader);
+
   private:
 
     // the emission and transition matrices
@@ -52,7 +57,7 @@ class ObjectModel
     Eigen::MatrixXd emission;
 
     // store the number of states of the system
-    unsigned int states;
+    unsigned int states = 0;
 
     // space to store the current state
     Eigen::VectorXd x_hat;
@@ -0,0 +1,166 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+#ifndef _IO_H_INCLUDED_
+#define _IO_H_INCLUDED_
+
+#include "eigen/Eigen/Dense"
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+// size of the write buffer used by the BinaryWriter
+#define WRITE_BUFFER_SIZE (1<<20)
+
+
+
+// BinaryWriter is a simple buffered writer for the binary file formats used by
+// the tracker (track archives, track stores and checkpoints). Data are written
+// in the native byte order, the files are not intended to be portable between
+// architectures. A failed write sets an error flag, which stays set until the
+// file is reopened and is reported by flush and close.
+class BinaryWriter
+{
+  public:
+    BinaryWriter() {};
+    ~BinaryWriter() { close(); };
+
+    // open a file for writing, optionally appending to an existing file
+    bool open(const std::string &a_filename, const bool a_append);
+    bool open(const std::string &a_filename) { return open(a_filename, false); }
+
+    // flush the buffer and close the file
+    bool close();
+
+    // flush the buffer to disk
+    bool flush();
+
+    // is the file open?
+    bool is_open() const { return m_file != NULL; }
+
+    // return false if any write has failed since the file was opened
+    bool good() const { return !m_error; }
+
+    // write some raw data
+    void write(const void* a_data, const size_t a_bytes);
+
+    // write a single value
+    template <typename T> void write(const T &a_value) {
+      write(&a_value, sizeof(T));
+    }
+
+    // write a matrix, with its dimensions
+    template <typename Derived>
+    void write_matrix(const Eigen::MatrixBase<Derived> &a_matrix) {
+      uint32_t rows = a_matrix.rows(), cols = a_matrix.cols();
+      write(rows);
+      write(cols);
+      for (uint32_t c=0; c<cols; c++) {
+        for (uint32_t r=0; r<rows; r++) {
+          write<double>(a_matrix(r,c));
+        }
+      }
+    }
+
+    // return the current offset into the file
+    uint64_t tell() const { return m_offset; }
+
+  private:
+    // the file and the write buffer
+    FILE* m_file = NULL;
+    std::vector<char> m_buffer;
+
+    // offset into the file
+    uint64_t m_offset = 0;
+
+    // set if a write has failed
+    bool m_error = false;
+
+    // no copying of writers
+    BinaryWriter(const BinaryWriter&);
+    BinaryWriter& operator=(const BinaryWriter&);
+};
+
+
+
+// BinaryReader reads data from a block of memory, for example a memory mapped
+// file. Reading beyond the end of the block sets an error flag and returns
+// zeros, rather than reading garbage.
+class BinaryReader
+{
+  public:
+    BinaryReader(const char* a_data, const uint64_t a_size) :
+                 m_data(a_data), m_size(a_size) {};
+    ~BinaryReader() {};
+
+    // read some raw data
+    void read(void* a_data, const size_t a_bytes);
+
+    // read a single value
+    template <typename T> T read() {
+      T value;
+      read(&value, sizeof(T));
+      return value;
+    }
+
+    // read a matrix written using write_matrix
+    Eigen::MatrixXd read_matrix();
+
+    // set the offset into the memory block
+    void seek(const uint64_t a_offset) { m_offset = a_offset; }
+    uint64_t tell() const { return m_offset; }
+
+    // return false if we have tried to read beyond the end of the data
+    bool good() const { return !m_error; }
+
+  private:
+    const char* m_data;
+    uint64_t m_size;
+    uint64_t m_offset = 0;
+    bool m_error = false;
+};
+
+
+
+// MappedFile maps a file into memory (read-only), so that records can be read
+// on demand without loading the complete file
+class MappedFile
+{
+  public:
+    MappedFile() {};
+    ~MappedFile() { close(); };
+
+    // map a file, closing any existing mapping first
+    bool open(const std::string &a_filename);
+    void close();
+
+    // return the data
+    const char* data() const { return m_data; }
+    uint64_t size() const { return m_size; }
+    bool is_open() const { return m_data != NULL; }
+
+  private:
+    const char* m_data = NULL;
+    uint64_t m_size = 0;
+
+    // no copying of mappings
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+#endif
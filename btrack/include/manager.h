@@ -19,33 +19,80 @@
 
 #include <vector>
 #include <stack>
+#include <memory>
+#include <functional>
+#include <map>
+#include <unordered_set>
 
 #include "types.h"
 #include "hypothesis.h"
 #include "tracklet.h"
+#include "archive.h"
 
 #define RESERVE_ALL_TRACKS 500000
 
+// version of the binary track store format
+#define TRACK_STORE_VERSION 1
+
+
+
+// Binary track store. The file starts with a header, followed by an index
+// with one entry per track, and then the columns of data for all of the track
+// objects (x, y, z, t, label, ref). The objects of each track are stored
+// contiguously in each column, starting at the offset given in the index, so
+// a single track can be read without loading the rest of the file.
+struct TrackStoreHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t n_tracks;
+  uint64_t n_entries;
+  uint64_t index_offset;
+  uint64_t x_offset;
+  uint64_t y_offset;
+  uint64_t z_offset;
+  uint64_t t_offset;
+  uint64_t label_offset;
+  uint64_t ref_offset;
+};
+
+struct TrackStoreIndex
+{
+  uint32_t ID;
+  uint32_t parent;
+  uint32_t root;
+  uint32_t fate;
+  uint64_t offset;
+  uint64_t length;
+};
+
 // make a joining hypothesis (note: LinkHypothesis is used by the tracker...)
 typedef std::pair<TrackletPtr, TrackletPtr> JoinHypothesis;
 
 // make a branching hypothesis
 typedef std::tuple<TrackletPtr, TrackletPtr, TrackletPtr> BranchHypothesis;
 
-// make a merging hypothesis
+// make a merging hypothesis, the merged track followed by its two parents
 typedef std::tuple<TrackletPtr, TrackletPtr, TrackletPtr> MergeHypothesis;
 
 
 // compare two hypotheses, used for sorting by start time
 bool compare_hypothesis_time(const Hypothesis &h_one, const Hypothesis &h_two);
 
-// merge two tracks
-void join_tracks(const TrackletPtr &parent_trk, const TrackletPtr &join_trk);
+// the time elapsed between two frames
+typedef std::function<double(const unsigned int,
+                             const unsigned int)> ElapsedTime;
+
+// merge two tracks, the motion model of the parent track is updated over the
+// time elapsed between the objects, which may span several frames
+void join_tracks(const TrackletPtr &parent_trk,
+                 const TrackletPtr &join_trk,
+                 const ElapsedTime &a_elapsed);
 
 // set a branch between the parent and children
 void branch_tracks(const BranchHypothesis &branch);
 
-// merge tracks
+// set the parents of a merged track
 void merge_tracks(const MergeHypothesis &merge);
 
 
@@ -65,14 +112,17 @@ class TrackManager
     };
     virtual ~TrackManager() {};
 
-    // return the number of tracks
+    // return the number of tracks, including any that have been archived
     size_t size() const {
-      return this->m_tracks.size();
+      return n_archived() + this->m_tracks.size();
     }
 
-    // return a track by index
+    // return a track by index, archived tracks come first and are loaded from
+    // disk on demand. Returns a null pointer if the archive cannot be read
     inline TrackletPtr operator[] (const unsigned int idx) const {
-      return m_tracks[idx];
+      size_t n = n_archived();
+      if (idx < n) return m_archive->load(idx);
+      return m_tracks[idx-n];
     };
 
     // return a dummy object by index
@@ -90,16 +140,38 @@ class TrackManager
 
     // test whether the track manager is empty
     inline bool empty() const {
-      return m_tracks.empty();
+      return size() == 0;
+    }
+
+    // set an archive to store finished tracks
+    void set_archive(const std::shared_ptr<TrackArchive> &a_archive) {
+      m_archive = a_archive;
+    }
+
+    // move tracks that have not been updated within a_window frames of
+    // a_frame to the archive, returns the number of tracks retired
+    size_t retire(const unsigned int a_frame, const unsigned int a_window);
+
+    // return false if the archive could not be written or read
+    bool good() const {
+      return !m_archive || m_archive->good();
     }
 
     // finalise the track output, giving dummy objects their unique (orthogonal)
     // IDs for later retrieval, and any other cleanup required.
     void finalise();
 
+    // counter which changes whenever finished tracks may have been modified,
+    // by merging or finalising the tracks
+    unsigned int revision() const { return m_revision; }
+
     // merges all tracks that have a link hypothesis, renumbers others and sets
-    // parent and root properties
-    void merge(const std::vector<Hypothesis> &a_hypotheses);
+    // parent and root properties. a_elapsed gives the time between frames
+    void merge(const std::vector<Hypothesis> &a_hypotheses,
+               const ElapsedTime &a_elapsed);
+
+    // write all of the tracks to a binary track store
+    unsigned int write_store(const std::string &a_filename) const;
 
   private:
 
@@ -113,9 +185,30 @@ class TrackManager
     // a vector of dummy objects
     std::vector<TrackObjectPtr> m_dummies;
 
-    // make hypothesis maps
-    HypothesisMap<JoinHypothesis> m_links;
-    HypothesisMap<BranchHypothesis> m_branches;
+    // revision of the finished tracks
+    unsigned int m_revision = 0;
+
+    // archive of finished tracks, which is shared between copies of the
+    // manager
+    std::shared_ptr<TrackArchive> m_archive;
+
+    // the number of tracks in the archive
+    size_t n_archived() const {
+      return m_archive ? m_archive->size() : 0;
+    }
+
+    // remove the merged tracks from the archive
+    bool compact_archive();
+
+    // archived dummy objects, stored as the archive index of the track and the
+    // position of the dummy within the track
+    std::vector<std::pair<size_t, size_t>> m_archived_dummies;
+
+    // the link, branch and merge hypotheses of each track, keyed by the track
+    // ID (for a merge, the ID of the merged track)
+    std::map<unsigned int, JoinHypothesis> m_links;
+    std::map<unsigned int, BranchHypothesis> m_branches;
+    std::map<unsigned int, MergeHypothesis> m_merges;
 };
 
 #endif
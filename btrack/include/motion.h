@@ -19,6 +19,7 @@
 
 #include "eigen/Eigen/Dense"
 #include "types.h"
+#include "io.h"
 
 #include <vector>
 #include <iostream>
@@ -27,6 +28,33 @@
 #include <limits>
 #include <algorithm>
 #include <set>
+#include <memory>
+#include <mutex>
+
+// transitions are cached for intervals quantised to this fraction of the time
+// step of the model, up to a maximum number of distinct intervals
+#define TRANSITION_RESOLUTION 1000000
+#define TRANSITION_CACHE_SIZE 4096
+
+
+
+// the state transition and process noise matrices for an interval of time
+struct Transition
+{
+  Eigen::MatrixXd A;
+  Eigen::MatrixXd Q;
+};
+
+// a cache of transitions, keyed on the quantised length of the interval. The
+// cache is shared by all of the copies of a motion model, which may belong to
+// trackers running on different threads
+struct TransitionCache
+{
+  std::mutex lock;
+  std::map<long long, Transition> transitions;
+};
+
+
 
 // Implements a Kalman filter for motion modelling in the tracker. Note that we
 // do not implement the 'control' updates from the full Kalman filter
@@ -43,12 +71,20 @@ class MotionModel
     // Q: Estimated error in process
     // R: Estimated error in measurements
     // Certain parameters are inferred from the shapes of the matrices, such as
-    // the number of states and measurements
+    // the number of states and measurements. The matrices describe a single
+    // time step of length dt (one by default), the transitions for other
+    // intervals are derived from them
     MotionModel(const Eigen::MatrixXd &A,
                 const Eigen::MatrixXd &H,
                 const Eigen::MatrixXd &P,
                 const Eigen::MatrixXd &R,
-                const Eigen::MatrixXd &Q);
+                const Eigen::MatrixXd &Q,
+                const double dt);
+    MotionModel(const Eigen::MatrixXd &A,
+                const Eigen::MatrixXd &H,
+                const Eigen::MatrixXd &P,
+                const Eigen::MatrixXd &R,
+                const Eigen::MatrixXd &Q) : MotionModel(A, H, P, R, Q, 1.) {};
 
     // Default destructor
     ~MotionModel() {};
@@ -56,13 +92,40 @@ class MotionModel
     // Setup the filter from a new object, set x_hat to the object position
     void setup(const TrackObjectPtr new_object);
 
-    // run an update of the Kalman filter using a new object observation
-    void update(const TrackObjectPtr new_object);
+    // run an update of the Kalman filter using a new object observation (or
+    // dummy), a_dt after the previous update
+    void update(const TrackObjectPtr new_object, const double a_dt);
+    void update(const TrackObjectPtr new_object) {
+      update(new_object, dt);
+    }
+
+    // return the length of a single time step of the model
+    double time_step() const { return dt; }
+
+    // is an interval a single time step of the model?
+    bool single_step(const double a_dt) const {
+      return a_dt == dt ||
+             std::llround(a_dt / dt * TRANSITION_RESOLUTION) ==
+             TRANSITION_RESOLUTION;
+    }
+
+    // get the state transition and process noise for an interval a_dt. For a
+    // single time step these are the model matrices, otherwise they are taken
+    // from the cache (or computed into a_scratch if the cache is full)
+    const Transition& transition(const double a_dt,
+                                 Transition &a_scratch) const;
+
+    // get the positional covariance of the filter propagated forward by a_dt
+    Eigen::Matrix3d position_covariance(const double a_dt) const;
 
     // get the Kalman filter prediction
     Prediction predict() const;
 
-    // get the motion vector
+    // get the positional part of the Kalman filter prediction
+    PositionPrediction predict_position() const;
+
+    // get the motion vector, the change in position per unit time at the last
+    // update
     Eigen::Vector3d get_motion_vector() const {
       return motion_vector;
     }
@@ -74,7 +137,20 @@ class MotionModel
       *s = states;
      };
 
+    // write or read the current state of the filter (x_hat, P and the motion
+    // vector). The model matrices themselves are not stored, since they are
+    // shared by every tracklet
+    void write_state(BinaryWriter &a_writer) const;
+    void read_state(BinaryReader &a_reader);
+
+    // write or read the model matrices, reading resets the state of the filter
+    void write_model(BinaryWriter &a_writer) const;
+    void read_model(BinaryReader &a_reader);
+
   private:
+    // the batch engine works directly on the filter state
+    friend class MotionBatch;
+
     // matrices for Kalman filter
     Eigen::MatrixXd A;
     Eigen::MatrixXd H;
@@ -101,7 +177,72 @@ class MotionModel
     bool initialised = false;
 
     // time step which will default to one
-    double dt;
+    double dt = 1.;
+
+    // the transitions for other intervals
+    std::shared_ptr<TransitionCache> cache;
+
+    // compute the transition for an interval of a_steps time steps
+    void compute_transition(const double a_steps, Transition &a_out) const;
+};
+
+
+
+// MotionBatch runs the Kalman filter predict and update steps for many
+// motion models at once. The states and covariances of the queued models are
+// gathered into structure-of-arrays form, with one lane per model, so that the
+// inner loops run over the models and can be vectorised by the compiler. The
+// results are written back to each model, so the models behave exactly as if
+// they had been updated individually. All of the queued models must share the
+// same model matrices, which is true for all tracklets in a tracker.
+class MotionBatch
+{
+  public:
+    MotionBatch() {};
+    ~MotionBatch() {};
+
+    // queue an update of a model with a new observation or dummy, a_dt after
+    // the previous update of the model
+    void push(MotionModel* a_model, const TrackObjectPtr &a_obj,
+              const double a_dt);
+    void push(MotionModel* a_model, const TrackObjectPtr &a_obj) {
+      push(a_model, a_obj, a_model->time_step());
+    }
+
+    // run the updates of all queued models and clear the queue. Models with
+    // different intervals are run in separate groups
+    void run();
+
+    // return the number of queued models
+    size_t size() const { return m_models.size(); }
+
+  private:
+    // the queued models, their observations and intervals
+    std::vector<MotionModel*> m_models;
+    std::vector<TrackObjectPtr> m_objects;
+    std::vector<double> m_dts;
+
+    // the queue while the groups are being run
+    std::vector<MotionModel*> m_all_models;
+    std::vector<TrackObjectPtr> m_all_objects;
+    std::vector<double> m_all_dts;
+
+    // run the updates of the queued models, which all share the interval a_dt
+    void run_group(const double a_dt);
+
+    // transition for the current group
+    Transition m_transition;
+
+    // order of the lanes, models with observations come first
+    std::vector<size_t> m_lanes;
+
+    // model matrices, stored row major
+    std::vector<double> m_A, m_H, m_Q, m_R;
+
+    // workspace, in structure-of-arrays form: element (i,j) of a matrix for
+    // lane l is stored at [(i*cols+j)*n + l]
+    std::vector<double> m_x, m_xp, m_P, m_AP, m_Pp;
+    std::vector<double> m_z, m_PHt, m_HP, m_S, m_L, m_K, m_tmp;
 };
 
 #endif
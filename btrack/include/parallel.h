@@ -0,0 +1,111 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+
+#ifndef _PARALLEL_H_INCLUDED_
+#define _PARALLEL_H_INCLUDED_
+
+#include <vector>
+#include <functional>
+
+#include "types.h"
+#include "tracklet.h"
+
+
+
+// run a_function(i) for each task i in [0, a_tasks) using up to a_threads
+// threads, and return once all of the tasks have finished. The tasks are dealt
+// out to a queue for each thread, most expensive first if a_costs (one per
+// task) is given, otherwise in order. A thread which runs out of tasks steals
+// from the back of the other queues
+void parallel_for(const size_t a_tasks,
+                  const unsigned int a_threads,
+                  const std::function<void(const size_t)> &a_function,
+                  const std::vector<double> &a_costs);
+
+void parallel_for(const size_t a_tasks,
+                  const unsigned int a_threads,
+                  const std::function<void(const size_t)> &a_function);
+
+
+
+// Stitch the tracks found independently in overlapping temporal chunks into a
+// single set of tracks.
+//
+// Chunk k is responsible for the frames [a_boundaries[k], a_boundaries[k+1]),
+// but it is tracked over a longer range so that it overlaps the neighbouring
+// chunks by a_overlap frames on either side. Each track is cut to the frames
+// that its chunk is responsible for, and the pieces are joined across each
+// boundary by matching tracks from the two chunks that share observations in
+// the overlap, i.e. within a_overlap frames of the boundary. Matching is a
+// greedy assignment by the number of shared observations, with ties broken by
+// the order of the tracks, so the result is deterministic. Every observation
+// ends up in exactly one of the returned tracks, which have no IDs.
+std::vector<TrackletPtr> stitch_chunks(
+    const std::vector<std::vector<TrackletPtr>> &a_chunks,
+    const std::vector<unsigned int> &a_boundaries,
+    const unsigned int a_overlap);
+
+
+
+// A regular grid of tiles covering the imaging volume in x and y. Each tile is
+// responsible for the observations which lie inside it, observations outside
+// of the volume belong to the nearest tile.
+struct TileGrid
+{
+  double x0 = 0.;
+  double y0 = 0.;
+  double width = 0.;
+  double height = 0.;
+  unsigned int nx = 1;
+  unsigned int ny = 1;
+
+  TileGrid(const ImagingVolume &a_volume,
+           const unsigned int a_nx,
+           const unsigned int a_ny);
+
+  // return the number of tiles
+  size_t size() const { return nx*ny; }
+
+  // return the column or row of the tile containing a coordinate
+  unsigned int column(const double a_x) const;
+  unsigned int row(const double a_y) const;
+
+  // return the index of the tile responsible for an observation
+  size_t tile(const TrackObjectPtr &a_obj) const {
+    return row(a_obj->y)*nx + column(a_obj->x);
+  }
+};
+
+
+
+// Stitch the tracks found independently in overlapping spatial tiles into a
+// single set of tracks.
+//
+// Each tile is tracked with a halo, so that tracks crossing the border of the
+// tile are seen by both of the neighbouring tiles. Each track is cut into the
+// pieces that lie in its own tile (dummies belong to the tile of the preceding
+// observation), and the pieces are joined where a track in either tile links
+// the last observation of one piece to the first observation of another.
+// Matching is a greedy assignment by the number of tiles which agree on the
+// link, with ties broken by the order of the pieces, so the result is
+// deterministic. Every observation ends up in exactly one of the returned
+// tracks, which have no IDs.
+std::vector<TrackletPtr> stitch_tiles(
+    const std::vector<std::vector<TrackletPtr>> &a_tiles,
+    const TileGrid &a_grid);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+#ifndef _SYNTHETIC_H_INCLUDED_
+#define _SYNTHETIC_H_INCLUDED_
+
+#include <random>
+#include <vector>
+
+#include "wrapper.h"
+
+// Synthetic data for the benchmark and the checks. These are not part of the
+// library, and are only used by the programs built alongside it.
+
+
+
+// the constant velocity model from models/constant_velocity.json
+inline void set_constant_velocity(InterfaceWrapper &a_interface)
+{
+  double A[36] = {1,0,0,1,0,0,
+                  0,1,0,0,1,0,
+                  0,0,1,0,0,1,
+                  0,0,0,1,0,0,
+                  0,0,0,0,1,0,
+                  0,0,0,0,0,1};
+  double H[18] = {1,0,0,0,0,0,
+                  0,1,0,0,0,0,
+                  0,0,1,0,0,0};
+  double P[36] = {0};
+  double Q[36];
+  double R[9] = {1,0,0,
+                 0,1,0,
+                 0,0,1};
+
+  for (size_t i=0; i<6; i++) P[i*7] = 1.;
+  for (size_t i=0; i<36; i++) Q[i] = 1.;
+
+  a_interface.set_motion_model(3, 6, A, H, P, Q, R, 1., 1., 5, 0.1);
+}
+
+
+
+// make a single object
+inline PyTrackObject synthetic_object(const unsigned int a_ID,
+                                      const double a_x,
+                                      const double a_y,
+                                      const unsigned int a_t)
+{
+  PyTrackObject obj = PyTrackObject();
+  obj.ID = a_ID;
+  obj.x = a_x;
+  obj.y = a_y;
+  obj.z = 0.;
+  obj.t = a_t;
+  obj.dummy = false;
+  obj.label = 0;
+  obj.states = 0;
+  obj.probability = NULL;
+  return obj;
+}
+
+
+
+// cells moving across a 1600x1600 field of view with a random constant
+// velocity plus some noise. A fraction a_missed of the observations are
+// missed, so that the tracks are occasionally lost. The objects are in order
+// of frame
+inline std::vector<PyTrackObject> random_movie(const unsigned int a_frames,
+                                               const unsigned int a_tracks,
+                                               const unsigned int a_seed,
+                                               const double a_missed)
+{
+  std::mt19937 rng(a_seed);
+  std::uniform_real_distribution<double> position(0., 1600.);
+  std::uniform_real_distribution<double> velocity(-1., 1.);
+  std::uniform_real_distribution<double> missed(0., 1.);
+  std::normal_distribution<double> noise(0., 0.2);
+
+  std::vector<double> x(a_tracks), y(a_tracks), vx(a_tracks), vy(a_tracks);
+  for (size_t i=0; i<a_tracks; i++) {
+    x[i] = position(rng);
+    y[i] = position(rng);
+    vx[i] = velocity(rng);
+    vy[i] = velocity(rng);
+  }
+
+  std::vector<PyTrackObject> objects;
+  unsigned int ID = 0;
+  for (unsigned int t=0; t<a_frames; t++) {
+    for (size_t i=0; i<a_tracks; i++) {
+      x[i] += vx[i] + noise(rng);
+      y[i] += vy[i] + noise(rng);
+
+      // miss a small fraction of the observations
+      if (missed(rng) < a_missed) continue;
+
+      objects.push_back( synthetic_object(ID++, x[i], y[i], t) );
+    }
+  }
+
+  return objects;
+}
+
+
+
+// a simple movie, with cells on a grid a_spacing apart which all move with
+// the same constant velocity (a_vx, a_vy) and are never missed. Every cell
+// should give a single track covering all of the frames
+inline std::vector<PyTrackObject> grid_movie(const unsigned int a_frames,
+                                             const unsigned int a_nx,
+                                             const unsigned int a_ny,
+                                             const double a_spacing,
+                                             const double a_vx,
+                                             const double a_vy)
+{
+  std::vector<PyTrackObject> objects;
+  unsigned int ID = 0;
+  for (unsigned int t=0; t<a_frames; t++) {
+    for (unsigned int j=0; j<a_ny; j++) {
+      for (unsigned int i=0; i<a_nx; i++) {
+        double x = a_spacing*(i+0.5) + a_vx*t;
+        double y = a_spacing*(j+0.5) + a_vy*t;
+        objects.push_back( synthetic_object(ID++, x, y, t) );
+      }
+    }
+  }
+
+  return objects;
+}
+
+#endif
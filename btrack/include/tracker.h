@@ -26,6 +26,8 @@
 #include <algorithm>
 #include <set>
 #include <ctime>
+#include <atomic>
+#include <functional>
 
 #include "types.h"
 #include "motion.h"
@@ -34,6 +36,16 @@
 #include "manager.h"
 #include "defs.h"
 #include "hyperbin.h"
+#include "io.h"
+#include "allocation.h"
+#include "parallel.h"
+
+// version of the checkpoint format
+#define CHECKPOINT_VERSION 6
+
+// the digits of the radix sort of the objects by frame
+#define FRAME_RADIX_BITS 8
+#define FRAME_RADIX (1u << FRAME_RADIX_BITS)
 
 
 // #define PROB_NOT_ASSIGN 0.01
@@ -58,11 +70,104 @@
 
 
 
+// return the value of the chi-squared distribution (with three degrees of
+// freedom) which is exceeded with probability a_probability
+double chi2_threshold(const double a_probability);
+
+
+
 // a pair for hypotheses, track/object ID and probability
 typedef std::pair<unsigned int, double> LinkHypothesis;
 
 
 
+// the belief matrix and the object positions, in single or double precision,
+// mapped onto scratch buffers owned by the tracker
+template <typename T>
+using BeliefMap = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
+template <typename T>
+using PositionMap = Eigen::Map<Eigen::Matrix<T, 3, Eigen::Dynamic>>;
+
+// scratch buffers for the belief update, kept between frames
+template <typename T>
+struct BeliefScratch
+{
+  std::vector<T> belief;
+  std::vector<T> positions;
+};
+
+// scratch arrays for linking. For each track, the object it would like to link
+// to, which is n_objects if the track would rather be lost. For each object,
+// the best of the tracks competing for it, its log probability and the number
+// of competing tracks. Plus flags for the tracks which have been linked or lost
+struct LinkScratch
+{
+  std::vector<unsigned int> best_object;
+  std::vector<unsigned int> track;
+  std::vector<double> prob;
+  std::vector<unsigned int> count;
+  std::vector<char> used;
+};
+
+// find the best object for each track from the log belief matrix, with a row
+// for each object and a final row for being lost. Conflicts are resolved by
+// keeping the first track with the highest log probability for each object
+template <typename T>
+void resolve_links(const BeliefMap<T> &a_belief, LinkScratch &a_links)
+{
+  const size_t n_objects = a_belief.rows()-1;
+  const size_t n_tracks = a_belief.cols();
+
+  a_links.best_object.resize(n_tracks);
+  a_links.track.assign(n_objects, 0);
+  a_links.prob.assign(n_objects, -kInfinity);
+  a_links.count.assign(n_objects, 0);
+
+  for (size_t trk=0; trk<n_tracks; trk++) {
+
+    // get the object with the best match for this track, the belief is a
+    // log probability, but the ordering is the same...
+    typename BeliefMap<T>::Index best_object;
+    double prob = a_belief.col(trk).maxCoeff(&best_object);
+    a_links.best_object[trk] = best_object;
+
+    // this track is probably lost
+    if (size_t(best_object) == n_objects) continue;
+
+    // this is a putative linkage, resolve any conflict as we go
+    if (a_links.count[best_object] == 0 || prob > a_links.prob[best_object]) {
+      a_links.track[best_object] = trk;
+      a_links.prob[best_object] = prob;
+    }
+    a_links.count[best_object]++;
+  }
+}
+
+// progress of the tracking, updated after every frame. The values are atomic,
+// so they can be read from another thread while the tracking is running
+struct TrackProgress
+{
+  std::atomic<unsigned int> current_frame{0};
+  std::atomic<unsigned int> n_active{0};
+  std::atomic<unsigned int> n_tracks{0};
+  std::atomic<float> t_update_belief{0.f};
+  std::atomic<float> t_update_link{0.f};
+  std::atomic<bool> complete{false};
+  std::atomic<bool> cancelled{false};
+};
+
+// the quantities of a track prediction used to score candidate linkages
+template <typename T> struct BeliefPrediction;
+
+
+
+class BayesianTracker;
+
+// a set of independent trackers, each of which tracks part of the data
+typedef std::vector<std::unique_ptr<BayesianTracker>> TrackerParts;
+
+
+
 // BayesianTracker is a multi object tracking algorithm, specifically
 // used to reconstruct tracks in crowded fields. Here we use a probabilistic
 // network of information to perform the trajectory linking. This method uses
@@ -118,6 +223,25 @@ public:
     this->max_search_radius = search_radius;
   }
 
+  // set the probability floor for gating. Candidate objects whose squared
+  // Mahalanobis distance from the prediction would be exceeded with less than
+  // this probability are rejected before scoring. Zero disables gating
+  void set_gating(const double a_probability) {
+    this->gate_probability = a_probability;
+    this->gate_threshold = chi2_threshold(a_probability);
+  }
+
+  // set the precision of the belief matrix, either PRECISION_single or
+  // PRECISION_double. The tracklets and motion models are always stored in
+  // double precision
+  unsigned int set_precision(const unsigned int a_precision) {
+    if (a_precision != PRECISION_single && a_precision != PRECISION_double) {
+      return ERROR_precision_not_supported;
+    }
+    this->precision = a_precision;
+    return SUCCESS;
+  }
+
   // add new objects
   unsigned int xyzt(const double* xyzt);
   unsigned int append(const PyTrackObject& new_object);
@@ -134,15 +258,100 @@ public:
   // run the tracking on the entire set
   void track_all();
 
+  // run the tracking on the entire set, splitting the frames into a_threads
+  // temporal chunks which are tracked in parallel and then stitched together.
+  // Neighbouring chunks overlap by a_overlap frames either side of their
+  // boundary, which is used to match the tracks between the chunks. Falls
+  // back to track_all if the movie is too short to split
+  unsigned int track_chunked(const unsigned int a_threads,
+                             const unsigned int a_overlap);
+
+  // track the complete set of objects by splitting the imaging volume into
+  // a_tiles_x by a_tiles_y tiles, which are tracked in parallel using up to
+  // a_threads threads. Each tile also tracks the objects within
+  // max_search_radius of its border, which are used to match the tracks that
+  // cross between the tiles
+  unsigned int track_tiled(const unsigned int a_tiles_x,
+                           const unsigned int a_tiles_y,
+                           const unsigned int a_threads);
+
   // move the tracking forward by n iterations, used in interactive mode
   void step() { step(1); };
   void step(const unsigned int n_steps);
 
+  // streaming mode, track a single frame of objects as it is acquired. The ID
+  // of the tracklet that each object was assigned to is returned in
+  // a_track_IDs, which should have space for a_n_objects entries. Frames must
+  // be supplied in increasing order, but may be missing (i.e. empty). A frame
+  // which is out of order is rejected, and the error is reported in the
+  // statistics until the next valid frame
+  unsigned int stream(const PyTrackObject* a_objects,
+                      const unsigned int a_n_objects,
+                      const unsigned int a_frame,
+                      unsigned int* a_track_IDs);
+
+  // finish streaming, trims and finalises the tracks
+  void finalise();
+
+  // set the imaging volume, useful in streaming mode where we cannot infer
+  // the volume from the observations in advance
+  void set_volume(const double* a_volume);
+
+  // the time elapsed between two frames, using the acquisition times if these
+  // have been set
+  double elapsed(const unsigned int a_from, const unsigned int a_to) const;
+
+  // set the acquisition time of each of the frames [0, a_n_frames), in the
+  // same units as the time step of the motion model. The times must not
+  // decrease. Without frame times, the frames are a single time step apart
+  unsigned int set_frame_times(const double* a_times,
+                               const unsigned int a_n_frames);
+
+  // retire tracks that have not been updated for a_window frames to an archive
+  // file on disk, bounding the memory used for long experiments. Must be set
+  // after the motion model. A window of zero disables retirement
+  unsigned int set_retirement(const std::string &a_filename,
+                              const unsigned int a_window);
+
+  // write the complete state of the tracker to a binary snapshot, or restore
+  // the state from one. Finished tracks are appended once to a separate file
+  // (a_filename with a .tracks extension), and only the live state is
+  // rewritten by later checkpoints to the same file. The live state is written
+  // to a temporary file and then renamed, so an existing checkpoint is never
+  // left half written. A failed restore leaves the tracker unchanged
+  unsigned int checkpoint(const std::string &a_filename);
+  unsigned int restore(const std::string &a_filename);
+
+  // write a checkpoint every a_interval frames while tracking, zero disables
+  // checkpointing
+  void set_checkpoint(const std::string &a_filename,
+                      const unsigned int a_interval) {
+    checkpoint_file = a_filename;
+    checkpoint_interval = a_interval;
+  }
+
   // get the number of tracks
   inline unsigned int size() const {
     return tracks.size();
   };
 
+  // get the number of objects waiting to be tracked, or already tracked
+  inline size_t n_queued() const {
+    return objects.size();
+  };
+
+  // get the first and last frames of the objects, zero if there are none
+  unsigned int first_frame() const {
+    return objects.empty() ? 0 : min_frame;
+  };
+  unsigned int last_frame() const {
+    return objects.empty() ? 0 : max_frame;
+  };
+
+  // copy the motion and object models and the tracking parameters from another
+  // tracker. The imaging volume is not copied
+  void copy_settings(const BayesianTracker &a_tracker);
+
   // return the Euclidean distance between object and trajectory
   double euclidean_dist(const size_t trk, const size_t obj) const {
     Eigen::Vector3d dxyz = tracks[trk]->position()-new_objects[obj]->position();
@@ -152,17 +361,22 @@ public:
   // track maintenance
   bool purge();
 
-  // calculate the cost matrix
-  void cost(Eigen::Ref<Eigen::MatrixXd> belief,
+  // calculate the belief matrix, as log probabilities
+  template <typename T>
+  void cost(BeliefMap<T> &belief,
+            const PositionMap<T> &positions,
             const size_t n_tracks,
             const size_t n_objects);
 
-  void cost_FAST(Eigen::Ref<Eigen::MatrixXd> belief,
+  template <typename T>
+  void cost_FAST(BeliefMap<T> &belief,
+            const PositionMap<T> &positions,
             const size_t n_tracks,
             const size_t n_objects);
 
-  // calculate linkages based on belief matrix
-  void link(Eigen::Ref<Eigen::MatrixXd> belief,
+  // calculate linkages based on the log belief matrix
+  template <typename T>
+  void link(const BeliefMap<T> &belief,
             const size_t n_tracks,
             const size_t n_objects);
 
@@ -177,6 +391,25 @@ public:
     return &statistics;
   }
 
+  // fill in a snapshot of the progress of the tracking, this can be called
+  // from another thread while the tracking is running
+  void get_progress(PyTrackProgress* a_progress) const;
+
+  // request that track_all stops at the end of the current frame, the
+  // tracking then finishes with ERROR_cancelled and the tracks found so far
+  // are finalised. Can be called from another thread
+  void cancel() {
+    progress.cancelled = true;
+  }
+
+  // clear a cancellation request, and the error left by a cancelled run,
+  // before starting the tracking again. The tracking resumes from the frame
+  // at which it was cancelled
+  void reset_cancel() {
+    progress.cancelled = false;
+    if (statistics.error == ERROR_cancelled) statistics.error = ERROR_none;
+  }
+
 private:
 
   // verbose output to stdio
@@ -201,8 +434,74 @@ private:
   // display the debug output to std::out
   void debug_output(const unsigned int frm) const;
 
-  // update the list of active tracks
-  bool update_active();
+  // update the list of active tracks, before tracking a_frame
+  bool update_active(const unsigned int a_frame);
+
+  // start a new tracklet from an object, and add it to the active list
+  TrackletPtr new_tracklet(const TrackObjectPtr& a_obj);
+
+  // track the objects in new_objects, from a_frame, using the active tracks
+  void process_frame(const unsigned int a_frame);
+
+  // the frame being tracked by process_frame
+  unsigned int processing_frame = 0;
+
+  // acquisition times of the frames, if these are not regular
+  std::vector<double> frame_times;
+
+  // split the tracking between several independent trackers (parts), track
+  // them in parallel and combine the stitched tracks
+  bool ready_to_decompose();
+  bool track_parts(TrackerParts &a_parts, const unsigned int a_threads);
+  std::vector<std::vector<TrackletPtr>> gather_parts(
+      const TrackerParts &a_parts);
+  void complete_parts(const std::vector<TrackletPtr> &a_tracks);
+
+  // append objects (or dummies) to tracklets. If BATCH_MOTION_UPDATE is set,
+  // the motion model updates are queued and run for all tracklets at once by
+  // flush_appends, otherwise the objects are appended immediately
+  void queue_append(const TrackletPtr &a_trk, const TrackObjectPtr &a_obj);
+  void queue_dummy(const TrackletPtr &a_trk);
+  void flush_appends();
+
+  // queued appends and the batched motion model engine
+  std::vector<TrackletPtr> queued_tracks;
+  std::vector<TrackObjectPtr> queued_objects;
+  MotionBatch motion_batch;
+
+  // number of frames after which a finished track is retired to the archive
+  unsigned int retirement_window = 0;
+
+  // retire the finished tracks
+  void retire();
+
+  // periodic checkpoints
+  std::string checkpoint_file;
+  unsigned int checkpoint_interval = 0;
+
+  // checkpoint if we have reached the end of an interval, stopping the
+  // tracking if the checkpoint could not be written
+  void auto_checkpoint() {
+    if (checkpoint_interval > 0 && current_frame % checkpoint_interval == 0 &&
+        checkpoint(checkpoint_file) != SUCCESS) {
+      statistics.error = ERROR_file_IO;
+    }
+  }
+
+  // the file of finished tracks for incremental checkpoints, the checkpoint
+  // it belongs to, the number of tracks written to it and the revision of
+  // the track manager at the time
+  BinaryWriter checkpoint_tracks;
+  std::string checkpoint_base;
+  uint64_t checkpoint_n_tracks = 0;
+  unsigned int checkpoint_revision = 0;
+
+  // tracks which have finished since the last checkpoint
+  std::vector<TrackletPtr> finished;
+
+  // start a new file of finished tracks, containing every track which is
+  // not active
+  bool start_checkpoint(const std::string &a_filename);
 
   // pointer to the track manager
   // TrackManager* p_manager;
@@ -214,32 +513,141 @@ private:
   // some space to store the objects
   std::vector<TrackObjectPtr> objects;
 
-  // sizes of various vectors
-  size_t n_objects;
+  // sizes of various vectors, these stay at zero when streaming
+  size_t n_objects = 0;
+
+  unsigned int current_frame = 0;
+  unsigned int o_counter = 0;
 
-  unsigned int current_frame;
-  unsigned int o_counter;
+  // the range of frames of the queued objects
+  unsigned int min_frame = std::numeric_limits<unsigned int>::max();
+  unsigned int max_frame = 0;
 
-  // store the frame numbers of incoming tracks
-  std::set<unsigned int> frames_set;
+  // the frames which contain objects, and an index of the objects by frame.
+  // The objects in frames[k] are objects[frame_index[k]] up to (but not
+  // including) objects[frame_index[k+1]]
   std::vector<unsigned int> frames;
+  std::vector<size_t> frame_index;
+
+  // queue an object for tracking
+  void queue_object(const TrackObjectPtr &a_obj);
+
+  // sort the objects by frame, using a radix sort, and build the index
+  void index_frames();
+
+  // the position in objects of the first object in a_frame, or of the next
+  // frame with objects if a_frame is empty
+  size_t frame_begin(const unsigned int a_frame) const;
+
+  // the ID of the tracklet that each of the new_objects was assigned to
+  std::vector<unsigned int> assignments;
 
   // tracker initialisation
   bool initialised = false;
 
+  // streaming mode, objects are not stored, only the live tracks
+  bool streaming = false;
+
   // ID counter for new tracks
   unsigned int new_ID = 0;
 
   // counter to run the purge function
   unsigned int purge_iter;
 
+  // when the tracking is cancelled, the trailing dummies are removed from the
+  // active tracks so that the tracks can be finalised, and are put back if the
+  // tracking is resumed
+  void suspend();
+  void resume();
+  std::vector<std::pair<TrackletPtr, std::vector<TrackObjectPtr>>> suspended;
+
   // counters for the number of lost tracks and number of conflicts
   unsigned int n_lost = 0;
   unsigned int n_conflicts = 0;
+
+  // when tracking a part of a larger set, the frames and positions that the
+  // part is responsible for. Only the lost tracks and conflicts in this part
+  // are counted, so that those in the overlaps between parts are not counted
+  // twice. By default the tracker is responsible for everything
+  std::function<bool(const unsigned int, const Eigen::Vector3d&)> responsible;
+  bool count_event(const Eigen::Vector3d &a_position) const {
+    return !responsible || responsible(processing_frame, a_position);
+  }
+
   float max_search_radius = MAX_SEARCH_RADIUS;
 
+  // gating, the threshold is the squared Mahalanobis distance
+  double gate_probability = GATE_PROBABILITY;
+  double gate_threshold = chi2_threshold(GATE_PROBABILITY);
+
+  // test whether an object lies within the gate of a prediction, given the
+  // displacement of the object from the prediction and the inverse of the
+  // gating covariance
+  template <typename T>
+  bool inside_gate(const Eigen::Matrix<T,3,1>& a_delta,
+                   const Eigen::Matrix<T,3,3>& a_gate_inverse) {
+    if (gate_probability <= 0.) return true;
+    gate_tested++;
+    if (a_delta.dot(a_gate_inverse * a_delta) > gate_threshold) return false;
+    gate_passed++;
+    return true;
+  }
+
+  // the gating covariance for a prediction, and its inverse
+  Eigen::Matrix3d gate_covariance(const PositionPrediction& a_prediction) const;
+  Eigen::Matrix3d gate_inverse(const PositionPrediction& a_prediction) const {
+    return gate_covariance(a_prediction).inverse();
+  }
+
+  // the radius used to search for objects near to a track with a given
+  // gating covariance
+  double search_radius(const Eigen::Matrix3d& a_gate_covariance) const;
+
+  // the precision of the belief matrix, in bits
+  unsigned int precision = DEFAULT_PRECISION;
+
+  // make the belief matrix at a given precision and link the tracks
+  template <typename T>
+  void update_belief(BeliefScratch<T> &a_scratch,
+                     const size_t n_active,
+                     const size_t n_obs);
+
+  // scratch buffers for the belief update at each precision, and for the
+  // neighbours of each track in the fast update
+  BeliefScratch<float> scratch_single;
+  BeliefScratch<double> scratch_double;
+  std::vector<TrackObjectPtr_and_Index> local_objects;
+
+  // scratch arrays for linking
+  LinkScratch links;
+
+  // the scoring quantities of the prediction of a track
+  template <typename T>
+  void belief_prediction(const size_t trk,
+                         BeliefPrediction<T> &a_prediction,
+                         Eigen::Matrix3d &a_gate_covariance);
+
+  // the log probability of assigning a track to an object
+  template <typename T>
+  T log_prob_assign(const BeliefPrediction<T> &a_prediction,
+                    const Eigen::Matrix<T,3,1> &a_position,
+                    const unsigned int a_label);
+
+  // spatial index of the new objects, used by the fast cost update
+  ObjectTree object_tree;
+
+  // counters for the gate hit rate in the current frame
+  unsigned long gate_tested = 0;
+  unsigned long gate_passed = 0;
+
   // set up a structure for the statistics
   PyTrackInfo statistics;
+
+  // progress of the tracking, for polling from another thread
+  TrackProgress progress;
+
+  // publish the progress after each frame
+  void update_progress();
 };
 
 
@@ -18,12 +18,14 @@
 #define _TRACKLET_H_INCLUDED_
 
 #include "eigen/Eigen/Dense"
+#include <algorithm>
 #include <vector>
 
 #include "types.h"
 #include "motion.h"
 #include "inference.h"
 #include "defs.h"
+#include "io.h"
 
 // #define MAX_LOST 5
 
@@ -50,14 +52,40 @@ public:
 
   // append a new track object to the trajectory, update flag tells the function
   // whether to update the motion model or not - new tracks should not update
-  // the motion model
-  void append(const TrackObjectPtr& new_object, bool update);
+  // the motion model. a_dt is the time since the last object in the track,
+  // which defaults to a single time step of the motion model
+  void append(const TrackObjectPtr& new_object, bool update, const double a_dt);
+  void append(const TrackObjectPtr& new_object, bool update) {
+    append(new_object, update, motion_model.time_step());
+  }
   void append(const TrackObjectPtr& new_object) {
     append(new_object, true);
   }
   // append a dummy object to the trajectory in case of a missed observation
   void append_dummy();
 
+  // make a dummy object at the predicted position in frame a_frame, a_dt after
+  // the last object, without appending it. Returns a null pointer if the
+  // track has been lost for too long. By default the dummy is in the next
+  // frame
+  TrackObjectPtr make_dummy(const unsigned int a_frame, const double a_dt) const;
+  TrackObjectPtr make_dummy() const {
+    return make_dummy(track.back()->t+1, motion_model.time_step());
+  }
+
+  // count the frames before a_frame in which the track was not seen, without
+  // appending dummies for them. Frames already counted for an earlier frame
+  // are not counted again, since the track stops growing once it is lost
+  void skip_to(const unsigned int a_frame) {
+    unsigned int last = std::max(track.back()->t, considered);
+    if (a_frame > last+1) lost += a_frame-last-1;
+    considered = a_frame;
+  }
+
+  // return the motion model, used to update the models of many tracklets at
+  // once before appending the objects without an update
+  MotionModel* get_motion_model() { return &motion_model; }
+
   // return the length of the trajectory
   unsigned int length() const { return track.size(); };
 
@@ -107,26 +135,49 @@ public:
   }
 
 
+  // make a new tracklet from the objects (and predictions) in [a_first,
+  // a_last) of this one. The new tracklet has no ID
+  std::shared_ptr<Tracklet> slice(const size_t a_first,
+                                  const size_t a_last) const;
+
+  // extend this tracklet with the objects (and predictions) in [a_first,
+  // a_last) of another. The motion model and lost counter are taken from the
+  // other tracklet, since they describe the end of the extended track
+  void extend(const Tracklet &a_trk, const size_t a_first, const size_t a_last);
+
+  // write the tracklet to a binary file, or read it back using a copy of the
+  // motion model. Only the positional part of the Kalman filter output is
+  // stored, since this is all that is used by the exporters
+  void write(BinaryWriter &a_writer) const;
+  void read(BinaryReader &a_reader, const MotionModel &a_model);
+
   // get the latest prediction from the motion model. Note that the current
   // prediction from the Tracklet object is different to the prediction of the
   // motion model. The tracklet adds any extra model information to the
   // last known position, while the motion model is the filtered version of the
   // data which may contain some lag. This is a critical part of the prediction
-  // TODO(arl): make this model agnostic
-  Prediction predict() const;
+  // TODO(arl): make this model agnostic. The prediction is made a_dt after the
+  // last object, by default a single time step of the motion model
+  PositionPrediction predict(const double a_dt) const;
+  PositionPrediction predict() const {
+    return predict(motion_model.time_step());
+  }
 
   // Identifier for the tracklet
   unsigned int ID = 0;
 
   // these are vectors storing the predicted new position and the Kalman output
   // as well as the pointers to the track objects comprising the trajectory
-  std::vector<Prediction> kalman;
-  std::vector<Prediction> prediction;
+  std::vector<PositionPrediction> kalman;
+  std::vector<PositionPrediction> prediction;
   std::vector<TrackObjectPtr> track;
 
   // counter for number of consecutive lost/dummy observations
   unsigned int lost = 0;
 
+  // the last frame in which the lost counter was brought up to date
+  unsigned int considered = 0;
+
   // store the root, parent and original IDs
   unsigned int root = 0;
   unsigned int parent = 0;
@@ -152,4 +203,8 @@ private:
 // a shared pointer for tracklets
 typedef std::shared_ptr<Tracklet> TrackletPtr;
 
+// write or read a single track object in binary form
+void write_track_object(BinaryWriter &a_writer, const TrackObjectPtr &a_obj);
+TrackObjectPtr read_track_object(BinaryReader &a_reader);
+
 #endif
@@ -92,12 +92,33 @@ extern "C" struct PyTrackInfo {
   float t_total_time;
   float p_link;
   float p_lost;
+  float gate_hit_rate;
+  unsigned int n_allocations;
+  unsigned int n_belief_allocations;
   bool complete;
 
   // default constructor
   PyTrackInfo() : error(ERROR_none), n_tracks(0), n_active(0),
                 n_conflicts(0), n_lost(0), t_update_belief(0), t_update_link(0),
-                t_total_time(0), p_link(0), p_lost(0), complete(false) {};
+                t_total_time(0), p_link(0), p_lost(0), gate_hit_rate(0),
+                n_allocations(0), n_belief_allocations(0), complete(false) {};
+};
+
+
+
+
+
+// Progress of an asynchronous tracking run, returned to Python when polling
+extern "C" struct PyTrackProgress {
+  unsigned int current_frame;
+  unsigned int last_frame;
+  unsigned int n_active;
+  unsigned int n_tracks;
+  float t_update_belief;
+  float t_update_link;
+  float t_elapsed;
+  bool running;
+  bool complete;
 };
 
 
@@ -180,6 +201,23 @@ struct Prediction
 };
 
 
+// Structure for the positional part of a prediction, which is all that the
+// tracker and the track histories use. This is fixed size, so making, copying
+// and storing it does not allocate
+struct PositionPrediction
+{
+  // position and error predictions
+  Eigen::Vector3d mu;
+  Eigen::Matrix3d covar;
+
+  // constructors
+  PositionPrediction() { mu.setZero(); covar.setIdentity(); }
+  PositionPrediction( const Eigen::Vector3d &a_mu,
+                      const Eigen::Matrix3d &a_covar) : mu(a_mu), covar(a_covar) {}
+
+};
+
+
 // template <typename btrack_float> struct test_s {
 // 	btrack_float x;
 // };
@@ -16,6 +16,10 @@
 #ifndef _WRAPPER_H_INCLUDED_
 #define _WRAPPER_H_INCLUDED_
 
+#include <thread>
+#include <atomic>
+#include <chrono>
+
 #include "types.h"
 #include "tracker.h"
 #include "hypothesis.h"
@@ -28,9 +32,14 @@ class InterfaceWrapper
   public:
 
     // default constructors/destructors
-    InterfaceWrapper();
+    InterfaceWrapper() : InterfaceWrapper(false) {};
+    InterfaceWrapper(const bool a_verbose);
     virtual ~InterfaceWrapper();
 
+    // copy the motion and object models and the tracking parameters from
+    // another interface, so that several datasets can share a configuration
+    void copy_configuration(const InterfaceWrapper &a_source);
+
     // tracking and basic data handling
     void set_motion_model(const unsigned int measurements,
                           const unsigned int states,
@@ -47,15 +56,53 @@ class InterfaceWrapper
     // set the maximum search radius
     void set_max_search_radius(const float max_search_radius);
 
+    // set the probability floor used for gating
+    void set_gating(const double gate_probability);
+
+    // set the precision of the belief matrix
+    unsigned int set_precision(const unsigned int precision);
+
     // append an object to the tracker
     void append(const PyTrackObject a_object);
 
     // run the tracking
     const PyTrackInfo* track();
 
+    // run the tracking asynchronously on a worker thread. Until it finishes,
+    // only get_progress, cancel and wait may be used. The other functions
+    // return ERROR_tracking_in_progress, or do nothing and return no data
+    unsigned int track_async();
+
+    // get the progress of the asynchronous tracking
+    void get_progress(PyTrackProgress* a_progress) const;
+
+    // ask the asynchronous tracking to stop after the current frame
+    void cancel();
+
+    // wait for the asynchronous tracking to finish
+    const PyTrackInfo* wait();
+
+    // run the tracking on temporal chunks in parallel
+    const PyTrackInfo* track_chunked(const unsigned int a_threads,
+                                     const unsigned int a_overlap);
+
+    // run the tracking on spatial tiles in parallel
+    const PyTrackInfo* track_tiled(const unsigned int a_tiles_x,
+                                   const unsigned int a_tiles_y,
+                                   const unsigned int a_threads);
+
     // step through the tracking by n steps
     const PyTrackInfo* step(const unsigned int a_steps);
 
+    // streaming mode, track a single frame of objects
+    const PyTrackInfo* stream(const PyTrackObject* a_objects,
+                              const unsigned int a_n_objects,
+                              const unsigned int a_frame,
+                              unsigned int* a_track_IDs);
+
+    // finish the streaming and finalise the tracks
+    void finalise();
+
     // get a track by ID, returns the number of objects in the track
     unsigned int get_track(double* output, const unsigned int a_ID) const;
 
@@ -74,6 +121,9 @@ class InterfaceWrapper
     // get the length of a track
     unsigned int track_length(const unsigned int a_ID) const;
 
+    // write all of the tracks to a binary track store
+    unsigned int write_store(const char* a_filename) const;
+
     // motion model related data
     unsigned int get_kalman_mu(double* output, const unsigned int a_ID) const;
     unsigned int get_kalman_covar(double* output, const unsigned int a_ID) const;
@@ -82,27 +132,90 @@ class InterfaceWrapper
 
     // return the number of tracks
     unsigned int size() const {
+      if (running) return 0;
       return tracker.size();
     }
 
-    // get the imaging volume
+    // get and set the imaging volume
     void get_volume(double* a_volume) const;
+    void set_volume(const double* a_volume);
 
-    // hypothesis generation, returns number of hypotheses found
+    // set the acquisition time of each frame
+    unsigned int set_frame_times(const double* a_times,
+                                 const unsigned int a_n_frames);
+
+    // retire finished tracks to an archive file on disk
+    unsigned int set_retirement(const char* a_filename,
+                                const unsigned int a_window);
+
+    // checkpoint and restore the state of the tracker
+    unsigned int checkpoint(const char* a_filename);
+    unsigned int restore(const char* a_filename);
+    void set_checkpoint(const char* a_filename, const unsigned int a_interval);
+
+    // hypothesis generation for the tracks in a range of frames, returns
+    // number of hypotheses found. If the
+    // parameters are unchanged, the previous hypotheses are updated and the
+    // IDs of removed hypotheses may be returned as TYPE_undef
     unsigned int create_hypotheses( PyHypothesisParams params,
                                     const unsigned int a_start_frame,
                                     const unsigned int a_end_frame );
     // return a specific hypothesis
     PyHypothesis get_hypothesis(const unsigned int a_ID);
 
+    // return the number of hypotheses of each type, before and after pruning
+    void get_hypothesis_counts(unsigned int* a_before, unsigned int* a_after);
+
     // merge tracks based on optimisation
     void merge(unsigned int* a_hypotheses, unsigned int n_hypotheses);
 
+    // merge tracks using only the hypotheses of tracks ending before a frame
+    // (for a merge, either of its parents), when optimising over a window of
+    // frames. Returns the number used
+    unsigned int merge_before(unsigned int* a_hypotheses,
+                              unsigned int n_hypotheses,
+                              const unsigned int a_frame);
+
+    // track a batch of independent datasets in parallel, see below
+    friend unsigned int track_datasets(InterfaceWrapper** a_datasets,
+                                       const unsigned int a_n_datasets,
+                                       const unsigned int a_threads,
+                                       const PyHypothesisParams* a_params,
+                                       PyTrackInfo* a_stats);
+
   private:
     // the tracker, track manager and hypothesis engines
     BayesianTracker tracker;
     HypothesisEngine h_engine;
     TrackManager* p_manager;
+
+    // the worker thread for asynchronous tracking
+    std::thread worker;
+    std::atomic<bool> running{false};
+
+    // the statistics returned while the asynchronous tracking is running
+    PyTrackInfo busy_stats;
+
+    // the last frame and the start and finish times of the asynchronous
+    // tracking, which are read by get_progress from other threads
+    std::atomic<unsigned int> last_frame{0};
+    std::atomic<std::chrono::steady_clock::rep> t_start{0};
+    std::atomic<std::chrono::steady_clock::rep> t_finish{0};
 };
 
+
+
+// Track a batch of independent datasets (e.g. the positions of a multi-well
+// experiment), each of which has its own interface, in parallel using up to
+// a_threads threads. The largest datasets are started first. If a_params is
+// not NULL, the hypotheses are also generated for each dataset over its range
+// of frames. The statistics of each dataset are copied to a_stats, which
+// should have space for a_n_datasets entries. Returns ERROR_none if all of the
+// datasets were tracked, or the error of the first dataset which was not
+unsigned int track_datasets(InterfaceWrapper** a_datasets,
+                            const unsigned int a_n_datasets,
+                            const unsigned int a_threads,
+                            const PyHypothesisParams* a_params,
+                            PyTrackInfo* a_stats);
+
 #endif
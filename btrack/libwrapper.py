@@ -26,7 +26,7 @@ import numpy as np
 import utils
 import constants
 
-from btypes import PyTrackObject, PyTrackingInfo
+from btypes import PyTrackObject, PyTrackingInfo, PyTrackProgress
 from optimise import hypothesis
 
 
@@ -140,6 +140,12 @@ class LibraryWrapper(object):
     lib.max_search_radius.restype = None
     lib.max_search_radius.argtypes = [ctypes.c_void_p, ctypes.c_float]
 
+    lib.set_gating.restype = None
+    lib.set_gating.argtypes = [ctypes.c_void_p, ctypes.c_double]
+
+    lib.set_precision.restype = ctypes.c_uint
+    lib.set_precision.argtypes = [ctypes.c_void_p, ctypes.c_uint]
+
     # append a new observation
     lib.append.restype = None
     lib.append.argtypes = [ctypes.c_void_p, PyTrackObject]
@@ -148,10 +154,63 @@ class LibraryWrapper(object):
     lib.track.restype = ctypes.POINTER(PyTrackingInfo)
     lib.track.argtypes = [ctypes.c_void_p]
 
+    # asynchronous tracking on a worker thread
+    lib.track_async.restype = ctypes.c_uint
+    lib.track_async.argtypes = [ctypes.c_void_p]
+
+    lib.get_progress.restype = None
+    lib.get_progress.argtypes = [ctypes.c_void_p,
+        ctypes.POINTER(PyTrackProgress)]
+
+    lib.cancel.restype = None
+    lib.cancel.argtypes = [ctypes.c_void_p]
+
+    lib.wait.restype = ctypes.POINTER(PyTrackingInfo)
+    lib.wait.argtypes = [ctypes.c_void_p]
+
+    # run the tracking on temporal chunks in parallel
+    lib.track_chunked.restype = ctypes.POINTER(PyTrackingInfo)
+    lib.track_chunked.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_uint]
+
+    # track a batch of independent datasets in parallel
+    lib.track_many.restype = ctypes.c_uint
+    lib.track_many.argtypes = [ctypes.POINTER(ctypes.c_void_p), ctypes.c_uint,
+        ctypes.c_uint, ctypes.POINTER(hypothesis.PyHypothesisParams),
+        ctypes.POINTER(PyTrackingInfo)]
+
+    # share the configuration of one tracker with another
+    lib.copy_configuration.restype = None
+    lib.copy_configuration.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+
+    # run the tracking on spatial tiles in parallel
+    lib.track_tiled.restype = ctypes.POINTER(PyTrackingInfo)
+    lib.track_tiled.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_uint,
+        ctypes.c_uint]
+
     # run one or more steps of the tracking, interactive mode
     lib.step.restype = ctypes.POINTER(PyTrackingInfo)
     lib.step.argtypes = [ctypes.c_void_p, ctypes.c_uint]
 
+    # streaming mode, track a single frame of objects
+    lib.stream.restype = ctypes.POINTER(PyTrackingInfo)
+    lib.stream.argtypes = [ctypes.c_void_p, ctypes.POINTER(PyTrackObject),
+                            ctypes.c_uint, ctypes.c_uint, np_uint_p]
+
+    # finish streaming and finalise the tracks
+    lib.finalise.restype = None
+    lib.finalise.argtypes = [ctypes.c_void_p]
+
+    # checkpoint and restore the tracker state
+    lib.checkpoint.restype = ctypes.c_uint
+    lib.checkpoint.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+
+    lib.restore.restype = ctypes.c_uint
+    lib.restore.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+
+    lib.set_checkpoint.restype = None
+    lib.set_checkpoint.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                   ctypes.c_uint]
+
     # get an individual track length
     lib.track_length.restype = ctypes.c_uint
     lib.track_length.argtypes = [ctypes.c_void_p, ctypes.c_uint]
@@ -192,10 +251,27 @@ class LibraryWrapper(object):
     lib.get_volume.restype = None
     lib.get_volume.argtypes = [ctypes.c_void_p, np_dbl_p]
 
+    # set the imaging volume
+    lib.set_volume.restype = None
+    lib.set_volume.argtypes = [ctypes.c_void_p, np_dbl_p]
+
+    # set the acquisition time of each frame
+    lib.set_frame_times.restype = ctypes.c_uint
+    lib.set_frame_times.argtypes = [ctypes.c_void_p, np_dbl_p, ctypes.c_uint]
+
+    # retire finished tracks to an archive file
+    lib.set_retirement.restype = ctypes.c_uint
+    lib.set_retirement.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                   ctypes.c_uint]
+
     # return a dummy object by reference
     lib.get_dummy.restype = PyTrackObject
     lib.get_dummy.argtypes = [ctypes.c_void_p, ctypes.c_int]
 
+    # write the tracks to a binary track store
+    lib.write_store.restype = ctypes.c_uint
+    lib.write_store.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+
     # get the number of tracks
     lib.size.restype = ctypes.c_uint
     lib.size.argtypes = [ctypes.c_void_p]
@@ -210,6 +286,16 @@ class LibraryWrapper(object):
     lib.get_hypothesis.restype = hypothesis.Hypothesis
     lib.get_hypothesis.argtypes = [ctypes.c_void_p, ctypes.c_uint]
 
+    # get the number of hypotheses of each type, before and after pruning
+    lib.get_hypothesis_counts.restype = None
+    lib.get_hypothesis_counts.argtypes = [ctypes.c_void_p, np_uint_p,
+                                          np_uint_p]
+
     # merge following optimisation
     lib.merge.restype = None
     lib.merge.argtypes = [ctypes.c_void_p, np_uint_p, ctypes.c_uint]
+
+    # merge following optimisation of a window of frames
+    lib.merge_before.restype = ctypes.c_uint
+    lib.merge_before.argtypes = [ctypes.c_void_p, np_uint_p, ctypes.c_uint,
+        ctypes.c_uint]
@@ -83,6 +83,13 @@ class PyHypothesisParams(ctypes.Structure):
       double segmentation_miss_rate;
       double apoptosis_rate;
       bool relax;
+      unsigned int hypotheses_to_generate;
+      unsigned int max_children;  // best children to consider, 0 for all
+      unsigned int max_divisions; // best divisions to keep, 0 for all
+      double prune_absolute;      // log probability threshold, 0 to disable
+      double prune_relative;      // log probability below the best of the
+                                  // same track, 0 to disable
+      bool prune_dominated;       // remove dominated hypotheses
 
     Notes:
         None
@@ -101,7 +108,12 @@ class PyHypothesisParams(ctypes.Structure):
                 ('segmentation_miss_rate', ctypes.c_double),
                 ('apoptosis_rate', ctypes.c_double),
                 ('relax', ctypes.c_bool),
-                ('hypotheses_to_generate', ctypes.c_uint)]
+                ('hypotheses_to_generate', ctypes.c_uint),
+                ('max_children', ctypes.c_uint),
+                ('max_divisions', ctypes.c_uint),
+                ('prune_absolute', ctypes.c_double),
+                ('prune_relative', ctypes.c_double),
+                ('prune_dominated', ctypes.c_bool)]
 
     def __init__(self, name=None):
         self.name = name
@@ -17,9 +17,11 @@ __author__ = "Alan R. Lowe"
 __email__ = "a.lowe@ucl.ac.uk"
 
 import logging
+import time
 import hypothesis
 
-from cvxopt.glpk import ilp
+from cvxopt.glpk import ilp, lp
+from cvxopt import glpk
 from cvxopt import matrix, spmatrix
 
 # get the logger instance
@@ -60,18 +62,34 @@ class TrackOptimiser(object):
     Since this is a *minimisation* we need to invert the (log) probability of
     each hypothesis.
 
+    With a time limit or a maximum number of iterations, the optimiser runs
+    within a budget. A feasible solution is found first by local search,
+    starting from every track being a false positive and inserting the most
+    probable hypotheses first, repairing the tracks they displace with
+    initialisations, terminations or false positives. GLPK is then given the
+    remaining time, and the best feasible solution found is returned. If GLPK
+    does not find the optimal solution without a budget, the local search is
+    used instead.
+
     Args:
         hypotheses: a list of PyHypothesis objects from the tracker
+        time_limit: (optional) the time budget in seconds
+        max_iterations: (optional) the maximum number of local search moves
 
     Members:
         optimise()
+        status: the status of the solution, optimal or feasible
+        gap: the difference between the upper bound on the log likelihood from
+            the LP relaxation and the log likelihood of the solution, zero if
+            it is optimal
 
     Returns:
         a list of selected hypotheses. These are indices into the list of
         PyHypothesis objects.
 
     Notes:
-        If the hypotheses are badly formed, this can take *FOREVER*.
+        If the hypotheses are badly formed, this can take *FOREVER* without a
+        time limit.
 
         'Report Automated Cell Lineage Construction' Al-Kofahi et al.
         Cell Cycle 2006 vol. 5 (3) pp. 327-335
@@ -84,8 +102,12 @@ class TrackOptimiser(object):
         Lowe AR 2017 Mol. Biol. Cell vol 28 pp. 3215-3228
     """
 
-    def __init__(self):
+    def __init__(self, time_limit=None, max_iterations=None):
         self._hypotheses = []
+        self.time_limit = time_limit
+        self.max_iterations = max_iterations
+        self.status = None
+        self.gap = None
 
     @property
     def hypotheses(self):
@@ -106,20 +128,26 @@ class TrackOptimiser(object):
 
         logger.info('Setting up constraints matrix for global optimisation...')
 
-        # anon function to renumber track ID from C++
-        trk_idx = lambda h: int(h)-1
+        # map the track IDs from C++ to rows of the constraints matrix. The IDs
+        # are not contiguous once tracks have been merged, or when optimising
+        # a window of frames
+        track_IDs = sorted(set([int(h.ID) for h in self.hypotheses]))
+        rows = {ID: i for i, ID in enumerate(track_IDs)}
+        trk_idx = lambda h: rows[int(h)]
 
         # calculate the number of hypotheses, could use this moment to cull?
         n_hypotheses = len(self.hypotheses)
-        N = max(set([int(h.ID) for h in self.hypotheses]))
+        N = len(track_IDs)
 
         # A is the constraints matrix (store as sparse since mostly empty)
         # note that we make this in the already transposed form...
         A = spmatrix([], [], [], (2*N, n_hypotheses), 'd')
         rho = matrix(0., (n_hypotheses, 1), 'd')
 
-        # iterate over the hypotheses and build the constraints
+        # iterate over the hypotheses and build the constraints, keeping the
+        # rows covered by each hypothesis
         # TODO(arl): vectorize this for increased performance
+        h_rows = []
         for counter, h in enumerate(self.hypotheses):
 
             # set the hypothesis score
@@ -128,76 +156,257 @@ class TrackOptimiser(object):
             if h.type == "P_FP":
                 # is this a false positive?
                 trk = trk_idx(h.ID)
-                A[trk,counter] = 1
-                A[N+trk,counter] = 1
-                continue
+                rows_h = [trk, N+trk]
 
             elif h.type == "P_init":
                 # an initialisation, therefore we only present this in the
                 # second half of the A matrix
-                trk = trk_idx(h.ID)
-                A[N+trk,counter] = 1
-                continue
+                rows_h = [N+trk_idx(h.ID)]
 
             elif h.type == "P_term" or h.type == "P_dead":
                 # a termination event, entry in first half only
-                trk = trk_idx(h.ID)
-                A[trk,counter] = 1
-                continue
+                rows_h = [trk_idx(h.ID)]
 
             elif h.type == "P_link":
                 # a linkage event
                 trk_i = trk_idx(h.ID)
                 trk_j = trk_idx(h.link_ID)
-                A[trk_i,counter] = 1
-                A[N+trk_j,counter] = 1
-                continue
+                rows_h = [trk_i, N+trk_j]
 
             elif h.type == "P_branch":
                 # a branch event
                 trk = trk_idx(h.ID)
                 child_one = trk_idx(h.child_one_ID)
                 child_two = trk_idx(h.child_two_ID)
-                A[trk,counter] = 1
-                A[N+child_one,counter] = 1
-                A[N+child_two,counter] = 1
-                continue
+                rows_h = [trk, N+child_one, N+child_two]
 
             elif h.type == "P_merge":
                 # a merge event
                 trk = trk_idx(h.ID)
                 parent_one = trk_idx(h.parent_one_ID)
                 parent_two = trk_idx(h.parent_two_ID)
-                A[N+trk,counter] = 1
-                A[parent_one,counter] = 1
-                A[parent_two,counter] = 1
-                continue
+                rows_h = [N+trk, parent_one, parent_two]
 
             else:
                 raise ValueError('Unknown hypothesis: {0:s}'.format(h.type))
 
+            for r in rows_h:
+                A[r,counter] = 1
+            h_rows.append(rows_h)
+
         logger.info('Optimising...')
 
-        # now set up the ILP solver
+        scores = list(rho)
+        deadline = None
+        if self.time_limit is not None:
+            deadline = time.time() + self.time_limit
+
+        # with a budget, start from the local search solution
+        results = None
+        if self.time_limit is not None or self.max_iterations is not None:
+            results = self._local_search(h_rows, scores, N, deadline)
+            self.status = 'feasible'
+
+        # now try to solve it!!!
+        remaining = None if deadline is None else deadline - time.time()
+        if remaining is None or remaining > 0:
+            status, x = self._solve(A, rho, N, n_hypotheses, remaining)
+            selected = None
+            if x is not None:
+                selected = [i for i in xrange(n_hypotheses) if x[i]>0.5]
+
+            if status == 'optimal':
+                results, self.status = selected, status
+            elif selected is not None and self._feasible(selected, h_rows, N):
+                if results is None or (sum([scores[i] for i in selected]) >
+                                       sum([scores[i] for i in results])):
+                    results, self.status = selected, 'feasible'
+
+            # log the warning if not optimal solution
+            if status != 'optimal':
+                logger.warning('Optimizer returned status: {0:s}'.format(status))
+
+        # fall back to the local search if no solution was found
+        if results is None:
+            results = self._local_search(h_rows, scores, N, deadline)
+            self.status = 'feasible'
+
+        if results is None:
+            self.status = 'infeasible'
+            return []
+
+        # report the gap between the solution and the upper bound
+        if self.status == 'optimal':
+            self.gap = 0.
+        else:
+            objective = sum([scores[i] for i in results])
+            bound = self._upper_bound(A, rho, h_rows, scores, N, deadline)
+            self.gap = max(0., bound-objective)
+
+        logger.info('Optimisation complete. (Solution: {0:s}, gap: {1:.3f})'
+                    .format(self.status, self.gap))
+        return sorted(results)
+
+    def _solve(self, A, rho, N, n_hypotheses, time_limit):
+        """ Solve the problem using GLPK, within an optional time limit in
+        seconds """
         G = spmatrix([], [], [], (2*N, n_hypotheses), 'd')
         h = matrix(0., (2*N,1), 'd')      # NOTE h cannot be a sparse matrix
         I = set()                         # empty set of x which are integer
         B = set(range(n_hypotheses))      # signifies all are binary in x
         b = matrix(1., (2*N,1), 'd')
 
-        # now try to solve it!!!
-        status, x = ilp(-rho, -G, h, A, b, I, B)
-
-        # log the warning if not optimal solution
-        if status != 'optimal':
-            logger.warning('Optimizer returned status: {0:s}'.format(status))
-            return []
-
-        # return only the selected hypotheses
-        results = [i for i,h in enumerate(self.hypotheses) if x[i]>0]
-
-        logger.info('Optimisation complete. (Solution: {0:s})'.format(status))
-        return results
+        # the options are passed with the call, rather than changing the
+        # options of the module which are shared with any other callers
+        options = dict(glpk.options)
+        if time_limit is not None:
+            options['tm_lim'] = max(1, int(1000*time_limit))
+        status, x = ilp(-rho, -G, h, A, b, I, B, options=options)
+        return status, x
+
+    def _feasible(self, selected, h_rows, N):
+        """ Test whether every track is started and ended exactly once """
+        covered = [0] * (2*N)
+        for i in selected:
+            for r in h_rows[i]:
+                covered[r] += 1
+        return all([c == 1 for c in covered])
+
+    def _upper_bound(self, A, rho, h_rows, scores, N, deadline):
+        """ An upper bound on the log likelihood of any solution, from the LP
+        relaxation of the problem, where each x is between zero and one rather
+        than binary. The LP is given the time remaining before the deadline,
+        if any. If there is no time left, or the LP cannot be solved, a weaker
+        bound is used: every row is covered by one hypothesis, so the log
+        likelihood is the sum over the rows of the share of the covering
+        hypothesis, which is at most the best share of any hypothesis covering
+        the row """
+        n_hypotheses = len(h_rows)
+        remaining = None if deadline is None else deadline - time.time()
+
+        if remaining is not None and remaining <= 0:
+            logger.info('No time left for the LP relaxation, using a weaker '
+                        'bound')
+        else:
+            G = spmatrix(-1., range(n_hypotheses), range(n_hypotheses))
+            h = matrix(0., (n_hypotheses,1), 'd')
+            b = matrix(1., (2*N,1), 'd')
+
+            options = dict(glpk.options)
+            if remaining is not None:
+                options['tm_lim'] = max(1, int(1000*remaining))
+            status, x, _, _ = lp(-rho, G, h, A, b, options=options)
+            if status == 'optimal':
+                return sum([rho[i]*x[i] for i in xrange(n_hypotheses)])
+
+            logger.warning('LP relaxation returned status: {0:s}'
+                           .format(status))
+
+        best = [None] * (2*N)
+        for rows_h, score in zip(h_rows, scores):
+            share = score / len(rows_h)
+            for r in rows_h:
+                if best[r] is None or share > best[r]:
+                    best[r] = share
+        return sum([s for s in best if s is not None])
+
+    def _local_search(self, h_rows, scores, N, deadline):
+        """ Find a feasible solution by local search. Starting with every track
+        as a false positive, or initialised and terminated, each move inserts a
+        hypothesis and repairs the tracks it displaces. Moves are tried with
+        the most probable hypotheses first and accepted if they improve the
+        solution, until no move improves it or the budget is used """
+
+        # the best hypothesis covering only a single row, and the best false
+        # positive of each track
+        single, fp = {}, {}
+        for i, rows_h in enumerate(h_rows):
+            if len(rows_h) == 1:
+                r = rows_h[0]
+                if r not in single or scores[i] > scores[single[r]]:
+                    single[r] = i
+            elif self.hypotheses[i].type == 'P_FP':
+                trk = rows_h[0]
+                if trk not in fp or scores[i] > scores[fp[trk]]:
+                    fp[trk] = i
+
+        def cover_track(trk):
+            # the best way to cover both rows of a track on its own
+            options = []
+            if trk in fp:
+                options.append((scores[fp[trk]], [fp[trk]]))
+            if trk in single and N+trk in single:
+                options.append((scores[single[trk]]+scores[single[N+trk]],
+                                [single[trk], single[N+trk]]))
+            return max(options) if options else None
+
+        def cover_row(r):
+            # the best way to cover a single row
+            return (scores[single[r]], [single[r]]) if r in single else None
+
+        # the starting solution
+        cover = [None] * (2*N)
+        for trk in xrange(N):
+            c = cover_track(trk)
+            if c is None:
+                logger.warning('Local search: track has no false positive.')
+                return None
+            for i in c[1]:
+                for r in h_rows[i]:
+                    cover[r] = i
+
+        order = sorted(xrange(len(h_rows)), key=lambda i: -scores[i])
+        iterations = 0
+        improved = True
+
+        while improved:
+            improved = False
+
+            for i in order:
+                if self.max_iterations is not None and \
+                    iterations >= self.max_iterations:
+                    improved = False
+                    break
+                if deadline is not None and iterations % 256 == 0 and \
+                    time.time() > deadline:
+                    improved = False
+                    break
+                iterations += 1
+
+                # remove the hypotheses covering the same rows
+                removed = set([cover[r] for r in h_rows[i]])
+                if i in removed: continue
+                delta = scores[i] - sum([scores[j] for j in removed])
+
+                # find the rows which are no longer covered, by track
+                freed = {}
+                for j in removed:
+                    for r in h_rows[j]:
+                        if r in h_rows[i]: continue
+                        freed.setdefault(r % N, []).append(r)
+
+                # and repair them
+                added = [i]
+                for trk, rows_t in freed.iteritems():
+                    c = cover_track(trk) if len(rows_t) == 2 else \
+                        cover_row(rows_t[0])
+                    if c is None: break
+                    delta += c[0]
+                    added += c[1]
+                else:
+                    if delta <= 1e-9: continue
+
+                    for j in removed:
+                        for r in h_rows[j]:
+                            cover[r] = None
+                    for j in added:
+                        for r in h_rows[j]:
+                            cover[r] = j
+                    improved = True
+
+        logger.info('Local search complete after {0:d} moves.'.format(
+                    iterations))
+        return list(set(cover))
 
 
 if __name__ == '__main__':
@@ -0,0 +1,84 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+
+#include "allocation.h"
+
+#include <cstdlib>
+#include <new>
+
+
+
+#if COUNT_ALLOCATIONS
+
+// the number of allocations made by each thread, so that trackers running in
+// parallel only count their own allocations
+static thread_local unsigned long n_allocations = 0;
+
+#if defined(__linux__)
+// malloc is wrapped by the linker, so calls to malloc from the library come
+// through here, while our operator new calls the real malloc directly
+extern "C" void* __real_malloc(size_t a_size);
+extern "C" void* __wrap_malloc(size_t a_size)
+{
+  n_allocations++;
+  return __real_malloc(a_size);
+}
+#define COUNTED_MALLOC __real_malloc
+#else
+#define COUNTED_MALLOC std::malloc
+#endif
+
+
+
+void* operator new(std::size_t a_size)
+{
+  n_allocations++;
+  void* ptr = COUNTED_MALLOC(a_size ? a_size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](std::size_t a_size)
+{
+  return operator new(a_size);
+}
+
+void operator delete(void* a_ptr) noexcept
+{
+  std::free(a_ptr);
+}
+
+void operator delete[](void* a_ptr) noexcept
+{
+  std::free(a_ptr);
+}
+
+
+
+unsigned long allocation_count()
+{
+  return n_allocations;
+}
+
+#else
+
+unsigned long allocation_count()
+{
+  return 0;
+}
+
+#endif
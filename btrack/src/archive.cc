@@ -0,0 +1,148 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+
+#include "archive.h"
+
+#include <cstdio>
+
+
+
+// open the archive file
+bool TrackArchive::open(const std::string &a_filename,
+                        const MotionModel &a_model)
+{
+  close();
+
+  if (!m_writer.open(a_filename)) return false;
+
+  m_filename = a_filename;
+  m_model = a_model;
+  m_error = false;
+  return true;
+}
+
+
+
+// close the archive, the archive is only used for the lifetime of the tracker
+// so we remove the file
+void TrackArchive::close()
+{
+  if (!is_open()) return;
+
+  m_mapping.close();
+  m_writer.close();
+  std::remove(m_filename.c_str());
+
+  m_offsets.clear();
+  m_loaded.clear();
+  m_last.reset();
+}
+
+
+
+// append a tracklet to the end of the file
+size_t TrackArchive::store(const TrackletPtr &a_trk)
+{
+  assert(is_open());
+
+  m_offsets.push_back(m_writer.tell());
+  m_loaded.push_back(std::weak_ptr<Tracklet>());
+  a_trk->write(m_writer);
+
+  return m_offsets.size()-1;
+}
+
+
+
+// load a tracklet from the archive
+TrackletPtr TrackArchive::load(const size_t a_idx)
+{
+  assert(a_idx < m_offsets.size());
+
+  // return the existing instance if this tracklet is already loaded
+  TrackletPtr trk = m_loaded[a_idx].lock();
+  if (trk) return trk;
+
+  // remap the file if the record has been written since we last mapped it
+  if (m_mapping.size() < m_writer.tell()) {
+    if (!m_writer.flush() || !m_mapping.open(m_filename)) {
+      m_mapping.close();
+      m_error = true;
+      return TrackletPtr();
+    }
+  }
+
+  BinaryReader reader(m_mapping.data(), m_mapping.size());
+  reader.seek(m_offsets[a_idx]);
+
+  trk = std::make_shared<Tracklet>();
+  trk->read(reader, m_model);
+  if (!reader.good()) {
+    m_error = true;
+    return TrackletPtr();
+  }
+
+  m_loaded[a_idx] = trk;
+  m_last = trk;
+  return trk;
+}
+
+
+
+// rewrite the archive into a new file, which then replaces the old one. The
+// tracklets are streamed through one at a time, so only those which are
+// already referenced elsewhere are held in memory
+bool TrackArchive::compact(const std::function<bool(const TrackletPtr&,
+                                                    const size_t)> &a_keep)
+{
+  if (!is_open() || !good()) return false;
+
+  std::string tmp_filename = m_filename + ".tmp";
+  BinaryWriter writer;
+  if (!writer.open(tmp_filename)) return false;
+
+  std::vector<uint64_t> offsets;
+  std::vector<std::weak_ptr<Tracklet>> loaded;
+
+  for (size_t i=0; i<m_offsets.size(); i++) {
+    TrackletPtr trk = load(i);
+    if (!trk) break;
+    if (!a_keep(trk, offsets.size())) continue;
+    offsets.push_back(writer.tell());
+    loaded.push_back(trk);
+    trk->write(writer);
+  }
+
+  if (!writer.close() || !good()) {
+    std::remove(tmp_filename.c_str());
+    m_error = true;
+    return false;
+  }
+
+  // swap the new file in and carry on appending to it
+  m_mapping.close();
+  m_writer.close();
+  if (std::rename(tmp_filename.c_str(), m_filename.c_str()) != 0 ||
+      !m_writer.open(m_filename, true)) {
+    m_error = true;
+    return false;
+  }
+
+  m_offsets.swap(offsets);
+  m_loaded.swap(loaded);
+  return true;
+}
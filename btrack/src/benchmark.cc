@@ -0,0 +1,86 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+
+// Benchmark of the belief update and linking on synthetic data. Objects move
+// with a constant velocity plus some noise, and a few are missed in each frame
+// so that the tracks are occasionally lost. The timings of each stage, summed
+// over all of the frames, are printed for each number of tracks.
+//
+// usage: benchmark [n_frames] [n_tracks ...]
+// build with: make benchmark
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "wrapper.h"
+#include "synthetic.h"
+
+#define BENCHMARK_FRAMES 100
+#define BENCHMARK_SEED 1729
+#define BENCHMARK_MISSED 0.02
+
+
+
+// track the synthetic data frame by frame, summing the timings
+void benchmark(const unsigned int a_frames, const unsigned int a_tracks)
+{
+  InterfaceWrapper wrapper;
+  set_constant_velocity(wrapper);
+
+  std::vector<PyTrackObject> objects = random_movie(a_frames, a_tracks,
+                                                    BENCHMARK_SEED,
+                                                    BENCHMARK_MISSED);
+  for (size_t i=0; i<objects.size(); i++) {
+    wrapper.append(objects[i]);
+  }
+
+  double t_belief = 0., t_link = 0.;
+  unsigned long n_allocations = 0;
+
+  for (unsigned int t=1; t<a_frames; t++) {
+    const PyTrackInfo* stats = wrapper.step(1);
+    t_belief += stats->t_update_belief;
+    t_link += stats->t_update_link;
+    n_allocations += stats->n_allocations;
+  }
+
+  std::printf("%8u tracks: belief %10.1f ms, link %10.1f ms, "
+              "%lu allocations, %u tracks found\n",
+              a_tracks, t_belief, t_link, n_allocations, wrapper.size());
+}
+
+
+
+int main(int argc, char** argv)
+{
+  unsigned int n_frames = BENCHMARK_FRAMES;
+  std::vector<unsigned int> n_tracks = {200, 2000};
+
+  if (argc > 1) n_frames = std::atoi(argv[1]);
+  if (argc > 2) {
+    n_tracks.clear();
+    for (int i=2; i<argc; i++) n_tracks.push_back(std::atoi(argv[i]));
+  }
+
+  std::printf("%u frames\n", n_frames);
+  for (const unsigned int n : n_tracks) {
+    benchmark(n_frames, n);
+  }
+
+  return EXIT_SUCCESS;
+}
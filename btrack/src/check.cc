@@ -0,0 +1,398 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+
+// Checks of the guarantees made by the tracker, on small synthetic movies.
+// Each check prints its result, and the program fails if any of them fail.
+//
+// usage: check [directory for temporary files]
+// build and run with: make check
+// the allocation checks need a counting build, after make clean:
+// make check COUNT_ALLOCATIONS=true
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "wrapper.h"
+#include "synthetic.h"
+
+#define CHECK_SEED 1729
+
+// the tracks, as the object IDs (negative for dummies) and the fate of each
+typedef std::vector<std::vector<int>> TrackList;
+
+// directory for the temporary files
+std::string check_directory = "/tmp";
+
+
+
+// report the result of a check
+bool report(const char* a_name, const bool a_passed)
+{
+  std::printf("%-48s %s\n", a_name, a_passed ? "ok" : "FAILED");
+  return a_passed;
+}
+
+
+
+// append the objects to the tracker
+void append_all(InterfaceWrapper &a_interface,
+                const std::vector<PyTrackObject> &a_objects)
+{
+  for (size_t i=0; i<a_objects.size(); i++) {
+    a_interface.append(a_objects[i]);
+  }
+}
+
+
+
+// the objects of each frame, in order of frame
+std::vector<std::vector<PyTrackObject>> split_frames(
+  const std::vector<PyTrackObject> &a_objects)
+{
+  std::vector<std::vector<PyTrackObject>> frames;
+  for (size_t i=0; i<a_objects.size(); i++) {
+    if (frames.size() <= a_objects[i].t) frames.resize(a_objects[i].t+1);
+    frames[a_objects[i].t].push_back(a_objects[i]);
+  }
+  return frames;
+}
+
+
+
+// get all of the tracks from the tracker
+TrackList get_tracks(const InterfaceWrapper &a_interface)
+{
+  TrackList tracks(a_interface.size());
+  for (unsigned int i=0; i<a_interface.size(); i++) {
+    tracks[i].resize(a_interface.track_length(i));
+    a_interface.get_refs(tracks[i].data(), i);
+    tracks[i].push_back(a_interface.get_fate(i));
+  }
+  return tracks;
+}
+
+
+
+// checkpoint a batch run half way through, restore it into a new tracker and
+// finish the tracking. The tracks should be the same as an uninterrupted run
+bool check_checkpoint_batch()
+{
+  const unsigned int n_frames = 60;
+  std::vector<PyTrackObject> objects = random_movie(n_frames, 100,
+                                                    CHECK_SEED, 0.05);
+  std::string filename = check_directory + "/btrack_check_batch.bin";
+
+  InterfaceWrapper reference;
+  set_constant_velocity(reference);
+  append_all(reference, objects);
+  reference.track();
+
+  InterfaceWrapper interrupted;
+  set_constant_velocity(interrupted);
+  append_all(interrupted, objects);
+  interrupted.step(n_frames/2);
+  if (interrupted.checkpoint(filename.c_str()) != SUCCESS) return false;
+
+  InterfaceWrapper resumed;
+  if (resumed.restore(filename.c_str()) != SUCCESS) return false;
+  const PyTrackInfo* stats = resumed.track();
+
+  return stats->error == ERROR_none &&
+         get_tracks(resumed) == get_tracks(reference);
+}
+
+
+
+// checkpoint a streaming run half way through, restore it into a new tracker
+// and stream the rest of the frames. The objects should be assigned to the
+// same tracks as in an uninterrupted run, which checkpoints periodically
+bool check_checkpoint_stream()
+{
+  const unsigned int n_frames = 60;
+  std::vector<std::vector<PyTrackObject>> frames = split_frames(
+    random_movie(n_frames, 100, CHECK_SEED, 0.05));
+  std::string filename = check_directory + "/btrack_check_stream.bin";
+  std::string periodic = check_directory + "/btrack_check_periodic.bin";
+
+  InterfaceWrapper reference;
+  set_constant_velocity(reference);
+  reference.set_checkpoint(periodic.c_str(), 7);
+
+  InterfaceWrapper interrupted;
+  set_constant_velocity(interrupted);
+
+  InterfaceWrapper resumed;
+
+  bool passed = true;
+  std::vector<unsigned int> IDs, resumed_IDs;
+
+  for (unsigned int t=0; t<n_frames; t++) {
+    const std::vector<PyTrackObject> &frame = frames[t];
+    IDs.resize(frame.size());
+    resumed_IDs.resize(frame.size());
+
+    const PyTrackInfo* stats = reference.stream(frame.data(), frame.size(),
+                                                t, IDs.data());
+    passed = passed && stats->error == ERROR_none;
+
+    if (t < n_frames/2) {
+      interrupted.stream(frame.data(), frame.size(), t, resumed_IDs.data());
+      if (t == n_frames/2-1) {
+        if (interrupted.checkpoint(filename.c_str()) != SUCCESS) return false;
+        if (resumed.restore(filename.c_str()) != SUCCESS) return false;
+      }
+    } else {
+      stats = resumed.stream(frame.data(), frame.size(), t,
+                             resumed_IDs.data());
+      passed = passed && stats->error == ERROR_none;
+    }
+
+    passed = passed && IDs == resumed_IDs;
+  }
+
+  // the periodic checkpoints can also be restored
+  InterfaceWrapper restored;
+  passed = passed && restored.restore(periodic.c_str()) == SUCCESS;
+
+  reference.finalise();
+  resumed.finalise();
+  return passed && get_tracks(resumed) == get_tracks(reference);
+}
+
+
+
+// once the scratch buffers have grown to the size of the frames, the belief
+// update should not allocate. This is only counted in builds with
+// COUNT_ALLOCATIONS, otherwise the check is skipped
+bool check_belief_allocations(bool &a_skipped)
+{
+  const unsigned int n_frames = 20;
+  const unsigned int n_warm = 2;
+
+  InterfaceWrapper interface;
+  set_constant_velocity(interface);
+  append_all(interface, grid_movie(n_frames, 10, 10, 50., 1., 0.5));
+
+  unsigned long n_allocations = 0, n_belief_allocations = 0;
+  for (unsigned int t=1; t<n_frames; t++) {
+    const PyTrackInfo* stats = interface.step(1);
+    n_allocations += stats->n_allocations;
+    if (t > n_warm) n_belief_allocations += stats->n_belief_allocations;
+  }
+
+  a_skipped = n_allocations == 0;
+  return n_belief_allocations == 0;
+}
+
+
+
+// the links made from a belief matrix, the track assigned to each object (or
+// -1 for a new track) and whether each track is given a dummy
+struct Links
+{
+  std::vector<int> object_track;
+  std::vector<bool> dummy;
+  bool operator==(const Links &o) const {
+    return object_track == o.object_track && dummy == o.dummy;
+  }
+};
+
+
+
+// the links made by the original implementation of BayesianTracker::link,
+// which collected the putative links of each object in a HypothesisMap
+Links reference_links(const Eigen::MatrixXd &a_belief)
+{
+  const size_t n_objects = a_belief.rows()-1;
+  const size_t n_tracks = a_belief.cols();
+
+  Links links;
+  links.object_track.assign(n_objects, -1);
+  links.dummy.assign(n_tracks, false);
+
+  std::set<unsigned int> not_used;
+  for (size_t i=0; i<n_tracks; i++) not_used.insert(i);
+  HypothesisMap<LinkHypothesis> map(n_objects);
+
+  for (size_t trk=0; trk<n_tracks; trk++) {
+    Eigen::MatrixXd::Index best_object;
+    double prob = a_belief.col(trk).maxCoeff(&best_object);
+    if (int(best_object) != int(n_objects)) {
+      map.push(best_object, LinkHypothesis(trk, prob));
+    } else {
+      links.dummy[trk] = true;
+      not_used.erase(trk);
+    }
+  }
+
+  for (size_t obj=0; obj<n_objects; obj++) {
+    std::vector<LinkHypothesis> candidates = map[obj];
+    if (candidates.empty()) continue;
+
+    unsigned int trk = candidates[0].first;
+    double prob = -kInfinity;
+    for (size_t i=0; i<candidates.size(); i++) {
+      if (candidates[i].second > prob) {
+        prob = candidates[i].second;
+        trk = candidates[i].first;
+      }
+    }
+    links.object_track[obj] = trk;
+    not_used.erase(trk);
+  }
+
+  for (auto trk=not_used.begin(); trk!=not_used.end(); ++trk) {
+    links.dummy[*trk] = true;
+  }
+
+  return links;
+}
+
+
+
+// the links made by the flat arrays of BayesianTracker::link
+Links flat_links(Eigen::MatrixXd &a_belief, LinkScratch &a_scratch)
+{
+  const size_t n_objects = a_belief.rows()-1;
+  const size_t n_tracks = a_belief.cols();
+
+  BeliefMap<double> belief(a_belief.data(), n_objects+1, n_tracks);
+  resolve_links<double>(belief, a_scratch);
+
+  Links links;
+  links.object_track.assign(n_objects, -1);
+  links.dummy.assign(n_tracks, true);
+  for (size_t obj=0; obj<n_objects; obj++) {
+    if (a_scratch.count[obj] < 1) continue;
+    links.object_track[obj] = a_scratch.track[obj];
+    links.dummy[a_scratch.track[obj]] = false;
+  }
+
+  return links;
+}
+
+
+
+// the flat array linking should make the same links as the original, for
+// random belief matrices with many ties and conflicts
+bool check_links()
+{
+  std::mt19937 rng(CHECK_SEED);
+  std::uniform_int_distribution<int> size(0, 12);
+  std::uniform_int_distribution<int> level(0, 4);
+
+  LinkScratch scratch;
+  for (size_t i=0; i<10000; i++) {
+    Eigen::MatrixXd belief(size(rng)+1, size(rng));
+    for (Eigen::Index j=0; j<belief.size(); j++) {
+      belief.data()[j] = -level(rng);
+    }
+    if (!(flat_links(belief, scratch) == reference_links(belief))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+
+// the tracks of a simple movie, tracked on a single thread
+TrackList simple_tracks(const std::vector<PyTrackObject> &a_objects)
+{
+  InterfaceWrapper interface;
+  set_constant_velocity(interface);
+  append_all(interface, a_objects);
+  interface.track();
+
+  TrackList tracks = get_tracks(interface);
+  std::sort(tracks.begin(), tracks.end());
+  return tracks;
+}
+
+
+
+// tracking temporal chunks in parallel and stitching them should give the same
+// tracks as a single thread, for a simple movie
+bool check_chunked()
+{
+  std::vector<PyTrackObject> objects = grid_movie(100, 8, 8, 100., 1., 0.5);
+
+  InterfaceWrapper chunked;
+  set_constant_velocity(chunked);
+  append_all(chunked, objects);
+  const PyTrackInfo* stats = chunked.track_chunked(4, 10);
+
+  TrackList tracks = get_tracks(chunked);
+  std::sort(tracks.begin(), tracks.end());
+  return stats->error == ERROR_none && tracks.size() == 64 &&
+         tracks == simple_tracks(objects);
+}
+
+
+
+// tracking spatial tiles in parallel and reconciling the tracks which cross
+// the tiles should give the same tracks as a single thread, for a simple movie
+// where the cells move across the borders of the tiles
+bool check_tiled()
+{
+  std::vector<PyTrackObject> objects = grid_movie(100, 8, 8, 100., 1., 0.5);
+
+  InterfaceWrapper tiled;
+  set_constant_velocity(tiled);
+  tiled.set_max_search_radius(50.);
+  append_all(tiled, objects);
+  const PyTrackInfo* stats = tiled.track_tiled(2, 2, 4);
+
+  TrackList tracks = get_tracks(tiled);
+  std::sort(tracks.begin(), tracks.end());
+  return stats->error == ERROR_none && tracks.size() == 64 &&
+         tracks == simple_tracks(objects);
+}
+
+
+
+int main(int argc, char** argv)
+{
+  if (argc > 1) check_directory = argv[1];
+
+  bool passed = true;
+  passed &= report("checkpoint and restore (batch)", check_checkpoint_batch());
+  passed &= report("checkpoint and restore (streaming)",
+                   check_checkpoint_stream());
+  passed &= report("flat array links match the original", check_links());
+  passed &= report("chunked tracking matches a single thread",
+                   check_chunked());
+  passed &= report("tiled tracking matches a single thread", check_tiled());
+
+  // the allocations are only counted in some builds
+  bool skipped;
+  bool allocations = check_belief_allocations(skipped);
+  if (skipped) {
+    std::printf("%-48s %s\n", "no allocations in the belief update",
+                "skipped (COUNT_ALLOCATIONS=false)");
+  } else {
+    passed &= report("no allocations in the belief update", allocations);
+  }
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
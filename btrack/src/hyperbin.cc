@@ -19,417 +19,182 @@
 
 
 
-// // set up a HashCube with a certain bin size
-// template <typename T>
-// HashBin<T>::HashBin( const unsigned int bin_xyz,
-//                   const unsigned int bin_n )
-// {
-//   // default constructor
-//   m_bin_size[0] = float(bin_xyz);
-//   m_bin_size[1] = float(bin_xyz);
-//   m_bin_size[2] = float(bin_xyz);
-//   m_bin_size[3] = float(bin_n);
-// }
-//
-//
-// // return a hash index given the xyzt
-// template <typename T>
-// HashIndex HashBin<T>::hash_index(const float x,
-//                                  const float y,
-//                                  const float z,
-//                                  const float n) const
-// {
-//
-//   // set up a hash index structure
-//   HashIndex idx;
-//   idx.x = static_cast<int> ( floor((1./ m_bin_size[0]) * x) );
-//   idx.y = static_cast<int> ( floor((1./ m_bin_size[1]) * y) );
-//   idx.z = static_cast<int> ( floor((1./ m_bin_size[2]) * z) );
-//   idx.n = static_cast<int> ( floor((1./ m_bin_size[3]) * n) );
-//   return idx;
-// }
-//
-//
-// // get the contents of the bins surronding the xyz coordinates
-// template <typename T>
-// std::vector<T> HashBin<T>::get_contents(const HashIndex a_idx)
-// {
-//
-//   // set up a vector to store the contents
-//   std::vector<T> r_contents;
-//
-//   // make a bin index structure to interrogate the matrix
-//   HashIndex bin_idx;
-//
-//   // make a map iterator and search for each of the bins
-//   typename std::map< HashIndex, std::vector<T> >::iterator ret;
-//
-//   // iterate over z
-//   for (int z=a_idx.z-1; z<=a_idx.z+1; z++) {
-//     bin_idx.z = z;
-//
-//     // iterate over y
-//     for (int y=a_idx.y-1; y<=a_idx.y+1; y++) {
-//       bin_idx.y = y;
-//
-//       // iterate over x
-//       for (int x=a_idx.x-1; x<=a_idx.x+1; x++) {
-//         bin_idx.x = x;
-//
-//         // find this bin index and return the list of tracks...
-//         ret = m_cube.find(bin_idx);
-//
-//         // if we didn't find anything...
-//         if (ret == m_cube.end()) continue;
-//
-//         // if we found something, move these into the out queue
-//         for (size_t i=0; i<ret->second.size(); i++) {
-//           r_contents.push_back( ret->second[i] );
-//         } // i
-//
-//       } // x
-//     } // y
-//   } // z
-//
-//   return r_contents;
-// }
-
-
-
-
-
-
-
-
-
-
-
-
-
-// A 4D hash cube object.
-//
-// Essentially a way of binsorting trajectory data for easy lookup,
-// thus preventing excessive searching over non-local trajectories.
-//
-HypercubeBin::HypercubeBin( void )
+// build the k-d tree
+void ObjectTree::build(const std::vector<TrackObjectPtr> &a_objects)
 {
-  // default constructor
-}
-
-
-
-HypercubeBin::~HypercubeBin( void )
-{
-  // default destructor
-  m_cube.clear();
-}
-
-
-
-// set up a HashCube with a certain bin size
-HypercubeBin::HypercubeBin( const unsigned int bin_xyz,
-                            const unsigned int bin_n )
-{
-  // default constructor
-  m_bin_size[0] = float(bin_xyz);
-  m_bin_size[1] = float(bin_xyz);
-  m_bin_size[2] = float(bin_xyz);
-  m_bin_size[3] = float(bin_n);
-}
-
-
-
-// use this to calculate the bin of a certain track
-HashIndex HypercubeBin::hash_index( TrackletPtr a_trk,
-                                    const bool a_start ) const
-{
-
-  // get the appropriate object from the track
-  TrackObjectPtr obj;
-
-  if (a_start) {
-    obj = a_trk->track.front();
-  } else {
-    obj = a_trk->track.back();
+  m_objects = a_objects;
+  m_nodes.resize(a_objects.size());
+
+  for (size_t i=0; i<a_objects.size(); i++) {
+    m_nodes[i].xyz[0] = a_objects[i]->x;
+    m_nodes[i].xyz[1] = a_objects[i]->y;
+    m_nodes[i].xyz[2] = a_objects[i]->z;
+    m_nodes[i].index = i;
   }
 
-  // return the hash index for this track
-  // return hash_index(obj->x, obj->y, obj->z, obj->t);
-  return hash_index(obj);
-}
-
-
-
-HashIndex HypercubeBin::hash_index( const float x,
-                                    const float y,
-                                    const float z,
-                                    const float n ) const
-{
-
-  // set up a hash index structure
-  HashIndex idx;
-  idx.x = static_cast<int> ( floor((1./ m_bin_size[0]) * x) );
-  idx.y = static_cast<int> ( floor((1./ m_bin_size[1]) * y) );
-  idx.z = static_cast<int> ( floor((1./ m_bin_size[2]) * z) );
-  idx.n = static_cast<int> ( floor((1./ m_bin_size[3]) * n) );
-  return idx;
+  build(0, m_nodes.size(), 0);
 }
 
 
 
-// add a track to the hashcube object
-void HypercubeBin::add_tracklet( TrackletPtr a_trk )
+// split the nodes at the median of the axis for this depth
+void ObjectTree::build(const size_t lo,
+                       const size_t hi,
+                       const unsigned int a_depth)
 {
-  // get the index of the start (i.e. first object) of the track
-  add_tracklet(a_trk, true);
-}
+  if (hi-lo <= OBJECT_TREE_LEAF_SIZE) return;
 
-// add a track to the hashcube object
-void HypercubeBin::add_tracklet( TrackletPtr a_trk,
-                                 const bool a_start )
-{
-  // get the index of the start (i.e. first object) of the track?
-  HashIndex idx = hash_index( a_trk, a_start );
+  const unsigned int axis = a_depth % 3;
+  const size_t mid = lo + (hi-lo)/2;
 
-  // try to insert it
-  std::pair<std::map<HashIndex,std::vector<TrackletPtr>>::iterator,bool> ret;
-  std::vector<TrackletPtr> trk_list = {a_trk};
-  ret = m_cube.emplace( idx, trk_list );
+  std::nth_element(m_nodes.begin()+lo, m_nodes.begin()+mid, m_nodes.begin()+hi,
+                   [axis](const Node &a, const Node &b) {
+                     return a.xyz[axis] < b.xyz[axis];
+                   });
 
-  // if this key already exists, append it to the list
-  if (ret.second == false) {
-    m_cube[idx].push_back(a_trk);
-  }
+  build(lo, mid, a_depth+1);
+  build(mid+1, hi, a_depth+1);
 }
 
 
 
-
-
-
-
-// std::vector<TrackletPtr> HypercubeBin::get(TrackObjectPtr a_obj)
-// {
-//
-// }
-
-
-
-// use this to get the tracks in a certain bin (+/-xyz, but only +n)
-std::vector<TrackletPtr> HypercubeBin::get( const TrackletPtr a_trk,
-                                            const bool a_start )
+// return the objects within a radius of a point
+void ObjectTree::get(const Eigen::Vector3d &a_point,
+                     const double a_radius,
+                     std::vector<TrackObjectPtr_and_Index> &a_found) const
 {
+  a_found.clear();
 
-  // space for the tracks to be returned
-  std::vector<TrackletPtr> r_trks;
-
-  // make a map iterator and search for each of the bins
-  std::map< HashIndex, std::vector<TrackletPtr> >::iterator ret;
-
-  // get the hash_index (either start or end of trajectory)
-  HashIndex idx = hash_index( a_trk, a_start );
+  const double point[3] = {a_point(0), a_point(1), a_point(2)};
+  search(0, m_nodes.size(), 0, point, a_radius, a_found);
 
-  // make a bin index structure to interrogate the matrix
-  HashIndex bin_idx;
-
-  // iterate over time
-  for (int n=idx.n; n<=idx.n+1; n++) {
-    bin_idx.n = n;
-
-    // iterate over z
-    for (int z=idx.z-1; z<=idx.z+1; z++) {
-      bin_idx.z = z;
-
-      // iterate over y
-      for (int y=idx.y-1; y<=idx.y+1; y++) {
-        bin_idx.y = y;
-
-        // iterate over x
-        for (int x=idx.x-1; x<=idx.x+1; x++) {
-          bin_idx.x = x;
-
-          // find this bin index and return the list of tracks...
-          ret = m_cube.find(bin_idx);
-
-          // if we didn't find anything...
-          if (ret == m_cube.end()) continue;
-
-          // if we found something, move these into the out queue
-          for (size_t i=0; i<ret->second.size(); i++) {
-            // Note - we need to make sure that the track we return doesn't
-            // start **BEFORE** the track we're searching for....
-            if (ret->second[i]->track.front()->t >=
-                a_trk->track.back()->t) {
-              r_trks.push_back( ret->second[i] );
-            }
-
-          } // i
-        } // x
-      } // y
-    } // z
-  } // n
-  return r_trks;
+  // return the objects in the order in which they were added
+  std::sort(a_found.begin(), a_found.end(),
+            [](const TrackObjectPtr_and_Index &a,
+               const TrackObjectPtr_and_Index &b) {
+              return a.second < b.second;
+            });
 }
 
 
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-// A 4D hash cube object.
-//
-// Essentially a way of binsorting trajectory data for easy lookup,
-// thus preventing excessive searching over non-local trajectories.
-//
-ObjectBin::ObjectBin( void )
-{
-  // default constructor
-}
-
-
-
-ObjectBin::~ObjectBin( void )
-{
-  // default destructor
-  m_cube.clear();
-}
-
-
-
-// set up a HashCube with a certain bin size
-ObjectBin::ObjectBin( const unsigned int bin_xyz,
-                      const unsigned int bin_n )
-{
-  // default constructor
-  m_bin_size[0] = float(bin_xyz);
-  m_bin_size[1] = float(bin_xyz);
-  m_bin_size[2] = float(bin_xyz);
-  m_bin_size[3] = float(bin_n);
-}
-
-
-
-// use this to calculate the bin of a certain track
-HashIndex ObjectBin::hash_index( TrackletPtr a_trk,
-                                 const bool a_start ) const
+// search a branch of the tree
+void ObjectTree::search(const size_t lo,
+                        const size_t hi,
+                        const unsigned int a_depth,
+                        const double* a_point,
+                        const double a_radius,
+                        std::vector<TrackObjectPtr_and_Index> &a_found) const
 {
+  const double r2 = a_radius*a_radius;
+
+  // small branches are searched by brute force
+  if (hi-lo <= OBJECT_TREE_LEAF_SIZE) {
+    for (size_t i=lo; i<hi; i++) {
+      const Node &n = m_nodes[i];
+      double dx = n.xyz[0]-a_point[0];
+      double dy = n.xyz[1]-a_point[1];
+      double dz = n.xyz[2]-a_point[2];
+      if (dx*dx + dy*dy + dz*dz <= r2) {
+        a_found.push_back( TrackObjectPtr_and_Index(m_objects[n.index], n.index) );
+      }
+    }
+    return;
+  }
 
-  // get the appropriate object from the track
-  TrackObjectPtr obj;
+  const unsigned int axis = a_depth % 3;
+  const size_t mid = lo + (hi-lo)/2;
+  const Node &n = m_nodes[mid];
 
-  if (a_start) {
-    obj = a_trk->track.front();
-  } else {
-    obj = a_trk->track.back();
+  double dx = n.xyz[0]-a_point[0];
+  double dy = n.xyz[1]-a_point[1];
+  double dz = n.xyz[2]-a_point[2];
+  if (dx*dx + dy*dy + dz*dz <= r2) {
+    a_found.push_back( TrackObjectPtr_and_Index(m_objects[n.index], n.index) );
   }
 
-  // return the hash index for this track
-  // return hash_index(obj->x, obj->y, obj->z, obj->t);
-  return hash_index(obj);
+  // only descend into the branches that overlap the search radius
+  if (a_point[axis]-a_radius <= n.xyz[axis]) {
+    search(lo, mid, a_depth+1, a_point, a_radius, a_found);
+  }
+  if (a_point[axis]+a_radius >= n.xyz[axis]) {
+    search(mid+1, hi, a_depth+1, a_point, a_radius, a_found);
+  }
 }
 
 
 
-HashIndex ObjectBin::hash_index( const float x,
-                                    const float y,
-                                    const float z,
-                                    const float n ) const
+// return the bin of a point
+HashIndex SweepLineBin::hash_index(const Eigen::Vector3d &a_xyz) const
 {
-
-  // set up a hash index structure
   HashIndex idx;
-  idx.x = static_cast<int> ( floor((1./ m_bin_size[0]) * x) );
-  idx.y = static_cast<int> ( floor((1./ m_bin_size[1]) * y) );
-  idx.z = static_cast<int> ( floor((1./ m_bin_size[2]) * z) );
-  idx.n = 1; //static_cast<int> ( floor((1./ m_bin_size[3]) * n) );
+  idx.x = static_cast<int> ( floor(a_xyz(0) / m_bin_size) );
+  idx.y = static_cast<int> ( floor(a_xyz(1) / m_bin_size) );
+  idx.z = static_cast<int> ( floor(a_xyz(2) / m_bin_size) );
   return idx;
 }
 
 
 
-// add a track to the hashcube object
-void ObjectBin::add_object(TrackObjectPtr a_obj)
+// add the start of a tracklet to the window
+void SweepLineBin::add(const Eigen::Vector3d &a_xyz, const unsigned int a_index)
 {
-  // get the index of the start (i.e. first object) of the track?
-  HashIndex idx = hash_index( a_obj );
+  m_bins[hash_index(a_xyz)].push_back(a_index);
+  m_size++;
+}
 
-  // try to insert it
-  std::pair<std::map<HashIndex,
-            std::vector<TrackObjectPtr_and_Index>>::iterator,bool> ret;
 
-  std::cout << "ObjectBin size: " << n_objects << std::endl;
 
-  std::vector<TrackObjectPtr_and_Index> obj_list = {TrackObjectPtr_and_Index(a_obj, n_objects)};
+// remove the start of a tracklet from the window, empty bins are removed so
+// that the map only holds the bins in the window
+void SweepLineBin::remove(const Eigen::Vector3d &a_xyz,
+                          const unsigned int a_index)
+{
+  std::map<HashIndex, std::vector<unsigned int>>::iterator bin;
+  bin = m_bins.find(hash_index(a_xyz));
+  if (bin == m_bins.end()) return;
 
-  ret = m_cube.emplace( idx, obj_list );
+  std::vector<unsigned int> &contents = bin->second;
+  std::vector<unsigned int>::iterator it;
+  it = std::find(contents.begin(), contents.end(), a_index);
+  if (it == contents.end()) return;
 
-  n_objects+=1;
+  *it = contents.back();
+  contents.pop_back();
+  m_size--;
 
-  // if this key already exists, append it to the list
-  if (ret.second == false) {
-    m_cube[idx].push_back(obj_list[0]);
-  }
+  if (contents.empty()) m_bins.erase(bin);
 }
 
 
 
-// use this to get the tracks in a certain bin (+/-xyz, but only +n)
-std::vector<TrackObjectPtr_and_Index> ObjectBin::get( const TrackletPtr a_trk,
-                                                      const bool a_start )
+// get the tracklets in the bins surrounding a point (+/-xyz)
+void SweepLineBin::get(const Eigen::Vector3d &a_xyz,
+                       std::vector<unsigned int> &a_found) const
 {
+  a_found.clear();
 
-  // space for the tracks to be returned
-  std::vector<TrackObjectPtr_and_Index> r_objs;
-
-  // make a map iterator and search for each of the bins
-  std::map< HashIndex, std::vector<TrackObjectPtr_and_Index> >::iterator ret;
-
-  // get the hash_index (either start or end of trajectory)
-  HashIndex idx = hash_index( a_trk, a_start );
-
-  // make a bin index structure to interrogate the matrix
+  HashIndex idx = hash_index(a_xyz);
   HashIndex bin_idx;
 
-  bin_idx.n = 1;
+  std::map<HashIndex, std::vector<unsigned int>>::const_iterator ret;
 
-  // iterate over z
   for (int z=idx.z-1; z<=idx.z+1; z++) {
     bin_idx.z = z;
-
-    // iterate over y
     for (int y=idx.y-1; y<=idx.y+1; y++) {
       bin_idx.y = y;
-
-      // iterate over x
       for (int x=idx.x-1; x<=idx.x+1; x++) {
         bin_idx.x = x;
 
-        // find this bin index and return the list of tracks...
-        ret = m_cube.find(bin_idx);
-
-        // if we didn't find anything...
-        if (ret == m_cube.end()) continue;
+        ret = m_bins.find(bin_idx);
+        if (ret == m_bins.end()) continue;
 
-        // if we found something, move these into the out queue
-        for (size_t i=0; i<ret->second.size(); i++) {
-          r_objs.push_back( ret->second[i] );
-        } // i
+        a_found.insert(a_found.end(), ret->second.begin(), ret->second.end());
       } // x
     } // y
   } // z
 
-  return r_objs;
+  // the order within a bin depends on the order of removals, so sort the
+  // tracklets to make the order of the hypotheses reproducible
+  std::sort(a_found.begin(), a_found.end());
 }
@@ -16,6 +16,12 @@
 
 #include "hypothesis.h"
 
+#include <numeric>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdint.h>
+
 
 
 // safe log function
@@ -116,9 +122,6 @@ HypothesisEngine::HypothesisEngine( const unsigned int a_start_frame,
     std::cout << " - P_dead: " << hypothesis_allowed(TYPE_Papop) << std::endl;
     std::cout << " - P_merge: " << hypothesis_allowed(TYPE_Pmrge) << std::endl;
   }
-
-  // set up a HashCube
-  m_cube = HypercubeBin(m_params.dist_thresh, m_params.time_thresh);
 }
 
 
@@ -136,9 +139,6 @@ void HypothesisEngine::add_track(TrackletPtr a_trk)
 {
   // push this onto the list of trajectories
   m_tracks.push_back( a_trk );
-
-  // add this one to the hash cube
-  m_cube.add_tracklet( a_trk );
 }
 
 
@@ -161,19 +161,10 @@ bool HypothesisEngine::hypothesis_allowed(const unsigned int a_hypothesis_type)
 
 
 
-float HypothesisEngine::dist_from_border( TrackletPtr a_trk,
-                                          bool a_start=true ) const
+float HypothesisEngine::dist_from_border( const Eigen::Vector3d &a_xyz ) const
 {
   // Calculate the distance from the border of the field of view
   float min_dist, min_this_dim;
-  Eigen::Vector3d xyz;
-
-  // take either the first or last localisation of the object
-  if (a_start) {
-    xyz = a_trk->track.front()->position();
-  } else {
-    xyz = a_trk->track.back()->position();
-  }
 
   // set the distance to infinity
   min_dist = kInfinity;
@@ -185,8 +176,8 @@ float HypothesisEngine::dist_from_border( TrackletPtr a_trk,
     // skip a dimension if it does not exist
     if (volume.min_xyz[dim] == volume.max_xyz[dim]) continue;
 
-    min_this_dim = std::min(xyz[dim]-volume.min_xyz[dim],
-                            volume.max_xyz[dim]-xyz[dim]);
+    min_this_dim = std::min(a_xyz[dim]-volume.min_xyz[dim],
+                            volume.max_xyz[dim]-a_xyz[dim]);
 
     if (min_this_dim < min_dist) {
       min_dist = min_this_dim;
@@ -198,172 +189,879 @@ float HypothesisEngine::dist_from_border( TrackletPtr a_trk,
 
 
 
+// calculate the features of a track which are used to score the hypotheses
+TrackletFeatures HypothesisEngine::features( const TrackletPtr &a_trk ) const
+{
+  TrackletFeatures f;
+
+  const TrackObjectPtr &first = a_trk->track.front();
+  const TrackObjectPtr &last = a_trk->track.back();
+
+  f.first = first->position();
+  f.last = last->position();
+  f.t_first = first->t;
+  f.t_last = last->t;
+  f.label_first = first->label;
+  f.label_last = last->label;
+
+  // distance from the frame border
+  f.d_start = dist_from_border( f.first );
+  f.d_stop = dist_from_border( f.last );
+
+  f.P_FP = P_FP( a_trk );
+  f.log_P_TP = safe_log( 1.0 - f.P_FP );
+
+  f.n_apoptosis = count_apoptosis( a_trk );
+  f.P_dead = P_dead( f );
+
+  f.fixed_start = a_trk->parent != 0 || f.t_first < m_frame_range[0];
+  f.fixed_end = a_trk->fate == TYPE_Pmrge;
+
+  return f;
+}
+
+
+
+// test whether the hypotheses have been created with the same parameters
+bool HypothesisEngine::compatible( const PyHypothesisParams &a_params ) const
+{
+  if (!m_created) return false;
+
+  const PyHypothesisParams &p = m_params;
+  return p.lambda_time == a_params.lambda_time &&
+         p.lambda_dist == a_params.lambda_dist &&
+         p.lambda_link == a_params.lambda_link &&
+         p.lambda_branch == a_params.lambda_branch &&
+         p.eta == a_params.eta &&
+         p.theta_dist == a_params.theta_dist &&
+         p.theta_time == a_params.theta_time &&
+         p.dist_thresh == a_params.dist_thresh &&
+         p.time_thresh == a_params.time_thresh &&
+         p.apop_thresh == a_params.apop_thresh &&
+         p.segmentation_miss_rate == a_params.segmentation_miss_rate &&
+         p.apoptosis_rate == a_params.apoptosis_rate &&
+         p.relax == a_params.relax &&
+         p.hypotheses_to_generate == a_params.hypotheses_to_generate &&
+         p.max_children == a_params.max_children &&
+         p.max_divisions == a_params.max_divisions &&
+         p.prune_absolute == a_params.prune_absolute &&
+         p.prune_relative == a_params.prune_relative &&
+         p.prune_dominated == a_params.prune_dominated;
+}
+
+
+
+// calculate the features of all of the tracks in a single pass
+void HypothesisEngine::calculate_features( void )
+{
+  m_num_tracks = m_tracks.size();
+
+  m_features.clear();
+  m_features.reserve( m_num_tracks );
+  m_index.clear();
+  for (size_t i=0; i<m_num_tracks; i++) {
+    m_features.push_back( features(m_tracks[i]) );
+    m_index[m_tracks[i]->ID] = i;
+  }
+}
+
+
+
 // create the hypotheses
 void HypothesisEngine::create( void )
 {
+  // start again
+  m_hypotheses.clear();
+  m_free.clear();
+  m_track_pruned.clear();
+  std::fill(m_pruned, m_pruned+HYPOTHESIS_TYPES, 0);
+  m_created = true;
 
   if (m_tracks.size() < 1) return;
 
-  // get the tracks
-  m_num_tracks = m_tracks.size();
-
   // reserve some memory for the hypotheses (at least 5 times the number of
   // trajectories)
-  m_hypotheses.reserve( m_num_tracks*5 );
+  m_hypotheses.reserve( m_tracks.size()*5 );
 
-  TrackletPtr trk;
+  // calculate the features and create the hypotheses of all of the tracks
+  calculate_features();
+  sweep( std::vector<bool>(m_num_tracks, true) );
+
+  // remove any hypotheses which are not worth optimising
+  prune(0);
+
+  if (DEBUG) {
+    unsigned int before[HYPOTHESIS_TYPES], after[HYPOTHESIS_TYPES];
+    counts(before, after);
+    std::cout << "Hypotheses (before/after pruning): " << std::endl;
+    for (size_t i=0; i<HYPOTHESIS_TYPES; i++) {
+      std::cout << " - " << i << ": " << before[i] << "/" << after[i];
+      std::cout << std::endl;
+    }
+  }
+
+}
 
-  // loop through trajectories
-  for (size_t i=0; i<m_num_tracks; i++) {
 
-    // get the test track
-    trk = m_tracks[i];
 
-    // false positive hypothesis calculated for everything
-    Hypothesis h_fp(TYPE_Pfalse, trk);
-    h_fp.probability = safe_log( P_FP( trk ) );
-    m_hypotheses.push_back( h_fp );
+// update the hypotheses after the tracks have changed. The hypotheses of a
+// track depend on its features, the features of the tracks which it could link
+// to or from, and the frame range, so only these are regenerated
+void HypothesisEngine::update( const unsigned int a_start_frame,
+                               const unsigned int a_stop_frame )
+{
+  const unsigned int previous_range[2] = {m_frame_range[0], m_frame_range[1]};
+  m_frame_range[0] = a_start_frame;
+  m_frame_range[1] = a_stop_frame;
+
+  // nothing to update
+  if (!m_created) {
+    create();
+    return;
+  }
 
-    // distance from the frame border
-    float d_start = dist_from_border( trk, true );
-    float d_stop = dist_from_border( trk, false );
+  // keep the features of the tracks used previously
+  std::vector<TrackletFeatures> previous;
+  std::unordered_map<unsigned int, unsigned int> previous_index;
+  previous.swap( m_features );
+  previous_index.swap( m_index );
 
-    // now calculate the initialisation
-    if (hypothesis_allowed(TYPE_Pinit)) {
-      if (m_params.relax ||
-          trk->track.front()->t < m_frame_range[0]+m_params.theta_time ||
-          d_start < m_params.theta_dist ) {
+  calculate_features();
 
-        Hypothesis h_init(TYPE_Pinit, trk);
-        h_init.probability = safe_log(P_init(trk)) + 0.5*safe_log(P_TP(trk));
-        m_hypotheses.push_back( h_init );
+  // find the tracks which have been added, removed or have changed. The
+  // features of these before and after the change are the events which can
+  // affect the hypotheses of the surrounding tracks
+  std::unordered_set<unsigned int> changed;
+  std::vector<TrackletFeatures> events;
+  std::unordered_map<unsigned int, unsigned int>::const_iterator prev;
+
+  for (size_t i=0; i<m_num_tracks; i++) {
+    prev = previous_index.find( m_tracks[i]->ID );
+    if (prev != previous_index.end() &&
+        previous[prev->second] == m_features[i]) continue;
+
+    changed.insert( m_tracks[i]->ID );
+    events.push_back( m_features[i] );
+    if (prev != previous_index.end()) {
+      events.push_back( previous[prev->second] );
+    }
+  }
+
+  for (prev = previous_index.begin(); prev != previous_index.end(); prev++) {
+    if (m_index.count(prev->first) > 0) continue;
+    changed.insert( prev->first );
+    events.push_back( previous[prev->second] );
+  }
+
+  // tracks which could be initialised or terminated by the old or new frame
+  // range have also changed
+  const double init_before = std::max(previous_range[0], m_frame_range[0])
+                             + m_params.theta_time;
+  const double term_after = std::min(previous_range[1], m_frame_range[1])
+                            - m_params.theta_time;
+
+  if (previous_range[0] != m_frame_range[0] ||
+      previous_range[1] != m_frame_range[1]) {
+    for (size_t i=0; i<m_num_tracks; i++) {
+      const TrackletFeatures &f = m_features[i];
+      if ((previous_range[0] != m_frame_range[0] && f.t_first < init_before) ||
+          (previous_range[1] != m_frame_range[1] && f.t_last > term_after)) {
+        if (changed.insert( m_tracks[i]->ID ).second) events.push_back( f );
       }
     }
+  }
 
-    // termination?
-    if (hypothesis_allowed(TYPE_Pterm)) {
-      if (m_params.relax ||
-          trk->track.back()->t > m_frame_range[1]-m_params.theta_time ||
-          d_stop < m_params.theta_dist) {
+  // the hypotheses of the tracks which end before the start, or start after
+  // the end, of one of the events need to be created again
+  std::vector<bool> regenerate(m_num_tracks, false);
+
+  if (!events.empty()) {
+    SweepLineBin starts(std::max(m_params.dist_thresh, 1.));
+    SweepLineBin ends(std::max(m_params.dist_thresh, 1.));
+    for (size_t e=0; e<events.size(); e++) {
+      starts.add( events[e].first, e );
+      ends.add( events[e].last, e );
+    }
 
-        Hypothesis h_term(TYPE_Pterm, trk);
-        h_term.probability = safe_log(P_term(trk)) + 0.5*safe_log(P_TP(trk));
-        m_hypotheses.push_back( h_term );
+    for (size_t i=0; i<m_num_tracks; i++) {
+      const TrackletFeatures &f = m_features[i];
+      regenerate[i] = changed.count(m_tracks[i]->ID) > 0;
+      if (regenerate[i]) continue;
+
+      // links and divisions to an event
+      starts.get( f.last, m_candidates );
+      for (size_t j=0; j<m_candidates.size() && !regenerate[i]; j++) {
+        const TrackletFeatures &f_evt = events[m_candidates[j]];
+        Eigen::Vector3d delta = f.last - f_evt.first;
+        float d = std::sqrt( delta.transpose()*delta );
+        float dt = static_cast<double>(f_evt.t_first) - f.t_last;
+        regenerate[i] = d < m_params.dist_thresh &&
+                    dt < m_params.time_thresh && dt >= 1;
+      }
+
+      // merges from an event
+      if (!hypothesis_allowed(TYPE_Pmrge)) continue;
+      ends.get( f.first, m_candidates );
+      for (size_t j=0; j<m_candidates.size() && !regenerate[i]; j++) {
+        const TrackletFeatures &f_evt = events[m_candidates[j]];
+        Eigen::Vector3d delta = f_evt.last - f.first;
+        float d = std::sqrt( delta.transpose()*delta );
+        float dt = static_cast<double>(f.t_first) - f_evt.t_last;
+        regenerate[i] = d < m_params.dist_thresh &&
+                    dt < m_params.time_thresh && dt >= 1;
       }
     }
 
-    // NEW apoptosis detection hypothesis
-    // modify this for apoptosis
-    unsigned int n_apoptosis = count_apoptosis(trk);
+    for (size_t i=0; i<m_num_tracks; i++) {
+      if (regenerate[i]) changed.insert( m_tracks[i]->ID );
+    }
+  }
+
+  // remove the hypotheses of the tracks to be created again, and update the
+  // pointers to the tracks of the remaining hypotheses
+  auto refresh = [this](TrackletPtr &a_trk) {
+    if (!a_trk) return true;
+    std::unordered_map<unsigned int, unsigned int>::const_iterator idx;
+    idx = m_index.find(a_trk->ID);
+    if (idx == m_index.end()) return false;
+    a_trk = m_tracks[idx->second];
+    return true;
+  };
+
+  for (size_t i=0; i<m_hypotheses.size(); i++) {
+    Hypothesis &h = m_hypotheses[i];
+    if (h.hypothesis == TYPE_undef) continue;
+
+    if (changed.count(h.ID) > 0 ||
+        !refresh(h.trk_ID) || !refresh(h.trk_link_ID) ||
+        !refresh(h.trk_child_one_ID) || !refresh(h.trk_child_two_ID) ||
+        !refresh(h.trk_parent_one_ID) || !refresh(h.trk_parent_two_ID)) {
+      h = Hypothesis();
+      m_free.push_back( i );
+    }
+  }
+
+  // and the counts of their pruned hypotheses
+  std::unordered_set<unsigned int>::const_iterator c;
+  for (c = changed.begin(); c != changed.end(); c++) {
+    auto pruned = m_track_pruned.find(*c);
+    if (pruned == m_track_pruned.end()) continue;
+    for (size_t t=0; t<HYPOTHESIS_TYPES; t++) m_pruned[t] -= pruned->second[t];
+    m_track_pruned.erase(pruned);
+  }
+
+  // create the new hypotheses at the end of the list, then move them into
+  // the free IDs
+  const size_t first_new = m_hypotheses.size();
+  if (!changed.empty()) sweep( regenerate );
+  prune(first_new);
+  reuse_free(first_new);
+
+  if (DEBUG) {
+    std::cout << "Hypotheses updated for " << changed.size() << " tracks, ";
+    std::cout << m_free.size() << " free IDs" << std::endl;
+  }
+}
+
+
+
+// move the new hypotheses, added from a_first onwards, into the free IDs
+// and remove any free IDs from the end of the list
+void HypothesisEngine::reuse_free( const size_t a_first )
+{
+  std::sort(m_free.begin(), m_free.end(), std::greater<size_t>());
+
+  size_t n_new = m_hypotheses.size() - a_first;
+  while (n_new > 0 && !m_free.empty()) {
+    m_hypotheses[m_free.back()] = m_hypotheses.back();
+    m_hypotheses.pop_back();
+    m_free.pop_back();
+    n_new--;
+  }
+
+  // the free IDs at the end of the list can be removed
+  while (!m_hypotheses.empty() && m_hypotheses.back().hypothesis == TYPE_undef) {
+    m_hypotheses.pop_back();
+  }
+  const size_t n_hypotheses = m_hypotheses.size();
+  m_free.erase(m_free.begin(),
+               std::find_if(m_free.begin(), m_free.end(),
+                            [n_hypotheses](const size_t a_ID) {
+                              return a_ID < n_hypotheses;
+                            }));
+}
+
 
-    if (hypothesis_allowed(TYPE_Papop) &&
-        n_apoptosis > m_params.apop_thresh) {
 
-      Hypothesis h_apoptosis(TYPE_Papop, trk);
-      h_apoptosis.probability = safe_log(P_dead(trk, n_apoptosis))
-                                + 0.5*safe_log(P_TP(trk));
-      m_hypotheses.push_back( h_apoptosis );
+// count the hypotheses of a track which were pruned
+void HypothesisEngine::count_pruned( const unsigned int a_ID,
+                                     const unsigned int a_type,
+                                     const unsigned int a_n )
+{
+  if (a_n == 0) return;
+
+  m_pruned[a_type] += a_n;
+
+  auto pruned = m_track_pruned.find(a_ID);
+  if (pruned == m_track_pruned.end()) {
+    std::array<unsigned int, HYPOTHESIS_TYPES> n_pruned;
+    n_pruned.fill(0);
+    pruned = m_track_pruned.emplace(a_ID, n_pruned).first;
+  }
+  pruned->second[a_type] += a_n;
+}
+
+
+
+// sweep through the tracks, creating the hypotheses of the flagged tracks
+void HypothesisEngine::sweep( const std::vector<bool> &a_create )
+{
+  // order the tracks by the times of their first and last objects
+  std::vector<unsigned int> by_start(m_num_tracks), by_end(m_num_tracks);
+  std::iota(by_start.begin(), by_start.end(), 0);
+  std::iota(by_end.begin(), by_end.end(), 0);
+  std::stable_sort(by_start.begin(), by_start.end(),
+                   [this](const unsigned int a, const unsigned int b) {
+                     return m_features[a].t_first < m_features[b].t_first;
+                   });
+  std::stable_sort(by_end.begin(), by_end.end(),
+                   [this](const unsigned int a, const unsigned int b) {
+                     return m_features[a].t_last < m_features[b].t_last;
+                   });
+
+  // sweep through the ends of the tracks, keeping the tracks which start in
+  // the window (t_last, t_last+time_thresh) in the spatial hash. The tracks
+  // in the window are by_start[first_start] to by_start[next_start-1]
+  SweepLineBin window(std::max(m_params.dist_thresh, 1.));
+  size_t first_start = 0, next_start = 0;
+
+  for (size_t e=0; e<m_num_tracks; e++) {
+
+    const TrackletFeatures &f = m_features[by_end[e]];
+
+    // add the tracks starting before the end of the window
+    while (next_start < m_num_tracks) {
+      const TrackletFeatures &f_start = m_features[by_start[next_start]];
+      double dt = static_cast<double>(f_start.t_first) - f.t_last;
+      if (dt >= m_params.time_thresh) break;
+      window.add( f_start.first, by_start[next_start] );
+      next_start++;
+    }
+
+    // remove the tracks starting before the end of this one
+    while (first_start < next_start) {
+      const TrackletFeatures &f_start = m_features[by_start[first_start]];
+      if (f_start.t_first > f.t_last) break;
+      window.remove( f_start.first, by_start[first_start] );
+      first_start++;
     }
 
-    // manage conflicts
-    std::vector<TrackletPtr> conflicts;
+    if (a_create[by_end[e]]) create_for_track( by_end[e], window );
+  }
 
-    // iterate over all of the tracks in the hash cube
-    std::vector<TrackletPtr> trks_to_test = m_cube.get( trk, false );
+  // sweep through the starts of the tracks for merges, keeping the tracks
+  // which end in the window (t_first-time_thresh, t_first) in the spatial
+  // hash. The tracks in the window are by_end[first_end] to by_end[next_end-1]
+  if (hypothesis_allowed(TYPE_Pmrge)) {
 
-    for (size_t j=0; j<trks_to_test.size(); j++) {
-      // get the track
-      TrackletPtr this_trk = trks_to_test[j];
+    SweepLineBin ends(std::max(m_params.dist_thresh, 1.));
+    size_t first_end = 0, next_end = 0;
 
-      float d = link_distance(trk, this_trk);
-      float dt = link_time(trk, this_trk);
+    for (size_t s=0; s<m_num_tracks; s++) {
 
-      // if we exceed these continue
-      if (d  >= m_params.dist_thresh) continue;
-      if (dt >= m_params.time_thresh || dt < 1) continue; // this was one
+      const TrackletFeatures &f = m_features[by_start[s]];
 
-      // TODO(arl): limits the maximum link distance ?
-      if (hypothesis_allowed(TYPE_Plink)) {
+      // add the tracks ending before the start of this one
+      while (next_end < m_num_tracks) {
+        const TrackletFeatures &f_end = m_features[by_end[next_end]];
+        if (f_end.t_last >= f.t_first) break;
+        ends.add( f_end.last, by_end[next_end] );
+        next_end++;
+      }
 
-        Hypothesis h_link(TYPE_Plink, trk);
-        h_link.trk_link_ID = this_trk;
-        h_link.probability = safe_log(P_link(trk, this_trk, d, dt))
-                            + 0.5*safe_log(P_TP(trk))
-                            + 0.5*safe_log(P_TP(this_trk));
-        m_hypotheses.push_back( h_link );
+      // remove the tracks which ended too long before the start of this one
+      while (first_end < next_end) {
+        const TrackletFeatures &f_end = m_features[by_end[first_end]];
+        double dt = static_cast<double>(f.t_first) - f_end.t_last;
+        if (dt < m_params.time_thresh) break;
+        ends.remove( f_end.last, by_end[first_end] );
+        first_end++;
       }
 
-      // append this to conflicts
-      conflicts.push_back( this_trk );
+      if (a_create[by_start[s]]) create_merges( by_start[s], ends );
+    }
+  }
+}
 
-    } // j
 
-    // if we have conflicts, this may mean divisions have occurred
-    if (conflicts.size() < 2) continue;
 
-    // iterate through the conflicts and put division hypotheses into the
-    // list, including links to the children
-    for (unsigned int p=0; p<conflicts.size(); p++) {
-      // get the first putative child
-      TrackletPtr child_one = conflicts[p];
+// create the hypotheses of a single track
+void HypothesisEngine::create_for_track(const unsigned int a_trk,
+                                        const SweepLineBin &a_window)
+{
+  // get the test track
+  const TrackletPtr &trk = m_tracks[a_trk];
+  const TrackletFeatures &f = m_features[a_trk];
+
+  // false positive hypothesis calculated for everything
+  Hypothesis h_fp(TYPE_Pfalse, trk);
+  h_fp.probability = safe_log( f.P_FP );
+  m_hypotheses.push_back( h_fp );
+
+  // now calculate the initialisation, if the start is fixed it has already
+  // been decided
+  if (f.fixed_start) {
+    Hypothesis h_init(TYPE_Pinit, trk);
+    h_init.probability = 0.;
+    m_hypotheses.push_back( h_init );
+  } else if (hypothesis_allowed(TYPE_Pinit)) {
+    if (m_params.relax ||
+        f.t_first < m_frame_range[0]+m_params.theta_time ||
+        f.d_start < m_params.theta_dist ) {
+
+      Hypothesis h_init(TYPE_Pinit, trk);
+      h_init.probability = safe_log(P_init(f)) + 0.5*f.log_P_TP;
+      m_hypotheses.push_back( h_init );
+    }
+  }
+
+  // if the end is fixed it has already been decided, so the track can only
+  // terminate
+  if (f.fixed_end) {
+    Hypothesis h_term(TYPE_Pterm, trk);
+    h_term.probability = 0.;
+    m_hypotheses.push_back( h_term );
+    return;
+  }
 
-      for (unsigned int q=p+1; q<conflicts.size(); q++) {
-        // get the second putative child
-        TrackletPtr child_two = conflicts[q];
+  // termination?
+  if (hypothesis_allowed(TYPE_Pterm)) {
+    if (m_params.relax ||
+        f.t_last > m_frame_range[1]-m_params.theta_time ||
+        f.d_stop < m_params.theta_dist) {
+
+      Hypothesis h_term(TYPE_Pterm, trk);
+      h_term.probability = safe_log(P_term(f)) + 0.5*f.log_P_TP;
+      m_hypotheses.push_back( h_term );
+    }
+  }
 
-        if (hypothesis_allowed(TYPE_Pdivn)) {
+  // NEW apoptosis detection hypothesis
+  // modify this for apoptosis
+  if (hypothesis_allowed(TYPE_Papop) &&
+      f.n_apoptosis > m_params.apop_thresh) {
 
-          Hypothesis h_divn(TYPE_Pdivn, trk);
-          h_divn.trk_child_one_ID = child_one;
-          h_divn.trk_child_two_ID = child_two;
-          h_divn.probability = safe_log(P_branch(trk, child_one, child_two))
-                              + 0.5*safe_log(P_TP(trk))
-                              + 0.5*safe_log(P_TP(child_one))
-                              + 0.5*safe_log(P_TP(child_two));
-          m_hypotheses.push_back( h_divn );
+    Hypothesis h_apoptosis(TYPE_Papop, trk);
+    h_apoptosis.probability = safe_log(f.P_dead) + 0.5*f.log_P_TP;
+    m_hypotheses.push_back( h_apoptosis );
+  }
+
+  // manage conflicts
+  m_conflicts.clear();
+
+  // iterate over all of the tracks starting nearby in the window
+  a_window.get( f.last, m_candidates );
+
+  for (size_t j=0; j<m_candidates.size(); j++) {
+    // get the track
+    const unsigned int lnk = m_candidates[j];
+    const TrackletFeatures &f_lnk = m_features[lnk];
+    if (f_lnk.fixed_start) continue;
+
+    Eigen::Vector3d delta = f.last - f_lnk.first;
+    float d = std::sqrt( delta.transpose()*delta );
+    float dt = static_cast<double>(f_lnk.t_first) - f.t_last;
+
+    // if we exceed these continue
+    if (d  >= m_params.dist_thresh) continue;
+    if (dt >= m_params.time_thresh || dt < 1) continue; // this was one
+
+    // TODO(arl): limits the maximum link distance ?
+    double link = safe_log(P_link(f, f_lnk, d, dt))
+                  + 0.5*f.log_P_TP
+                  + 0.5*f_lnk.log_P_TP;
+
+    if (hypothesis_allowed(TYPE_Plink)) {
+
+      Hypothesis h_link(TYPE_Plink, trk);
+      h_link.trk_link_ID = m_tracks[lnk];
+      h_link.probability = link;
+      m_hypotheses.push_back( h_link );
+    }
+
+    // append this to conflicts
+    m_conflicts.push_back( std::make_pair(link, lnk) );
+
+  } // j
+
+  // if we have conflicts, this may mean divisions have occurred
+  if (m_conflicts.size() < 2 || !hypothesis_allowed(TYPE_Pdivn)) return;
+
+  const size_t n_pairs = m_conflicts.size()*(m_conflicts.size()-1)/2;
+  best_candidates();
+
+  // iterate through the conflicts and score the putative divisions
+  m_pairs.clear();
+
+  for (unsigned int p=0; p<m_conflicts.size(); p++) {
+    // get the first putative child
+    const TrackletFeatures &f_one = m_features[m_conflicts[p].second];
+
+    for (unsigned int q=p+1; q<m_conflicts.size(); q++) {
+      // get the second putative child
+      const TrackletFeatures &f_two = m_features[m_conflicts[q].second];
+
+      TrackPair divn;
+      divn.track_one = m_conflicts[p].second;
+      divn.track_two = m_conflicts[q].second;
+      divn.probability = safe_log(P_branch(f, f_one, f_two))
+                         + 0.5*f.log_P_TP
+                         + 0.5*f_one.log_P_TP
+                         + 0.5*f_two.log_P_TP;
+      keep_pair( divn );
+    } // q
+  } // p
+
+  sort_pairs();
+
+  // put the division hypotheses into the list, including links to the
+  // children
+  for (size_t i=0; i<m_pairs.size(); i++) {
+    Hypothesis h_divn(TYPE_Pdivn, trk);
+    h_divn.trk_child_one_ID = m_tracks[m_pairs[i].track_one];
+    h_divn.trk_child_two_ID = m_tracks[m_pairs[i].track_two];
+    h_divn.probability = m_pairs[i].probability;
+    m_hypotheses.push_back( h_divn );
+  }
+
+  count_pruned(trk->ID, TYPE_Pdivn, n_pairs - m_pairs.size());
+}
+
+
+
+// create the merge hypotheses of a single track
+void HypothesisEngine::create_merges(const unsigned int a_trk,
+                                     const SweepLineBin &a_window)
+{
+  const TrackletFeatures &f = m_features[a_trk];
+  if (f.fixed_start) return;
+
+  // find the parents, tracks ending nearby in the window
+  m_conflicts.clear();
+  a_window.get( f.first, m_candidates );
+
+  for (size_t j=0; j<m_candidates.size(); j++) {
+    const unsigned int prnt = m_candidates[j];
+    const TrackletFeatures &f_prnt = m_features[prnt];
+    if (f_prnt.fixed_end) continue;
+
+    Eigen::Vector3d delta = f_prnt.last - f.first;
+    float d = std::sqrt( delta.transpose()*delta );
+    float dt = static_cast<double>(f.t_first) - f_prnt.t_last;
+
+    if (d  >= m_params.dist_thresh) continue;
+    if (dt >= m_params.time_thresh || dt < 1) continue;
+
+    double link = safe_log(P_link(f_prnt, f, d, dt))
+                  + 0.5*f_prnt.log_P_TP;
+    m_conflicts.push_back( std::make_pair(link, prnt) );
+  }
+
+  if (m_conflicts.size() < 2) return;
+
+  const size_t n_pairs = m_conflicts.size()*(m_conflicts.size()-1)/2;
+  best_candidates();
+
+  // score the putative merges
+  m_pairs.clear();
+
+  for (unsigned int p=0; p<m_conflicts.size(); p++) {
+    const TrackletFeatures &f_one = m_features[m_conflicts[p].second];
+
+    for (unsigned int q=p+1; q<m_conflicts.size(); q++) {
+      const TrackletFeatures &f_two = m_features[m_conflicts[q].second];
+
+      TrackPair mrge;
+      mrge.track_one = m_conflicts[p].second;
+      mrge.track_two = m_conflicts[q].second;
+      mrge.probability = safe_log(P_merge(f_one, f_two, f))
+                         + 0.5*f.log_P_TP
+                         + 0.5*f_one.log_P_TP
+                         + 0.5*f_two.log_P_TP;
+      keep_pair( mrge );
+    } // q
+  } // p
+
+  sort_pairs();
+
+  // put the merge hypotheses into the list, including links to the parents
+  for (size_t i=0; i<m_pairs.size(); i++) {
+    Hypothesis h_mrge(TYPE_Pmrge, m_tracks[a_trk]);
+    h_mrge.trk_parent_one_ID = m_tracks[m_pairs[i].track_one];
+    h_mrge.trk_parent_two_ID = m_tracks[m_pairs[i].track_two];
+    h_mrge.probability = m_pairs[i].probability;
+    m_hypotheses.push_back( h_mrge );
+  }
+
+  count_pruned(m_tracks[a_trk]->ID, TYPE_Pmrge, n_pairs - m_pairs.size());
+}
+
+
+
+// remove hypotheses which are unlikely to be selected by the optimiser.
+// FP, init and term hypotheses are always kept, as are the hypotheses before
+// a_first, which have been pruned already. The tracks of the hypotheses from
+// a_first onwards have no earlier hypotheses
+void HypothesisEngine::prune(const size_t a_first)
+{
+  const bool absolute = m_params.prune_absolute < 0.;
+  const bool relative = m_params.prune_relative > 0.;
+  if (!absolute && !relative && !m_params.prune_dominated) return;
+
+  // key for the link between the end of one track and the start of another
+  auto link_key = [](const unsigned int a_from, const unsigned int a_to) {
+    return (static_cast<uint64_t>(a_from) << 32) | a_to;
+  };
+
+  // find the best prunable hypothesis of each track
+  std::unordered_map<unsigned int, double> best;
+  for (size_t i=a_first; i<m_hypotheses.size(); i++) {
+    const Hypothesis &h = m_hypotheses[i];
+    if (h.hypothesis == TYPE_Pfalse || h.hypothesis == TYPE_Pinit ||
+        h.hypothesis == TYPE_Pterm) continue;
+
+    std::unordered_map<unsigned int, double>::iterator b = best.find(h.ID);
+    if (b == best.end()) {
+      best[h.ID] = h.probability;
+    } else {
+      b->second = std::max(b->second, h.probability);
+    }
+  }
+
+  // remove the hypotheses below the thresholds, and keep the scores of the
+  // remaining hypotheses needed to test for dominance
+  std::vector<bool> keep(m_hypotheses.size(), true);
+  std::unordered_map<unsigned int, double> init, term;
+  std::unordered_map<uint64_t, double> links;
+
+  for (size_t i=0; i<m_hypotheses.size(); i++) {
+    const Hypothesis &h = m_hypotheses[i];
+
+    switch (h.hypothesis) {
+      case TYPE_undef:
+      case TYPE_Pfalse:
+        continue;
+      case TYPE_Pinit:
+        init[h.ID] = h.probability;
+        continue;
+      case TYPE_Pterm:
+        term[h.ID] = h.probability;
+        continue;
+    }
+
+    if (i < a_first) {
+      if (h.hypothesis == TYPE_Plink) {
+        links[link_key(h.ID, h.trk_link_ID->ID)] = h.probability;
+      }
+    } else if (absolute && h.probability < m_params.prune_absolute) {
+      keep[i] = false;
+    } else if (relative && h.probability < best[h.ID]-m_params.prune_relative) {
+      keep[i] = false;
+    } else if (h.hypothesis == TYPE_Plink) {
+      links[link_key(h.ID, h.trk_link_ID->ID)] = h.probability;
+    }
+  }
+
+  // remove the hypotheses which can be replaced by a combination of other
+  // hypotheses with the same constraints and at least the same probability
+  if (m_params.prune_dominated) {
+
+    // score of the best way to end one track and start another, either by
+    // linking them or by terminating one and initialising the other
+    auto replace = [&](const unsigned int a_from, const unsigned int a_to,
+                       const double a_term, const double a_init) {
+      std::unordered_map<uint64_t, double>::const_iterator lnk;
+      lnk = links.find(link_key(a_from, a_to));
+      if (lnk == links.end()) return a_term + a_init;
+      return std::max(lnk->second, a_term + a_init);
+    };
+
+    const double none = -kInfinity;
+    auto score = [none](const std::unordered_map<unsigned int, double> &a_map,
+                        const unsigned int a_ID) {
+      std::unordered_map<unsigned int, double>::const_iterator s;
+      s = a_map.find(a_ID);
+      return s == a_map.end() ? none : s->second;
+    };
+
+    for (size_t i=a_first; i<m_hypotheses.size(); i++) {
+      if (!keep[i]) continue;
+      const Hypothesis &h = m_hypotheses[i];
+
+      double alternative = none;
+
+      switch (h.hypothesis) {
+
+        // a link is replaced by terminating one track and initialising the
+        // other
+        case TYPE_Plink:
+          alternative = score(term, h.ID) + score(init, h.trk_link_ID->ID);
+          break;
+
+        // apoptosis is replaced by a termination
+        case TYPE_Papop:
+          alternative = score(term, h.ID);
+          break;
+
+        // a division is replaced by a link to one child and the
+        // initialisation of the other
+        case TYPE_Pdivn: {
+          unsigned int c0 = h.trk_child_one_ID->ID;
+          unsigned int c1 = h.trk_child_two_ID->ID;
+          double t = score(term, h.ID);
+          alternative = std::max(
+            replace(h.ID, c0, t, score(init, c0)) + score(init, c1),
+            replace(h.ID, c1, t, score(init, c1)) + score(init, c0));
+          break;
         }
-      } // q
-    } // p
 
+        // a merge is replaced by a link from one parent and the termination
+        // of the other
+        case TYPE_Pmrge: {
+          unsigned int p0 = h.trk_parent_one_ID->ID;
+          unsigned int p1 = h.trk_parent_two_ID->ID;
+          double s = score(init, h.ID);
+          alternative = std::max(
+            replace(p0, h.ID, score(term, p0), s) + score(term, p1),
+            replace(p1, h.ID, score(term, p1), s) + score(term, p0));
+          break;
+        }
+      }
+
+      if (alternative >= h.probability) keep[i] = false;
+    }
   }
 
+  // now remove the pruned hypotheses
+  size_t n_kept = a_first;
+  for (size_t i=a_first; i<m_hypotheses.size(); i++) {
+    if (!keep[i]) {
+      count_pruned(m_hypotheses[i].ID, m_hypotheses[i].hypothesis, 1);
+      continue;
+    }
+    m_hypotheses[n_kept] = m_hypotheses[i];
+    n_kept++;
+  }
+  m_hypotheses.resize(n_kept);
 }
 
 
 
-// FALSE POSITIVE TRAJECTORY
-double HypothesisEngine::P_FP( TrackletPtr a_trk ) const
+// only consider the candidates with the most probable links, these are then
+// returned to the order of the tracks
+void HypothesisEngine::best_candidates()
 {
-  unsigned int len_track = static_cast<unsigned int>(1.+a_trk->duration());
-  return std::pow(m_params.segmentation_miss_rate, len_track);
+  if (m_params.max_children == 0) return;
+  if (m_conflicts.size() <= m_params.max_children) return;
+
+  std::partial_sort(m_conflicts.begin(),
+                    m_conflicts.begin()+m_params.max_children,
+                    m_conflicts.end(),
+                    [](const std::pair<double, unsigned int> &a,
+                       const std::pair<double, unsigned int> &b) {
+                      if (a.first != b.first) return a.first > b.first;
+                      return a.second < b.second;
+                    });
+  m_conflicts.resize(m_params.max_children);
+  std::sort(m_conflicts.begin(), m_conflicts.end(),
+            [](const std::pair<double, unsigned int> &a,
+               const std::pair<double, unsigned int> &b) {
+              return a.second < b.second;
+            });
+}
+
+
+
+// keep a pair, when the number of pairs is bounded the best are kept in a
+// min-heap
+void HypothesisEngine::keep_pair(const TrackPair &a_pair)
+{
+  const size_t max_pairs = m_params.max_divisions;
+
+  if (max_pairs == 0) {
+    m_pairs.push_back( a_pair );
+    return;
+  }
+
+  if (m_pairs.size() < max_pairs) {
+    m_pairs.push_back( a_pair );
+    std::push_heap(m_pairs.begin(), m_pairs.end(), std::greater<TrackPair>());
+  } else if (a_pair > m_pairs.front()) {
+    std::pop_heap(m_pairs.begin(), m_pairs.end(), std::greater<TrackPair>());
+    m_pairs.back() = a_pair;
+    std::push_heap(m_pairs.begin(), m_pairs.end(), std::greater<TrackPair>());
+  }
+}
+
+
+
+// return the kept pairs from the heap to the order of enumeration
+void HypothesisEngine::sort_pairs()
+{
+  if (m_params.max_divisions == 0) return;
+
+  std::sort(m_pairs.begin(), m_pairs.end(),
+            [](const TrackPair &a, const TrackPair &b) {
+              if (a.track_one != b.track_one) return a.track_one < b.track_one;
+              return a.track_two < b.track_two;
+            });
+}
+
+
+
+// return the number of hypotheses of each type, before and after pruning
+void HypothesisEngine::counts(unsigned int* a_before,
+                              unsigned int* a_after) const
+{
+  for (size_t i=0; i<HYPOTHESIS_TYPES; i++) a_after[i] = 0;
+  for (size_t i=0; i<m_hypotheses.size(); i++) {
+    if (m_hypotheses[i].hypothesis < HYPOTHESIS_TYPES) {
+      a_after[m_hypotheses[i].hypothesis]++;
+    }
+  }
+
+  for (size_t i=0; i<HYPOTHESIS_TYPES; i++) {
+    a_before[i] = a_after[i] + m_pruned[i];
+  }
 }
 
 
 
-// TRUE POSITIVE TRAJECTORY
-double HypothesisEngine::P_TP( TrackletPtr a_trk ) const
+// FALSE POSITIVE TRAJECTORY
+double HypothesisEngine::P_FP( const TrackletPtr &a_trk ) const
 {
-  return 1.0 - P_FP(a_trk);
+  unsigned int len_track = static_cast<unsigned int>(1.+a_trk->duration());
+  return std::pow(m_params.segmentation_miss_rate, len_track);
 }
 
 
 
 // INITIALISATION PROBABILITY
-double HypothesisEngine::P_init( TrackletPtr a_trk ) const
+double HypothesisEngine::P_init( const TrackletFeatures &a_trk ) const
 {
   // Probability of a true initialisation event.  These tend to occur close to
   // the beginning of the sequence or at the periphery of the field of view as
   // objects enter.
 
 
-  float dist = dist_from_border(a_trk, true);
+  float dist = a_trk.d_start;
 
   double prob[2] = {0.0, 0.0};
   bool init = false;
 
 
-  if (a_trk->track.front()->t < m_frame_range[0]+m_params.theta_time) {
-    prob[0] = std::exp(-(a_trk->track.front()->t-(float)m_frame_range[0]+1.0) /
+  if (a_trk.t_first < m_frame_range[0]+m_params.theta_time) {
+    prob[0] = std::exp(-(a_trk.t_first-(float)m_frame_range[0]+1.0) /
               m_params.lambda_time);
     init = true;
   }
@@ -384,18 +1082,18 @@ double HypothesisEngine::P_init( TrackletPtr a_trk ) const
 
 
 // TERMINATION PROBABILITY
-double HypothesisEngine::P_term( TrackletPtr a_trk ) const
+double HypothesisEngine::P_term( const TrackletFeatures &a_trk ) const
 {
   // Probability of termination event.  Similar to initialisation, except that
   // we use the final location/time of the tracklet.
 
-  float dist = dist_from_border(a_trk, false);
+  float dist = a_trk.d_stop;
 
   double prob[2] = {0.0, 0.0};
   bool term = false;
 
-  if (m_frame_range[1]-a_trk->track.back()->t < m_params.theta_time) {
-    prob[0] = std::exp(-((float)m_frame_range[1]-a_trk->track.back()->t) /
+  if (m_frame_range[1]-a_trk.t_last < m_params.theta_time) {
+    prob[0] = std::exp(-((float)m_frame_range[1]-a_trk.t_last) /
               m_params.lambda_time );
     term = true;
   }
@@ -417,45 +1115,28 @@ double HypothesisEngine::P_term( TrackletPtr a_trk ) const
 
 
 // APOPTOSIS PROBABILITY
-double HypothesisEngine::P_dead(TrackletPtr a_trk,
-                                const unsigned int n_apoptosis ) const
+double HypothesisEngine::P_dead( const TrackletFeatures &a_trk ) const
 {
   // want to discount this by how close it is to the border of the field of
   // view
-  float dist = dist_from_border(a_trk, false);
+  float dist = a_trk.d_stop;
   float discount = 1.0 - std::exp(-dist/m_params.lambda_dist);
-  return (1.0 - std::pow(m_params.apoptosis_rate, n_apoptosis)) * discount;
-}
-
-double HypothesisEngine::P_dead( TrackletPtr a_trk ) const
-{
-  unsigned int n_apoptosis = count_apoptosis(a_trk);
-  return P_dead(a_trk, n_apoptosis);
+  return (1.0 - std::pow(m_params.apoptosis_rate, a_trk.n_apoptosis)) * discount;
 }
 
 
 
 // LINKING PROBABILITY
-double HypothesisEngine::P_link(TrackletPtr a_trk,
-                                TrackletPtr a_trk_lnk) const
-{
-  float d = link_distance(a_trk, a_trk_lnk);
-  float dt = link_time(a_trk, a_trk_lnk);
-
-  // return the full version output
-  return P_link(a_trk, a_trk_lnk, d, dt);
-}
-
-double HypothesisEngine::P_link(TrackletPtr a_trk,
-                                TrackletPtr a_trk_lnk,
+double HypothesisEngine::P_link(const TrackletFeatures &a_trk,
+                                const TrackletFeatures &a_trk_lnk,
                                 float d,
                                 float dt) const
 {
 
   // try to not link metaphase to anaphase
   if (DISALLOW_METAPHASE_ANAPHASE_LINKING) {
-    if (a_trk->track.back()->label == STATE_metaphase &&
-        a_trk_lnk->track.front()->label == STATE_anaphase) {
+    if (a_trk.label_last == STATE_metaphase &&
+        a_trk_lnk.label_first == STATE_anaphase) {
       return m_params.eta ;
     }
   }
@@ -470,9 +1151,9 @@ double HypothesisEngine::P_link(TrackletPtr a_trk,
 
 
 // DIVISION PROBABILITY
-double HypothesisEngine::P_branch(TrackletPtr a_trk,
-                                  TrackletPtr a_trk_c0,
-                                  TrackletPtr a_trk_c1) const
+double HypothesisEngine::P_branch(const TrackletFeatures &a_trk,
+                                  const TrackletFeatures &a_trk_c0,
+                                  const TrackletFeatures &a_trk_c1) const
 {
 
   // calculate the distance between the previous observation and both of the
@@ -480,8 +1161,8 @@ double HypothesisEngine::P_branch(TrackletPtr a_trk,
   // a dot product < 0 would indicate that the cells are aligned with the
   // metaphase phase i.e. a good division
   Eigen::Vector3d d_c0, d_c1;
-  d_c0 = a_trk_c0->track.front()->position() - a_trk->track.back()->position();
-  d_c1 = a_trk_c1->track.front()->position() - a_trk->track.back()->position();
+  d_c0 = a_trk_c0.first - a_trk.last;
+  d_c1 = a_trk_c1.first - a_trk.last;
 
   // normalise the vectors to calculate the dot product
   double dot_product = d_c0.normalized().transpose() * d_c1.normalized();
@@ -491,14 +1172,14 @@ double HypothesisEngine::P_branch(TrackletPtr a_trk,
   double weight;
 
   // parent is metaphase
-  if (a_trk->track.back()->label == STATE_metaphase) {
-    if (a_trk_c0->track.front()->label == STATE_anaphase &&
-        a_trk_c1->track.front()->label == STATE_anaphase) {
+  if (a_trk.label_last == STATE_metaphase) {
+    if (a_trk_c0.label_first == STATE_anaphase &&
+        a_trk_c1.label_first == STATE_anaphase) {
 
         // BEST
         weight = WEIGHT_METAPHASE_ANAPHASE_ANAPHASE;
-    } else if ( a_trk_c0->track.front()->label == STATE_anaphase ||
-                a_trk_c1->track.front()->label == STATE_anaphase ) {
+    } else if ( a_trk_c0.label_first == STATE_anaphase ||
+                a_trk_c1.label_first == STATE_anaphase ) {
 
         // PRETTY GOOD
         weight = WEIGHT_METAPHASE_ANAPHASE;
@@ -510,19 +1191,19 @@ double HypothesisEngine::P_branch(TrackletPtr a_trk,
 
   // parent is not metaphase
   } else {
-    if (a_trk_c0->track.front()->label == STATE_anaphase &&
-        a_trk_c1->track.front()->label == STATE_anaphase) {
+    if (a_trk_c0.label_first == STATE_anaphase &&
+        a_trk_c1.label_first == STATE_anaphase) {
 
           // PRETTY GOOD
           weight = WEIGHT_ANAPHASE_ANAPHASE;
-    } else if ( a_trk_c0->track.front()->label == STATE_anaphase ||
-                a_trk_c1->track.front()->label == STATE_anaphase ) {
+    } else if ( a_trk_c0.label_first == STATE_anaphase ||
+                a_trk_c1.label_first == STATE_anaphase ) {
 
           // OK
           weight = WEIGHT_ANAPHASE;
     } else {
       // in this case, none of the criteria are satisfied
-      weight = WEIGHT_OTHER + 10.*P_dead(a_trk_c0) + 10.*P_dead(a_trk_c1);
+      weight = WEIGHT_OTHER + 10.*a_trk_c0.P_dead + 10.*a_trk_c1.P_dead;
     }
   }
 
@@ -537,3 +1218,35 @@ double HypothesisEngine::P_branch(TrackletPtr a_trk,
 
   return std::exp(-delta_g/(2.*m_params.lambda_branch));
 }
+
+
+
+// MERGE PROBABILITY
+double HypothesisEngine::P_merge(const TrackletFeatures &a_trk_m0,
+                                 const TrackletFeatures &a_trk_m1,
+                                 const TrackletFeatures &a_trk) const
+{
+  // Probability of two tracks converging onto the start of a third. Both of
+  // the parents must be plausible links to the merged track, and parents
+  // arriving from opposite sides are favoured, as for the children of a
+  // division
+  Eigen::Vector3d d_m0, d_m1;
+  d_m0 = a_trk_m0.last - a_trk.first;
+  d_m1 = a_trk_m1.last - a_trk.first;
+
+  float dt_m0 = static_cast<double>(a_trk.t_first) - a_trk_m0.t_last;
+  float dt_m1 = static_cast<double>(a_trk.t_first) - a_trk_m1.t_last;
+
+  // make sure that we're looking forward in time
+  assert(dt_m0>0.0 && dt_m1>0.0);
+
+  // the parents are linked to the merged track
+  double link = (d_m0.norm()*dt_m0 + d_m1.norm()*dt_m1) / 2.;
+
+  // normalise the vectors to calculate the dot product
+  double dot_product = d_m0.normalized().transpose() * d_m1.normalized();
+  double delta_g = (1.-std::erf(dot_product / (3.*kRootTwo)))/2.0;
+
+  return std::exp(-link/m_params.lambda_link)
+         * std::exp(-delta_g/(2.*m_params.lambda_branch));
+}
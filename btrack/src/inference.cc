@@ -76,3 +76,25 @@ Eigen::VectorXd ObjectModel::predict() {
   prediction = x_hat * transition;
   return prediction;
 }
+
+
+
+// write the model matrices and the current state
+void ObjectModel::write_model(BinaryWriter &a_writer) const
+{
+  a_writer.write_matrix(transition);
+  a_writer.write_matrix(emission);
+  a_writer.write_matrix(x_hat);
+}
+
+
+
+// read the model matrices, and set up a new model
+void ObjectModel::read_model(BinaryReader &a_reader)
+{
+  Eigen::MatrixXd transition_in = a_reader.read_matrix();
+  Eigen::MatrixXd emission_in = a_reader.read_matrix();
+  Eigen::MatrixXd start_in = a_reader.read_matrix();
+  if (!a_reader.good()) return;
+  *this = ObjectModel(transition_in, emission_in, start_in);
+}
@@ -24,11 +24,11 @@ extern "C" {
   ========================================================================= */
 
 
-  InterfaceWrapper* new_interface() {
+  InterfaceWrapper* new_interface( const bool verbose ) {
     if (DEBUG) {
       std::cout << "InterfaceWrapper constructor called in C++" << std::endl;
     }
-    return new InterfaceWrapper();
+    return new InterfaceWrapper(verbose);
   }
 
   void del_interface(InterfaceWrapper* h){
@@ -71,6 +71,22 @@ extern "C" {
     h->set_max_search_radius(msr);
   }
 
+  void set_gating( InterfaceWrapper* h,
+                   const double gate_probability ) {
+    if (DEBUG) {
+      std::cout << "Set gating probability to: " << gate_probability << std::endl;
+    }
+    h->set_gating(gate_probability);
+  }
+
+  unsigned int set_precision( InterfaceWrapper* h,
+                              const unsigned int precision ) {
+    if (DEBUG) {
+      std::cout << "Set belief precision to: " << precision << std::endl;
+    }
+    return h->set_precision(precision);
+  }
+
 
   /* =========================================================================
   APPEND NEW OBJECT
@@ -91,11 +107,85 @@ extern "C" {
     return h->track();
   }
 
+  unsigned int track_async( InterfaceWrapper* h ){
+    return h->track_async();
+  }
+
+  void get_progress( InterfaceWrapper* h, PyTrackProgress* progress ){
+    h->get_progress(progress);
+  }
+
+  void cancel( InterfaceWrapper* h ){
+    h->cancel();
+  }
+
+  const PyTrackInfo* wait( InterfaceWrapper* h ){
+    return h->wait();
+  }
+
+  const PyTrackInfo* track_chunked( InterfaceWrapper* h,
+                                    const unsigned int n_threads,
+                                    const unsigned int overlap ){
+    return h->track_chunked(n_threads, overlap);
+  }
+
+  unsigned int track_many( InterfaceWrapper** h,
+                           const unsigned int n_datasets,
+                           const unsigned int n_threads,
+                           const PyHypothesisParams* params,
+                           PyTrackInfo* stats ){
+    return track_datasets(h, n_datasets, n_threads, params, stats);
+  }
+
+  void copy_configuration( InterfaceWrapper* h,
+                           const InterfaceWrapper* source ){
+    h->copy_configuration(*source);
+  }
+
+  const PyTrackInfo* track_tiled( InterfaceWrapper* h,
+                                  const unsigned int n_tiles_x,
+                                  const unsigned int n_tiles_y,
+                                  const unsigned int n_threads ){
+    return h->track_tiled(n_tiles_x, n_tiles_y, n_threads);
+  }
+
   const PyTrackInfo* step( InterfaceWrapper* h, const unsigned int n_steps ){
     //h->step(n_steps);
     return h->step(n_steps);
   }
 
+  /* =========================================================================
+  STREAMING MODE
+  ========================================================================= */
+  const PyTrackInfo* stream( InterfaceWrapper* h,
+                             const PyTrackObject* objects,
+                             const unsigned int n_objects,
+                             const unsigned int frame,
+                             unsigned int* output ){
+    return h->stream(objects, n_objects, frame, output);
+  }
+
+  void finalise( InterfaceWrapper* h ){
+    h->finalise();
+  }
+
+  /* =========================================================================
+  CHECKPOINT AND RESTORE
+  ========================================================================= */
+  unsigned int checkpoint( InterfaceWrapper* h, const char* filename ) {
+    return h->checkpoint(filename);
+  }
+
+  unsigned int restore( InterfaceWrapper* h, const char* filename ) {
+    return h->restore(filename);
+  }
+
+  void set_checkpoint( InterfaceWrapper* h,
+                       const char* filename,
+                       const unsigned int interval ) {
+    h->set_checkpoint(filename, interval);
+  }
+
   /* =========================================================================
   GET A TRACKLET
   ========================================================================= */
@@ -155,6 +245,13 @@ extern "C" {
     return h->get_dummy(obj);
   }
 
+  /* =========================================================================
+  WRITE THE TRACKS TO A BINARY TRACK STORE
+  ========================================================================= */
+  unsigned int write_store( InterfaceWrapper* h, const char* filename ) {
+    return h->write_store(filename);
+  }
+
   /* =========================================================================
   RETURN THE NUMBER OF FOUND TRACKS
   ========================================================================= */
@@ -170,6 +267,22 @@ extern "C" {
     return h->get_volume(volume);
   }
 
+  void set_volume( InterfaceWrapper* h, const double* volume ) {
+    return h->set_volume(volume);
+  }
+
+  unsigned int set_frame_times( InterfaceWrapper* h,
+                                const double* times,
+                                const unsigned int n_frames ) {
+    return h->set_frame_times(times, n_frames);
+  }
+
+  unsigned int set_retirement( InterfaceWrapper* h,
+                               const char* filename,
+                               const unsigned int window ) {
+    return h->set_retirement(filename, window);
+  }
+
   /* =========================================================================
   OPTIMIZER
   ========================================================================= */
@@ -187,6 +300,13 @@ extern "C" {
     return h->get_hypothesis(a_ID);
   };
 
+  void get_hypothesis_counts( InterfaceWrapper* h,
+                              unsigned int* before,
+                              unsigned int* after )
+  {
+    h->get_hypothesis_counts(before, after);
+  }
+
   void merge(InterfaceWrapper*h,
             unsigned int* a_hypotheses,
             unsigned int n_hypotheses)
@@ -194,4 +314,12 @@ extern "C" {
     h->merge(a_hypotheses, n_hypotheses);
   }
 
+  unsigned int merge_before(InterfaceWrapper* h,
+                            unsigned int* a_hypotheses,
+                            unsigned int n_hypotheses,
+                            const unsigned int a_frame)
+  {
+    return h->merge_before(a_hypotheses, n_hypotheses, a_frame);
+  }
+
 }
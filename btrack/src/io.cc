@@ -0,0 +1,168 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+#include "io.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+
+// open a file for writing
+bool BinaryWriter::open(const std::string &a_filename, const bool a_append)
+{
+  close();
+
+  m_file = std::fopen(a_filename.c_str(), a_append ? "ab" : "wb");
+  if (m_file == NULL) return false;
+
+  // if we're appending, start the offset at the end of the file
+  m_offset = 0;
+  if (a_append) {
+    std::fseek(m_file, 0, SEEK_END);
+    m_offset = static_cast<uint64_t>(std::ftell(m_file));
+  }
+  m_buffer.reserve(WRITE_BUFFER_SIZE);
+  m_buffer.clear();
+  m_error = false;
+  return true;
+}
+
+
+
+// flush and close the file
+bool BinaryWriter::close()
+{
+  if (m_file == NULL) return true;
+  bool ok = flush();
+  ok = (std::fclose(m_file) == 0) && ok;
+  m_file = NULL;
+  return ok && !m_error;
+}
+
+
+
+// write the contents of the buffer to disk
+bool BinaryWriter::flush()
+{
+  if (m_file == NULL) return false;
+  if (!m_buffer.empty()) {
+    size_t n = std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+    if (n != m_buffer.size()) m_error = true;
+    m_buffer.clear();
+  }
+  if (std::fflush(m_file) != 0) m_error = true;
+  return !m_error;
+}
+
+
+
+// write some data into the buffer, flushing to disk if it is full. Any
+// failure is recorded, rather than returned, so that it can be checked once
+// the complete record has been written
+void BinaryWriter::write(const void* a_data, const size_t a_bytes)
+{
+  if (m_file == NULL) {
+    m_error = true;
+    return;
+  }
+
+  if (m_buffer.size() + a_bytes > WRITE_BUFFER_SIZE) {
+    flush();
+  }
+
+  // very large blocks are written straight to disk
+  if (a_bytes > WRITE_BUFFER_SIZE) {
+    if (std::fwrite(a_data, 1, a_bytes, m_file) != a_bytes) m_error = true;
+  } else {
+    const char* data = static_cast<const char*>(a_data);
+    m_buffer.insert(m_buffer.end(), data, data+a_bytes);
+  }
+
+  m_offset += a_bytes;
+}
+
+
+
+// read some data from the memory block
+void BinaryReader::read(void* a_data, const size_t a_bytes)
+{
+  if (m_error || m_offset + a_bytes > m_size) {
+    std::memset(a_data, 0, a_bytes);
+    m_error = true;
+    return;
+  }
+  std::memcpy(a_data, m_data+m_offset, a_bytes);
+  m_offset += a_bytes;
+}
+
+
+
+// read a matrix, stored column major with the dimensions first
+Eigen::MatrixXd BinaryReader::read_matrix()
+{
+  uint32_t rows = read<uint32_t>();
+  uint32_t cols = read<uint32_t>();
+
+  // sanity check the dimensions before allocating anything
+  if (!good() || uint64_t(rows)*cols*sizeof(double) > m_size-m_offset) {
+    m_error = true;
+    return Eigen::MatrixXd();
+  }
+
+  Eigen::MatrixXd m(rows, cols);
+  read(m.data(), sizeof(double)*rows*cols);
+  return m;
+}
+
+
+
+// map a file into memory
+bool MappedFile::open(const std::string &a_filename)
+{
+  close();
+
+  int fd = ::open(a_filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (data == MAP_FAILED) return false;
+
+  m_data = static_cast<const char*>(data);
+  m_size = static_cast<uint64_t>(st.st_size);
+  return true;
+}
+
+
+
+// unmap the file
+void MappedFile::close()
+{
+  if (m_data == NULL) return;
+  munmap(const_cast<char*>(m_data), m_size);
+  m_data = NULL;
+  m_size = 0;
+}
@@ -27,13 +27,18 @@ bool compare_hypothesis_time(const Hypothesis &h_one, const Hypothesis &h_two)
 
 // take two tracks and merge the contents, rename the merged track and mark for
 // removal at the end
-void join_tracks(const TrackletPtr &parent_trk, const TrackletPtr &join_trk)
+void join_tracks(const TrackletPtr &parent_trk,
+                 const TrackletPtr &join_trk,
+                 const ElapsedTime &a_elapsed)
 {
   if (DEBUG) std::cout << join_trk->ID << ",";
 
-  // append the pointers to the objects to the parent track object
+  // append the pointers to the objects to the parent track object, the first
+  // object may be several frames after the end of the parent
   for (size_t i=0; i<join_trk->length(); i++) {
-    parent_trk->append(join_trk->track[i], true);
+    const TrackObjectPtr &obj = join_trk->track[i];
+    parent_trk->append(obj, true, a_elapsed(parent_trk->track.back()->t,
+                                            obj->t));
   }
 
   // set the renamed ID and a flag to remove
@@ -46,6 +51,25 @@ void join_tracks(const TrackletPtr &parent_trk, const TrackletPtr &join_trk)
 
 
 
+// the ID of a track, which may have been joined to another and renamed
+static unsigned int surviving_ID(const TrackletPtr &a_trk)
+{
+  return a_trk->to_remove() ? a_trk->renamed_ID : a_trk->ID;
+}
+
+
+
+// set the parent of a track, the root is that of the parent, or the parent
+// itself if it has no root
+static void set_parent(const TrackletPtr &a_child,
+                       const TrackletPtr &a_parent)
+{
+  a_child->parent = surviving_ID(a_parent);
+  a_child->root = a_parent->root != 0 ? a_parent->root : a_child->parent;
+}
+
+
+
 // branches
 void branch_tracks(const BranchHypothesis &branch)
 {
@@ -54,26 +78,16 @@ void branch_tracks(const BranchHypothesis &branch)
   TrackletPtr child_one_trk = std::get<1>(branch);
   TrackletPtr child_two_trk = std::get<2>(branch);
 
-  // local ID for parent track (could be renamed, so need to check)
-  unsigned int ID;
-
-  // first check to see whether the parent has been renamed
-  if (parent_trk->to_remove()) {
-    ID = parent_trk->renamed_ID;
-  } else {
-    ID = parent_trk->ID;
-  }
-
   // output some details?
   if (DEBUG) {
-    std::cout << parent_trk->ID << " (renamed: " << ID << ") {";
-    std::cout << child_one_trk->ID << ", ";
+    std::cout << parent_trk->ID << " (renamed: " << surviving_ID(parent_trk);
+    std::cout << ") {" << child_one_trk->ID << ", ";
     std::cout << child_two_trk->ID << "}";
   }
 
-  // set the parent ID for these children
-  child_one_trk->parent = ID;
-  child_two_trk->parent = ID;
+  // set the parent ID for these children, the parent could be renamed
+  set_parent(child_one_trk, parent_trk);
+  set_parent(child_two_trk, parent_trk);
 
   // TODO(arl): we can also set children here, this makes tree generation easier
 
@@ -83,8 +97,30 @@ void branch_tracks(const BranchHypothesis &branch)
 
 
 
+// merges, a track only stores a single parent, so the merged track takes the
+// first parent as its parent
+void merge_tracks(const MergeHypothesis &merge)
+{
+  // makes some local pointers to the tracklets
+  TrackletPtr child_trk = std::get<0>(merge);
+  TrackletPtr parent_one_trk = std::get<1>(merge);
+  TrackletPtr parent_two_trk = std::get<2>(merge);
+
+  // output some details?
+  if (DEBUG) {
+    std::cout << "{" << surviving_ID(parent_one_trk) << ", ";
+    std::cout << surviving_ID(parent_two_trk) << "} " << child_trk->ID;
+  }
+
+  // set the parent of the merged track, the parent could be renamed
+  set_parent(child_trk, parent_one_trk);
+}
+
+
+
 // take a list of hypotheses and re-organise the tracks following optimisation
-void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses)
+void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses,
+                         const ElapsedTime &a_elapsed)
 {
 
   if (a_hypotheses.empty()) {
@@ -100,9 +136,30 @@ void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses)
   // get the number of hypotheses
   size_t n_hypotheses = a_hypotheses.size();
 
-  // make some space for the different hypotheses
-  m_links = HypothesisMap<JoinHypothesis>( size() );
-  m_branches = HypothesisMap<BranchHypothesis>( size() );
+  // the hypotheses are keyed by the track ID, so that the cost of a merge
+  // depends on the number of hypotheses rather than the largest ID. Only the
+  // first hypothesis of each type is used for each track
+  m_links.clear();
+  m_branches.clear();
+  m_merges.clear();
+
+  // the archived tracks which are changed by the hypotheses, if any, are found
+  // by removing the live tracks from the tracks of the hypotheses
+  std::unordered_set<const Tracklet*> changed;
+  if (n_archived() > 0) {
+    for (size_t i=0; i<n_hypotheses; i++) {
+      const Hypothesis &h = a_hypotheses[i];
+      for (const TrackletPtr &trk : {h.trk_ID, h.trk_link_ID,
+                                     h.trk_child_one_ID, h.trk_child_two_ID,
+                                     h.trk_parent_one_ID,
+                                     h.trk_parent_two_ID}) {
+        if (trk) changed.insert(trk.get());
+      }
+    }
+    for (size_t i=0; i<m_tracks.size() && !changed.empty(); i++) {
+      changed.erase(m_tracks[i].get());
+    }
+  }
 
   // loop through the hypotheses, split into link and branch types
   for (size_t i=0; i<n_hypotheses; i++) {
@@ -110,8 +167,9 @@ void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses)
     Hypothesis h = a_hypotheses[i];
 
     // set the fate of each track as the 'accepted' hypothesis. these will be
-    // overwritten in the link and division events
-    h.trk_ID->fate = h.hypothesis;
+    // overwritten in the link and division events. A merge is the start of
+    // the merged track, so the fate is instead set for the parents
+    if (h.hypothesis != TYPE_Pmrge) h.trk_ID->fate = h.hypothesis;
 
     switch (h.hypothesis) {
 
@@ -123,7 +181,7 @@ void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses)
         }
 
         // push a link hypothesis
-        m_links.push(h.trk_ID->ID, JoinHypothesis(h.trk_ID, h.trk_link_ID));
+        m_links.emplace(h.trk_ID->ID, JoinHypothesis(h.trk_ID, h.trk_link_ID));
         break;
 
 
@@ -137,14 +195,25 @@ void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses)
         }
 
         // push a branch hypothesis
-        m_branches.push(h.trk_ID->ID, BranchHypothesis(h.trk_ID,
-                                                       h.trk_child_one_ID,
-                                                       h.trk_child_two_ID));
+        m_branches.emplace(h.trk_ID->ID, BranchHypothesis(h.trk_ID,
+                                                          h.trk_child_one_ID,
+                                                          h.trk_child_two_ID));
         break;
 
 
+      // merge
       case TYPE_Pmrge:
-        // do nothing if we have a merge
+        if (DEBUG) {
+          std::cout << "P_merge: " << h.trk_parent_one_ID->ID << "->" << h.trk_ID->ID;
+          std::cout << " [Score: " << h.probability << "]" << std::endl;
+          std::cout << "P_merge: " << h.trk_parent_two_ID->ID << "->" << h.trk_ID->ID;
+          std::cout << " [Score: " << h.probability << "]" << std::endl;
+        }
+
+        // push a merge hypothesis
+        m_merges.emplace(h.trk_ID->ID, MergeHypothesis(h.trk_ID,
+                                                       h.trk_parent_one_ID,
+                                                       h.trk_parent_two_ID));
         break;
 
     }
@@ -162,34 +231,47 @@ void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses)
 
   */
 
+  // set the fate of the parents of a merge as 'merged' before following the
+  // links, so that it is passed on if a parent is joined to an earlier track
+  for (auto merge=m_merges.begin(); merge!=m_merges.end(); ++merge) {
+    std::get<1>(merge->second)->fate = TYPE_Pmrge;
+    std::get<2>(merge->second)->fate = TYPE_Pmrge;
+  }
+
   std::set<unsigned int> used;
   unsigned int child_j;
 
-  // let's try to follow the links, iterate over the link hypotheses
-  for (size_t parent_i=0; parent_i<m_links.size(); parent_i++) {
+  // let's try to follow the links, iterate over the link hypotheses in order
+  // of the parent ID
+  for (auto link=m_links.begin(); link!=m_links.end(); ++link) {
+
+    unsigned int parent_i = link->first;
 
-    // if we have a linkage, and we haven't already used this...
-    if (!m_links[parent_i].empty() && used.count(parent_i)==0) {
+    // if we haven't already used this linkage...
+    if (used.count(parent_i)==0) {
 
       // now follow the chain
       used.emplace(parent_i);
-      child_j = m_links[parent_i][0].second->ID;
+      const TrackletPtr &parent_trk = link->second.first;
+      child_j = link->second.second->ID;
 
       // merge the tracks
       if (DEBUG) std::cout << "Merge: [" << parent_i << ",";
-      join_tracks(m_links[parent_i][0].first, m_links[parent_i][0].second);
+      join_tracks(parent_trk, link->second.second, a_elapsed);
 
       // mark the child as used
       used.emplace(child_j);
 
       // traverse the chain
-      while(!m_links[child_j].empty()) {
+      auto next = m_links.find(child_j);
+      while(next != m_links.end()) {
         // merge the next track
-        join_tracks(m_links[parent_i][0].first, m_links[child_j][0].second);
+        join_tracks(parent_trk, next->second.second, a_elapsed);
 
         // iterate
-        child_j = m_links[child_j][0].second->ID;
+        child_j = next->second.second->ID;
         used.emplace(child_j);
+        next = m_links.find(child_j);
       }
       if (DEBUG) std::cout << "]" << std::endl;
     }
@@ -197,16 +279,18 @@ void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses)
 
 
   // OK, now that we've merged all of the tracks, we want to set various flags
-  // to show that divisions have occurred
-
-  for (size_t parent_i=0; parent_i<m_branches.size(); parent_i++) {
+  // to show that divisions and merges have occurred
 
-    if (!m_branches[parent_i].empty()) {
-      if (DEBUG) std::cout << "Branch: [";
-      branch_tracks(m_branches[parent_i][0]);
-      if (DEBUG) std::cout << "]" << std::endl;
-    }
+  for (auto branch=m_branches.begin(); branch!=m_branches.end(); ++branch) {
+    if (DEBUG) std::cout << "Branch: [";
+    branch_tracks(branch->second);
+    if (DEBUG) std::cout << "]" << std::endl;
+  }
 
+  for (auto merge=m_merges.begin(); merge!=m_merges.end(); ++merge) {
+    if (DEBUG) std::cout << "Merged: [";
+    merge_tracks(merge->second);
+    if (DEBUG) std::cout << "]" << std::endl;
   }
 
   // erase those tracks marked for removal (i.e. those that have been merged)
@@ -217,6 +301,10 @@ void TrackManager::merge(const std::vector<Hypothesis> &a_hypotheses)
                   [](const TrackletPtr &t) { return t->to_remove(); }),
                   m_tracks.end() );
 
+  // and from the archive, which is only rewritten if any of the archived
+  // tracks have been changed
+  if (!changed.empty()) compact_archive();
+
   // give the user some more output
   if (DEBUG) std::cout << ", now " << m_tracks.size() << std::endl;
 
@@ -232,8 +320,12 @@ void TrackManager::finalise()
 
   if (DEBUG) std::cout << "Finalising all tracks..." << std::endl;
 
-  // set the global dummy ID counter here
-  int dummy_ID = -1;
+  // the tracks are trimmed and may have been merged
+  m_revision++;
+
+  // set the global dummy ID counter here, archived tracks already have their
+  // dummy IDs
+  int dummy_ID = -1 - static_cast<int>(m_archived_dummies.size());
   m_dummies.clear();
 
   // iterate over the tracks, trim and renumber
@@ -260,10 +352,20 @@ TrackObjectPtr TrackManager::get_dummy(const int a_idx) const
 {
   // first check that we're trying to get a dummy object (ID should be neg)
   assert(a_idx<0);
-  assert(!m_dummies.empty());
 
   unsigned int dummy_idx = std::abs(a_idx+1);
 
+  // is this dummy in the archive?
+  if (dummy_idx < m_archived_dummies.size()) {
+    const std::pair<size_t, size_t> &d = m_archived_dummies[dummy_idx];
+    TrackletPtr trk = m_archive->load(d.first);
+    if (!trk) return TrackObjectPtr();
+    return trk->track[d.second];
+  }
+
+  dummy_idx -= m_archived_dummies.size();
+  assert(!m_dummies.empty());
+
   // sanity check that we've actually got a dummy
   assert(m_dummies[dummy_idx]->dummy);
 
@@ -271,3 +373,158 @@ TrackObjectPtr TrackManager::get_dummy(const int a_idx) const
   return m_dummies[dummy_idx];
 
 }
+
+
+
+// move finished tracks to the archive
+size_t TrackManager::retire(const unsigned int a_frame,
+                            const unsigned int a_window)
+{
+  if (!m_archive || !m_archive->is_open() || !m_archive->good()) return 0;
+
+  // the window must be at least one frame, otherwise we may retire tracks
+  // which have been updated in the current frame
+  unsigned int window = std::max(a_window, static_cast<unsigned int>(1));
+
+  size_t n_kept = 0;
+  size_t n_retired = 0;
+
+  for (size_t i=0; i<m_tracks.size(); i++) {
+
+    TrackletPtr trk = m_tracks[i];
+
+    if (trk->active() || trk->track.back()->t + window >= a_frame) {
+      m_tracks[n_kept] = trk;
+      n_kept++;
+      continue;
+    }
+
+    // the track is finished, so trim it and give the dummies their IDs now
+    trk->trim();
+    size_t idx = m_archive->size();
+    for (size_t o=0; o<trk->track.size(); o++) {
+      if (trk->track[o]->dummy) {
+        m_archived_dummies.push_back(std::make_pair(idx, o));
+        trk->track[o]->ID = -static_cast<int>(m_archived_dummies.size());
+      }
+    }
+
+    m_archive->store(trk);
+    n_retired++;
+  }
+
+  m_tracks.resize(n_kept);
+
+  if (DEBUG && n_retired>0) {
+    std::cout << "Retired " << n_retired << " tracks to the archive (";
+    std::cout << m_archive->size() << " archived)" << std::endl;
+  }
+
+  return n_retired;
+}
+
+
+
+// rewrite the archive without the tracks that have been merged into others,
+// streaming the tracks through one at a time. The merged tracks may have
+// gained objects (and dummies) from other tracks, so the archived dummies are
+// renumbered as we go
+bool TrackManager::compact_archive()
+{
+  if (n_archived() == 0) return true;
+
+  m_archived_dummies.clear();
+  return m_archive->compact([this](const TrackletPtr &trk, const size_t idx) {
+    if (trk->to_remove()) return false;
+    trk->trim();
+    for (size_t o=0; o<trk->track.size(); o++) {
+      if (trk->track[o]->dummy) {
+        m_archived_dummies.push_back(std::make_pair(idx, o));
+        trk->track[o]->ID = -static_cast<int>(m_archived_dummies.size());
+      }
+    }
+    return true;
+  });
+}
+
+
+
+// write the tracks to a binary track store. The index is gathered first, then
+// each column is streamed out in a separate pass over the tracks, so that
+// only one (archived) track at a time needs to be in memory
+unsigned int TrackManager::write_store(const std::string &a_filename) const
+{
+  size_t n_tracks = size();
+
+  std::vector<TrackStoreIndex> index(n_tracks);
+  size_t n_entries = 0;
+
+  for (size_t i=0; i<n_tracks; i++) {
+    TrackletPtr trk = (*this)[i];
+    if (!trk) return ERROR_file_IO;
+
+    index[i].ID = trk->ID;
+    index[i].parent = trk->parent;
+    index[i].root = trk->root;
+    index[i].fate = trk->fate;
+    index[i].offset = n_entries;
+    index[i].length = trk->track.size();
+    n_entries += trk->track.size();
+  }
+
+  // set up the header, the 64-bit columns come first to keep them aligned
+  TrackStoreHeader header;
+  std::memcpy(header.magic, "BTRK", 4);
+  header.version = TRACK_STORE_VERSION;
+  header.n_tracks = n_tracks;
+  header.n_entries = n_entries;
+  header.index_offset = sizeof(TrackStoreHeader);
+  header.x_offset = header.index_offset + n_tracks*sizeof(TrackStoreIndex);
+  header.y_offset = header.x_offset + n_entries*sizeof(double);
+  header.z_offset = header.y_offset + n_entries*sizeof(double);
+  header.t_offset = header.z_offset + n_entries*sizeof(double);
+  header.label_offset = header.t_offset + n_entries*sizeof(uint32_t);
+  header.ref_offset = header.label_offset + n_entries*sizeof(uint32_t);
+
+  BinaryWriter writer;
+  if (!writer.open(a_filename)) return ERROR_file_IO;
+
+  writer.write(header);
+  writer.write(index.data(), n_tracks*sizeof(TrackStoreIndex));
+
+  // write one column, taking a value from each object of every track
+  bool ok = true;
+  auto write_column = [&](const std::function<void(const TrackObjectPtr&)>
+                          &a_write) {
+    for (size_t i=0; i<n_tracks && ok; i++) {
+      TrackletPtr trk = (*this)[i];
+      if (!trk || trk->track.size() != index[i].length) {
+        ok = false;
+        break;
+      }
+      for (size_t o=0; o<trk->track.size(); o++) a_write(trk->track[o]);
+    }
+  };
+
+  write_column([&](const TrackObjectPtr &obj) {
+    writer.write<double>(obj->x); });
+  write_column([&](const TrackObjectPtr &obj) {
+    writer.write<double>(obj->y); });
+  write_column([&](const TrackObjectPtr &obj) {
+    writer.write<double>(obj->z); });
+  write_column([&](const TrackObjectPtr &obj) {
+    writer.write<uint32_t>(obj->t); });
+  write_column([&](const TrackObjectPtr &obj) {
+    writer.write<uint32_t>(obj->label); });
+  write_column([&](const TrackObjectPtr &obj) {
+    writer.write<int32_t>(obj->ID); });
+
+  if (!writer.close() || !ok) return ERROR_file_IO;
+
+  if (DEBUG) {
+    std::cout << "Wrote " << n_tracks << " tracks (" << n_entries;
+    std::cout << " objects) to " << a_filename << std::endl;
+  }
+
+  return SUCCESS;
+}
@@ -20,14 +20,15 @@ MotionModel::MotionModel( const Eigen::MatrixXd &A,
                           const Eigen::MatrixXd &H,
                           const Eigen::MatrixXd &P,
                           const Eigen::MatrixXd &R,
-                          const Eigen::MatrixXd &Q ) :
+                          const Eigen::MatrixXd &Q,
+                          const double dt ) :
                           A(A), H(H), P(P), R(R), Q(Q),
                           measurements(H.rows()), states(A.rows()),
-                          x_hat(states), x_hat_new(states), I(states,states)
+                          x_hat(states), x_hat_new(states), I(states,states),
+                          dt(dt), cache(std::make_shared<TransitionCache>())
 {
 
-  // set the time step and the identity matrix used by the Kalman filter
-  dt = 1;
+  // set the identity matrix used by the Kalman filter
   I.setIdentity();
 
   // fill the current prediction and motion vector with zeros
@@ -59,14 +60,30 @@ Prediction MotionModel::predict() const
 
 
 
+// return the position and its covariance, without allocating a full
+// prediction
+PositionPrediction MotionModel::predict_position() const
+{
+  assert(initialised);
+  return PositionPrediction(x_hat.head(3), P.topLeftCorner(3,3));
+}
+
+
+
   // update the model with a new observation or dummy
-void MotionModel::update(const TrackObjectPtr new_object)
+void MotionModel::update(const TrackObjectPtr new_object, const double a_dt)
 {
   assert(initialised);
 
+  // the transition over the interval, usually a single time step
+  Transition scratch;
+  const Transition* t = single_step(a_dt) ? NULL : &transition(a_dt, scratch);
+  const Eigen::MatrixXd &A_dt = t ? t->A : A;
+  const Eigen::MatrixXd &Q_dt = t ? t->Q : Q;
+
   // discrete Kalman filter time update, no control...
-  x_hat_new = A * x_hat;
-  P = A*P*A.transpose() + Q;
+  x_hat_new = A_dt * x_hat;
+  P = A_dt*P*A_dt.transpose() + Q_dt;
 
   // if this is a dummy object, end here. Update prediction without new data
   if (new_object->dummy) {
@@ -79,9 +96,483 @@ void MotionModel::update(const TrackObjectPtr new_object)
   x_hat_new = x_hat_new + K * (new_object->position() - H*x_hat_new);
 
   // update the motion vector, essentially the difference in position
-  motion_vector = x_hat_new.head(3) - x_hat.head(3);
+  motion_vector = (x_hat_new.head(3) - x_hat.head(3)) / a_dt;
 
   // update P and the predicted state
   P = (I - K*H)*P;
   x_hat = x_hat_new;
 }
+
+
+
+// get the transition for an interval, from the cache if possible
+const Transition& MotionModel::transition(const double a_dt,
+                                          Transition &a_scratch) const
+{
+  long long key = std::llround(a_dt / dt * TRANSITION_RESOLUTION);
+  double steps = static_cast<double>(key) / TRANSITION_RESOLUTION;
+
+  std::lock_guard<std::mutex> guard(cache->lock);
+  auto found = cache->transitions.find(key);
+  if (found != cache->transitions.end()) return found->second;
+
+  // the transitions are never removed from the cache, so references to them
+  // remain valid. If the cache is full, don't store any more
+  if (cache->transitions.size() >= TRANSITION_CACHE_SIZE) {
+    compute_transition(steps, a_scratch);
+    return a_scratch;
+  }
+
+  Transition &t = cache->transitions[key];
+  compute_transition(steps, t);
+  return t;
+}
+
+
+
+// compute the transition for a number of time steps. For a whole number of
+// steps this is exactly equivalent to repeated updates without observations.
+// A fractional step uses A^f, from the binomial series in (A-I), which is
+// exact when A-I is nilpotent as it is for the usual kinematic models.
+//
+// The process noise of a fractional step assumes that it comes from white
+// noise driving the highest derivative, i.e. that each state integrates the
+// states it depends on in A-I. The noise of a state which is integrated k
+// times grows as f^(2k+1), so Q_ij is scaled by f^(k_i+k_j+1). This is exact
+// for the continuous model (e.g. the position terms of the constant velocity
+// model scale as f^3) and keeps Q positive semi-definite. For other noise
+// models, only whole steps are exact
+void MotionModel::compute_transition(const double a_steps,
+                                     Transition &a_out) const
+{
+  double whole = std::floor(std::max(a_steps, 0.));
+  double f = std::max(a_steps, 0.) - whole;
+
+  Eigen::MatrixXd A_n = I;
+  Eigen::MatrixXd Q_n = Eigen::MatrixXd::Zero(states, states);
+  for (unsigned int i=0; i<static_cast<unsigned int>(whole); i++) {
+    A_n = A * A_n;
+    Q_n = A*Q_n*A.transpose() + Q;
+  }
+
+  if (f > 0.) {
+    Eigen::MatrixXd N = A - I;
+    Eigen::MatrixXd term = I;
+    Eigen::MatrixXd A_f = I;
+    double c = 1.;
+    for (unsigned int j=1; j<=states; j++) {
+      c *= (f - (j-1)) / j;
+      term = term * N;
+      A_f += c * term;
+    }
+    // the number of times that each state is integrated, found by following
+    // the dependencies in A-I, there are at most states-1 integrations
+    std::vector<unsigned int> order(states, 0);
+    for (unsigned int pass=1; pass<states; pass++) {
+      for (unsigned int i=0; i<states; i++) {
+        for (unsigned int j=0; j<states; j++) {
+          if (i != j && N(i,j) != 0.) {
+            order[i] = std::max(order[i], std::min(order[j]+1, states-1));
+          }
+        }
+      }
+    }
+
+    Eigen::MatrixXd Q_f(states, states);
+    for (unsigned int i=0; i<states; i++) {
+      for (unsigned int j=0; j<states; j++) {
+        Q_f(i,j) = std::pow(f, order[i]+order[j]+1.) * Q(i,j);
+      }
+    }
+
+    A_n = A_f * A_n;
+    Q_n = A_f*Q_n*A_f.transpose() + Q_f;
+  }
+
+  a_out.A = A_n;
+  a_out.Q = Q_n;
+}
+
+
+
+// the positional covariance propagated forward by an interval
+Eigen::Matrix3d MotionModel::position_covariance(const double a_dt) const
+{
+  if (a_dt <= 0.) return P.topLeftCorner(3,3);
+
+  Transition scratch;
+  const Transition* t = single_step(a_dt) ? NULL : &transition(a_dt, scratch);
+  const Eigen::MatrixXd &A_dt = t ? t->A : A;
+  const Eigen::MatrixXd &Q_dt = t ? t->Q : Q;
+  Eigen::MatrixXd P_dt = A_dt*P*A_dt.transpose() + Q_dt;
+  return P_dt.topLeftCorner(3,3);
+}
+
+
+
+// write the current state of the filter
+void MotionModel::write_state(BinaryWriter &a_writer) const
+{
+  a_writer.write_matrix(x_hat);
+  a_writer.write_matrix(P);
+  a_writer.write_matrix(motion_vector);
+}
+
+
+
+// read the current state of the filter
+void MotionModel::read_state(BinaryReader &a_reader)
+{
+  x_hat = a_reader.read_matrix();
+  P = a_reader.read_matrix();
+  motion_vector = a_reader.read_matrix();
+}
+
+
+
+// write the model matrices
+void MotionModel::write_model(BinaryWriter &a_writer) const
+{
+  a_writer.write<uint8_t>(initialised);
+  if (!initialised) return;
+  a_writer.write_matrix(A);
+  a_writer.write_matrix(H);
+  a_writer.write_matrix(P);
+  a_writer.write_matrix(R);
+  a_writer.write_matrix(Q);
+  a_writer.write<double>(dt);
+}
+
+
+
+// read the model matrices, and set up a new filter
+void MotionModel::read_model(BinaryReader &a_reader)
+{
+  if (!a_reader.read<uint8_t>()) {
+    initialised = false;
+    return;
+  }
+  Eigen::MatrixXd A_in = a_reader.read_matrix();
+  Eigen::MatrixXd H_in = a_reader.read_matrix();
+  Eigen::MatrixXd P_in = a_reader.read_matrix();
+  Eigen::MatrixXd R_in = a_reader.read_matrix();
+  Eigen::MatrixXd Q_in = a_reader.read_matrix();
+  double dt_in = a_reader.read<double>();
+  if (!a_reader.good()) return;
+  *this = MotionModel(A_in, H_in, P_in, R_in, Q_in, dt_in);
+}
+
+
+
+// queue an update of a motion model
+void MotionBatch::push(MotionModel* a_model, const TrackObjectPtr &a_obj,
+                       const double a_dt)
+{
+  assert(a_model->initialised);
+  m_models.push_back(a_model);
+  m_objects.push_back(a_obj);
+  m_dts.push_back(a_dt);
+}
+
+
+
+// copy a matrix into a row major array
+static void flatten(const Eigen::MatrixXd &a_matrix, std::vector<double> &a_out)
+{
+  a_out.resize(a_matrix.rows()*a_matrix.cols());
+  for (long i=0; i<a_matrix.rows(); i++) {
+    for (long j=0; j<a_matrix.cols(); j++) {
+      a_out[i*a_matrix.cols()+j] = a_matrix(i,j);
+    }
+  }
+}
+
+
+
+// run the batched predict and update, grouping the models by interval
+void MotionBatch::run()
+{
+  if (m_models.empty()) return;
+
+  // usually every model shares the same interval
+  bool uniform = true;
+  for (size_t i=1; i<m_dts.size() && uniform; i++) {
+    uniform = (m_dts[i] == m_dts[0]);
+  }
+
+  if (uniform) {
+    run_group(m_dts[0]);
+  } else {
+    // run each group of models which share an interval in turn, in the order
+    // that the intervals first appear
+    m_all_models.swap(m_models);
+    m_all_objects.swap(m_objects);
+    m_all_dts.swap(m_dts);
+    for (size_t i=0; i<m_all_models.size(); i++) {
+      if (m_all_models[i] == NULL) continue;
+      const double dt = m_all_dts[i];
+      m_models.clear();
+      m_objects.clear();
+      for (size_t j=i; j<m_all_models.size(); j++) {
+        if (m_all_models[j] == NULL || m_all_dts[j] != dt) continue;
+        m_models.push_back(m_all_models[j]);
+        m_objects.push_back(m_all_objects[j]);
+        m_all_models[j] = NULL;
+      }
+      run_group(dt);
+    }
+    m_all_models.clear();
+    m_all_objects.clear();
+    m_all_dts.clear();
+  }
+
+  m_models.clear();
+  m_objects.clear();
+  m_dts.clear();
+}
+
+
+
+// run the batched predict and update for models sharing an interval
+void MotionBatch::run_group(const double a_dt)
+{
+  const size_t n = m_models.size();
+  if (n == 0) return;
+
+  // all models share the same matrices, so take them from the first one
+  const MotionModel &model = *m_models[0];
+  const size_t S = model.states;
+  const size_t M = model.measurements;
+  const Transition* t = model.single_step(a_dt) ? NULL :
+                        &model.transition(a_dt, m_transition);
+  flatten(t ? t->A : model.A, m_A);
+  flatten(model.H, m_H);
+  flatten(t ? t->Q : model.Q, m_Q);
+  flatten(model.R, m_R);
+
+  // order the lanes so that the models with observations come first
+  m_lanes.clear();
+  for (size_t i=0; i<n; i++) {
+    if (!m_objects[i]->dummy) m_lanes.push_back(i);
+  }
+  const size_t n_obs = m_lanes.size();
+  for (size_t i=0; i<n; i++) {
+    if (m_objects[i]->dummy) m_lanes.push_back(i);
+  }
+
+  m_x.resize(S*n);
+  m_xp.resize(S*n);
+  m_P.resize(S*S*n);
+  m_AP.resize(S*S*n);
+  m_Pp.resize(S*S*n);
+
+  // gather the states and covariances
+  for (size_t l=0; l<n; l++) {
+    const MotionModel &m = *m_models[m_lanes[l]];
+    for (size_t i=0; i<S; i++) {
+      m_x[i*n+l] = m.x_hat(i);
+      for (size_t j=0; j<S; j++) {
+        m_P[(i*S+j)*n+l] = m.P(i,j);
+      }
+    }
+  }
+
+  // time update, x' = A*x and P' = A*P*A^T + Q. Most of the entries of A are
+  // zero for the usual models, so skip them
+  for (size_t i=0; i<S; i++) {
+    double* xp = &m_xp[i*n];
+    std::fill(xp, xp+n, 0.);
+    for (size_t k=0; k<S; k++) {
+      const double a = m_A[i*S+k];
+      if (a == 0.) continue;
+      const double* x = &m_x[k*n];
+      for (size_t l=0; l<n; l++) xp[l] += a*x[l];
+    }
+  }
+
+  for (size_t i=0; i<S; i++) {
+    for (size_t j=0; j<S; j++) {
+      double* ap = &m_AP[(i*S+j)*n];
+      std::fill(ap, ap+n, 0.);
+      for (size_t k=0; k<S; k++) {
+        const double a = m_A[i*S+k];
+        if (a == 0.) continue;
+        const double* p = &m_P[(k*S+j)*n];
+        for (size_t l=0; l<n; l++) ap[l] += a*p[l];
+      }
+    }
+  }
+
+  for (size_t i=0; i<S; i++) {
+    for (size_t j=0; j<S; j++) {
+      double* pp = &m_Pp[(i*S+j)*n];
+      std::fill(pp, pp+n, m_Q[i*S+j]);
+      for (size_t k=0; k<S; k++) {
+        const double a = m_A[j*S+k];
+        if (a == 0.) continue;
+        const double* ap = &m_AP[(i*S+k)*n];
+        for (size_t l=0; l<n; l++) pp[l] += ap[l]*a;
+      }
+    }
+  }
+
+  // measurement update for the lanes with observations, these are the first
+  // n_obs lanes so the loops below only run over those
+  const size_t no = n_obs;
+  m_z.resize(M*no);
+  m_PHt.resize(S*M*no);
+  m_HP.resize(M*S*no);
+  m_S.resize(M*M*no);
+  m_L.resize(M*M*no);
+  m_K.resize(S*M*no);
+  m_tmp.resize(S*S*no);
+
+  // innovation, z - H*x'
+  for (size_t l=0; l<no; l++) {
+    Eigen::Vector3d pos = m_objects[m_lanes[l]]->position();
+    for (size_t r=0; r<M; r++) m_z[r*no+l] = pos(r);
+  }
+  for (size_t r=0; r<M; r++) {
+    double* z = &m_z[r*no];
+    for (size_t k=0; k<S; k++) {
+      const double h = m_H[r*S+k];
+      if (h == 0.) continue;
+      const double* xp = &m_xp[k*n];
+      for (size_t l=0; l<no; l++) z[l] -= h*xp[l];
+    }
+  }
+
+  // P'*H^T
+  for (size_t i=0; i<S; i++) {
+    for (size_t r=0; r<M; r++) {
+      double* pht = &m_PHt[(i*M+r)*no];
+      std::fill(pht, pht+no, 0.);
+      for (size_t k=0; k<S; k++) {
+        const double h = m_H[r*S+k];
+        if (h == 0.) continue;
+        const double* pp = &m_Pp[(i*S+k)*n];
+        for (size_t l=0; l<no; l++) pht[l] += pp[l]*h;
+      }
+    }
+  }
+
+  // H*P'
+  for (size_t r=0; r<M; r++) {
+    for (size_t j=0; j<S; j++) {
+      double* hp = &m_HP[(r*S+j)*no];
+      std::fill(hp, hp+no, 0.);
+      for (size_t k=0; k<S; k++) {
+        const double h = m_H[r*S+k];
+        if (h == 0.) continue;
+        const double* pp = &m_Pp[(k*S+j)*n];
+        for (size_t l=0; l<no; l++) hp[l] += h*pp[l];
+      }
+    }
+  }
+
+  // innovation covariance, H*P'*H^T + R
+  for (size_t r=0; r<M; r++) {
+    for (size_t c=0; c<M; c++) {
+      double* s = &m_S[(r*M+c)*no];
+      std::fill(s, s+no, m_R[r*M+c]);
+      for (size_t k=0; k<S; k++) {
+        const double h = m_H[r*S+k];
+        if (h == 0.) continue;
+        const double* pht = &m_PHt[(k*M+c)*no];
+        for (size_t l=0; l<no; l++) s[l] += h*pht[l];
+      }
+    }
+  }
+
+  // Cholesky factorisation of the innovation covariance, S = L*L^T
+  for (size_t j=0; j<M; j++) {
+    for (size_t i=j; i<M; i++) {
+      double* L = &m_L[(i*M+j)*no];
+      const double* s = &m_S[(i*M+j)*no];
+      std::copy(s, s+no, L);
+      for (size_t k=0; k<j; k++) {
+        const double* Lik = &m_L[(i*M+k)*no];
+        const double* Ljk = &m_L[(j*M+k)*no];
+        for (size_t l=0; l<no; l++) L[l] -= Lik[l]*Ljk[l];
+      }
+      if (i == j) {
+        for (size_t l=0; l<no; l++) L[l] = std::sqrt(L[l]);
+      } else {
+        const double* Ljj = &m_L[(j*M+j)*no];
+        for (size_t l=0; l<no; l++) L[l] /= Ljj[l];
+      }
+    }
+  }
+
+  // Kalman gain, K = P'*H^T*S^-1. Each row of K solves S*k = (P'*H^T)_i,
+  // using forward and back substitution with the Cholesky factor
+  for (size_t i=0; i<S; i++) {
+    for (size_t r=0; r<M; r++) {
+      double* k = &m_K[(i*M+r)*no];
+      const double* pht = &m_PHt[(i*M+r)*no];
+      std::copy(pht, pht+no, k);
+      for (size_t c=0; c<r; c++) {
+        const double* L = &m_L[(r*M+c)*no];
+        const double* kc = &m_K[(i*M+c)*no];
+        for (size_t l=0; l<no; l++) k[l] -= L[l]*kc[l];
+      }
+      const double* Lrr = &m_L[(r*M+r)*no];
+      for (size_t l=0; l<no; l++) k[l] /= Lrr[l];
+    }
+    for (size_t r=M; r-- > 0;) {
+      double* k = &m_K[(i*M+r)*no];
+      for (size_t c=r+1; c<M; c++) {
+        const double* L = &m_L[(c*M+r)*no];
+        const double* kc = &m_K[(i*M+c)*no];
+        for (size_t l=0; l<no; l++) k[l] -= L[l]*kc[l];
+      }
+      const double* Lrr = &m_L[(r*M+r)*no];
+      for (size_t l=0; l<no; l++) k[l] /= Lrr[l];
+    }
+  }
+
+  // state update, x' = x' + K*(z - H*x')
+  for (size_t i=0; i<S; i++) {
+    double* xp = &m_xp[i*n];
+    for (size_t r=0; r<M; r++) {
+      const double* k = &m_K[(i*M+r)*no];
+      const double* z = &m_z[r*no];
+      for (size_t l=0; l<no; l++) xp[l] += k[l]*z[l];
+    }
+  }
+
+  // covariance update, P = (I - K*H)*P', computed as P' - K*(H*P')
+  for (size_t i=0; i<S; i++) {
+    for (size_t j=0; j<S; j++) {
+      double* t = &m_tmp[(i*S+j)*no];
+      const double* pp = &m_Pp[(i*S+j)*n];
+      std::copy(pp, pp+no, t);
+      for (size_t r=0; r<M; r++) {
+        const double* k = &m_K[(i*M+r)*no];
+        const double* hp = &m_HP[(r*S+j)*no];
+        for (size_t l=0; l<no; l++) t[l] -= k[l]*hp[l];
+      }
+    }
+  }
+  for (size_t i=0; i<S*S; i++) {
+    std::copy(&m_tmp[i*no], &m_tmp[i*no]+no, &m_Pp[i*n]);
+  }
+
+  // scatter the results back to the models
+  for (size_t l=0; l<n; l++) {
+    MotionModel &m = *m_models[m_lanes[l]];
+    for (size_t i=0; i<S; i++) {
+      m.x_hat(i) = m_xp[i*n+l];
+      for (size_t j=0; j<S; j++) {
+        m.P(i,j) = m_Pp[(i*S+j)*n+l];
+      }
+    }
+
+    // the motion vector is only updated by an observation
+    if (l < no) {
+      for (size_t i=0; i<3; i++) {
+        m.motion_vector(i) = (m_xp[i*n+l] - m_x[i*n+l]) / a_dt;
+      }
+    }
+  }
+}
@@ -0,0 +1,417 @@
+/*
+--------------------------------------------------------------------------------
+ Name:     BayesianTracker
+ Purpose:  A multi object tracking library, specifically used to reconstruct
+           tracks in crowded fields. Here we use a probabilistic network of
+           information to perform the trajectory linking. This method uses
+           positional and visual information for track linking.
+
+ Authors:  Alan R. Lowe (arl) a.lowe@ucl.ac.uk
+
+ License:  See LICENSE.md
+
+ Created:  14/08/2014
+--------------------------------------------------------------------------------
+*/
+
+
+#include "parallel.h"
+
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cassert>
+
+
+
+// a queue of tasks belonging to one thread of the pool
+struct TaskQueue
+{
+  std::mutex lock;
+  std::deque<size_t> tasks;
+};
+
+
+
+// get the next task for thread a_thread, from the front of its own queue or
+// from the back of another thread's queue. Returns false if there are no tasks
+// left anywhere
+static bool next_task(std::vector<TaskQueue> &a_queues,
+                      const size_t a_thread,
+                      size_t &a_task)
+{
+  for (size_t q=0; q<a_queues.size(); q++) {
+    TaskQueue &queue = a_queues[(a_thread+q) % a_queues.size()];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) continue;
+    if (q == 0) {
+      a_task = queue.tasks.front();
+      queue.tasks.pop_front();
+    } else {
+      a_task = queue.tasks.back();
+      queue.tasks.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+
+
+// run the tasks on a work stealing pool of threads, the calling thread also
+// works
+void parallel_for(const size_t a_tasks,
+                  const unsigned int a_threads,
+                  const std::function<void(const size_t)> &a_function,
+                  const std::vector<double> &a_costs)
+{
+  size_t n_threads = std::min(static_cast<size_t>(std::max(a_threads, 1u)),
+                              a_tasks);
+  if (n_threads == 0) return;
+
+  // order the tasks, most expensive first
+  std::vector<size_t> order(a_tasks);
+  for (size_t i=0; i<a_tasks; i++) order[i] = i;
+  if (a_costs.size() == a_tasks) {
+    std::stable_sort(order.begin(), order.end(),
+                     [&a_costs](const size_t a, const size_t b) {
+                       return a_costs[a] > a_costs[b];
+                     });
+  }
+
+  // deal the tasks out to the threads
+  std::vector<TaskQueue> queues(n_threads);
+  for (size_t i=0; i<a_tasks; i++) {
+    queues[i % n_threads].tasks.push_back(order[i]);
+  }
+
+  auto worker = [&](const size_t a_thread) {
+    size_t task;
+    while (next_task(queues, a_thread, task)) {
+      a_function(task);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t t=1; t<n_threads; t++) {
+    threads.push_back( std::thread(worker, t) );
+  }
+  worker(0);
+
+  for (size_t t=0; t<threads.size(); t++) {
+    threads[t].join();
+  }
+}
+
+
+
+// run the tasks in order
+void parallel_for(const size_t a_tasks,
+                  const unsigned int a_threads,
+                  const std::function<void(const size_t)> &a_function)
+{
+  parallel_for(a_tasks, a_threads, a_function, std::vector<double>());
+}
+
+
+
+// a piece of a track, the objects [first, last) of a tracklet from one chunk
+// (or tile), and the index of the piece which follows it
+struct TrackPiece
+{
+  TrackletPtr trk;
+  size_t first;
+  size_t last;
+  int next = -1;
+  bool has_previous = false;
+};
+
+
+
+// a candidate link between two pieces, and the number of votes for it
+typedef std::pair<unsigned int, std::pair<size_t, size_t>> PieceLink;
+
+
+
+// greedy one to one assignment of links, most votes first. Links with equal
+// votes are taken in the order of the pairs, so the result is deterministic
+static void assign_links(const std::map<std::pair<size_t, size_t>,
+                                        unsigned int> &a_votes,
+                         std::vector<TrackPiece> &a_pieces)
+{
+  std::vector<PieceLink> order;
+  for (auto it=a_votes.begin(); it!=a_votes.end(); ++it) {
+    order.push_back(std::make_pair(it->second, it->first));
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const PieceLink &a, const PieceLink &b) {
+                     return a.first > b.first;
+                   });
+
+  for (size_t m=0; m<order.size(); m++) {
+    TrackPiece &l = a_pieces[order[m].second.first];
+    TrackPiece &r = a_pieces[order[m].second.second];
+    if (l.next >= 0 || r.has_previous) continue;
+    l.next = order[m].second.second;
+    r.has_previous = true;
+  }
+}
+
+
+
+// follow the chains of pieces to make the tracks, a track cannot start with a
+// dummy
+static std::vector<TrackletPtr> follow_chains(
+    const std::vector<TrackPiece> &a_pieces)
+{
+  std::vector<TrackletPtr> stitched;
+  for (size_t p=0; p<a_pieces.size(); p++) {
+    if (a_pieces[p].has_previous) continue;
+
+    size_t first = a_pieces[p].first;
+    while (a_pieces[p].trk->track[first]->dummy) first++;
+
+    TrackletPtr trk = a_pieces[p].trk->slice(first, a_pieces[p].last);
+    for (int n=a_pieces[p].next; n>=0; n=a_pieces[n].next) {
+      trk->extend(*a_pieces[n].trk, a_pieces[n].first, a_pieces[n].last);
+    }
+    stitched.push_back(trk);
+  }
+
+  return stitched;
+}
+
+
+
+// return the index of the first object of a track at or after frame a_frame
+static size_t first_object_from(const TrackletPtr &a_trk,
+                                const unsigned int a_frame)
+{
+  size_t i = 0;
+  while (i < a_trk->track.size() && a_trk->track[i]->t < a_frame) i++;
+  return i;
+}
+
+
+
+// are there any real (non dummy) observations in [a_first, a_last)?
+static bool has_observations(const TrackletPtr &a_trk,
+                             const size_t a_first,
+                             const size_t a_last)
+{
+  for (size_t i=a_first; i<a_last; i++) {
+    if (!a_trk->track[i]->dummy) return true;
+  }
+  return false;
+}
+
+
+
+// stitch the chunks together
+std::vector<TrackletPtr> stitch_chunks(
+    const std::vector<std::vector<TrackletPtr>> &a_chunks,
+    const std::vector<unsigned int> &a_boundaries,
+    const unsigned int a_overlap)
+{
+  const size_t n_chunks = a_chunks.size();
+  assert(a_boundaries.size() == n_chunks+1);
+
+  // cut each track to the frames that its chunk is responsible for, pieces
+  // holds the index of the piece for each track, or -1 if there is none
+  std::vector<TrackPiece> pieces;
+  std::vector<std::vector<int>> piece_index(n_chunks);
+
+  for (size_t k=0; k<n_chunks; k++) {
+    piece_index[k].assign(a_chunks[k].size(), -1);
+    for (size_t i=0; i<a_chunks[k].size(); i++) {
+      const TrackletPtr &trk = a_chunks[k][i];
+      TrackPiece piece;
+      piece.trk = trk;
+      piece.first = first_object_from(trk, a_boundaries[k]);
+      piece.last = first_object_from(trk, a_boundaries[k+1]);
+      if (!has_observations(trk, piece.first, piece.last)) continue;
+      piece_index[k][i] = pieces.size();
+      pieces.push_back(piece);
+    }
+  }
+
+  // join the pieces across each boundary
+  for (size_t k=0; k+1<n_chunks; k++) {
+
+    const unsigned int boundary = a_boundaries[k+1];
+    const unsigned int window_start = boundary > a_overlap ?
+                                      boundary - a_overlap : 0;
+    const unsigned int window_end = boundary + a_overlap;
+
+    // find the track in the right chunk that each observation in the overlap
+    // window was assigned to
+    std::unordered_map<const TrackObject*, size_t> right_track;
+    const std::vector<TrackletPtr> &right = a_chunks[k+1];
+    for (size_t j=0; j<right.size(); j++) {
+      if (piece_index[k+1][j] < 0) continue;
+      for (size_t o=first_object_from(right[j], window_start);
+           o<right[j]->track.size() && right[j]->track[o]->t < window_end;
+           o++) {
+        if (!right[j]->track[o]->dummy) {
+          right_track[right[j]->track[o].get()] = j;
+        }
+      }
+    }
+
+    // count the observations that each pair of tracks has in common
+    std::map<std::pair<size_t, size_t>, unsigned int> votes;
+    const std::vector<TrackletPtr> &left = a_chunks[k];
+    for (size_t i=0; i<left.size(); i++) {
+      if (piece_index[k][i] < 0) continue;
+      for (size_t o=first_object_from(left[i], window_start);
+           o<left[i]->track.size() && left[i]->track[o]->t < window_end;
+           o++) {
+        auto found = right_track.find(left[i]->track[o].get());
+        if (found != right_track.end()) {
+          votes[std::make_pair(i, found->second)]++;
+        }
+      }
+    }
+
+    // translate the votes into votes between pieces
+    std::map<std::pair<size_t, size_t>, unsigned int> piece_votes;
+    for (auto it=votes.begin(); it!=votes.end(); ++it) {
+      piece_votes[std::make_pair(piece_index[k][it->first.first],
+                                 piece_index[k+1][it->first.second])] =
+                                 it->second;
+    }
+    assign_links(piece_votes, pieces);
+  }
+
+  return follow_chains(pieces);
+}
+
+
+
+// set up a grid of tiles over the imaging volume
+TileGrid::TileGrid(const ImagingVolume &a_volume,
+                   const unsigned int a_nx,
+                   const unsigned int a_ny) :
+                   nx(std::max(a_nx, 1u)), ny(std::max(a_ny, 1u))
+{
+  x0 = a_volume.min_xyz(0);
+  y0 = a_volume.min_xyz(1);
+  width = (a_volume.max_xyz(0) - x0) / nx;
+  height = (a_volume.max_xyz(1) - y0) / ny;
+}
+
+
+
+// return the column of the tile containing a coordinate
+unsigned int TileGrid::column(const double a_x) const
+{
+  if (!(width > 0.) || a_x < x0) return 0;
+  return std::min(static_cast<unsigned int>((a_x-x0) / width), nx-1);
+}
+
+
+
+// return the row of the tile containing a coordinate
+unsigned int TileGrid::row(const double a_y) const
+{
+  if (!(height > 0.) || a_y < y0) return 0;
+  return std::min(static_cast<unsigned int>((a_y-y0) / height), ny-1);
+}
+
+
+
+// stitch the tiles together
+std::vector<TrackletPtr> stitch_tiles(
+    const std::vector<std::vector<TrackletPtr>> &a_tiles,
+    const TileGrid &a_grid)
+{
+  assert(a_tiles.size() == a_grid.size());
+
+  // cut each track into the pieces that lie in its own tile. For each piece,
+  // note the observations either side of it in the original track, which
+  // belong to other tiles
+  std::vector<TrackPiece> pieces;
+  std::vector<const TrackObject*> before, after;
+
+  for (size_t k=0; k<a_tiles.size(); k++) {
+    for (size_t i=0; i<a_tiles[k].size(); i++) {
+      const TrackletPtr &trk = a_tiles[k][i];
+
+      size_t o = 0;
+      const TrackObject* previous = NULL;
+      while (o < trk->track.size()) {
+
+        // find the run of objects which belong to the same tile
+        size_t owner = a_grid.tile(trk->track[o]);
+        size_t end = o+1;
+        while (end < trk->track.size() && (trk->track[end]->dummy ||
+               a_grid.tile(trk->track[end]) == owner)) end++;
+
+        if (owner == k) {
+          TrackPiece piece;
+          piece.trk = trk;
+          piece.first = o;
+          piece.last = end;
+          pieces.push_back(piece);
+          before.push_back(previous);
+          after.push_back(end < trk->track.size() ?
+                          trk->track[end].get() : NULL);
+        }
+
+        // the last real observation of the run
+        size_t last_real = end-1;
+        while (last_real > o && trk->track[last_real]->dummy) last_real--;
+        previous = trk->track[last_real].get();
+        o = end;
+      }
+    }
+  }
+
+  // the pieces starting and ending with each observation, each observation
+  // belongs to only one piece
+  std::unordered_map<const TrackObject*, size_t> starts, ends;
+  for (size_t p=0; p<pieces.size(); p++) {
+    const TrackPiece &piece = pieces[p];
+    size_t last_real = piece.last-1;
+    while (last_real > piece.first && piece.trk->track[last_real]->dummy) {
+      last_real--;
+    }
+    starts[piece.trk->track[piece.first].get()] = p;
+    ends[piece.trk->track[last_real].get()] = p;
+  }
+
+  // each piece votes for the link to the piece that follows it in its own
+  // tile, and for the link from the piece that precedes it
+  std::map<std::pair<size_t, size_t>, unsigned int> votes;
+  for (size_t p=0; p<pieces.size(); p++) {
+    if (after[p] != NULL) {
+      auto found = starts.find(after[p]);
+      if (found != starts.end()) {
+        votes[std::make_pair(p, found->second)]++;
+      }
+    }
+    if (before[p] != NULL) {
+      auto found = ends.find(before[p]);
+      if (found != ends.end()) {
+        votes[std::make_pair(found->second, p)]++;
+      }
+    }
+  }
+
+  // the pieces must not overlap in time once joined
+  for (auto it=votes.begin(); it!=votes.end(); ) {
+    const TrackPiece &l = pieces[it->first.first];
+    const TrackPiece &r = pieces[it->first.second];
+    if (l.trk->track[l.last-1]->t >= r.trk->track[r.first]->t) {
+      it = votes.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  assign_links(votes, pieces);
+  return follow_chains(pieces);
+}
@@ -17,6 +17,8 @@
 
 #include "tracker.h"
 
+#include <unistd.h>
+
 
 // we can assume that the covar matrix is diagonal from the MotionModel
 // since only position obeservations are made, therefore we can decompose
@@ -79,27 +81,140 @@ double probability_erf( const Eigen::Vector3d& x,
 
 
 
+// log of the complementary error function, using the asymptotic expansion for
+// large arguments where erfc underflows in the scalar type T
+template <typename T>
+T log_erfc(const T x)
+{
+  static const T x_max = std::sqrt(-std::log(std::numeric_limits<T>::min()))-1;
+  if (x < x_max) return std::log(std::erfc(x));
+  T x2 = T(1)/(x*x);
+  return -x*x - std::log(x) - T(.5*std::log(M_PI)) +
+         std::log1p(-T(.5)*x2 + T(.75)*x2*x2 - T(1.875)*x2*x2*x2);
+}
 
 
 
+// log of erf(b)-erf(a), for b>a. When both limits are in the same tail the
+// difference of the erf values is lost to cancellation, so we use the
+// complementary error functions instead
+template <typename T>
+T log_erf_difference(const T a, const T b)
+{
+  if (a >= T(0)) {
+    T log_erfc_a = log_erfc(a);
+    return log_erfc_a + std::log1p(-std::exp(log_erfc(b) - log_erfc_a));
+  } else if (b <= T(0)) {
+    return log_erf_difference(-b, -a);
+  }
+  return std::log(std::erf(b) - std::erf(a));
+}
 
 
 
+// log of the probability calculated by probability_erf, which remains finite
+// for objects a long way from the prediction. Takes the displacement of the
+// object from the prediction, and the reciprocal of the standard deviation of
+// the prediction (scaled by root two) for each axis
+template <typename T>
+T log_probability_erf( const Eigen::Matrix<T,3,1>& d,
+                       const Eigen::Matrix<T,3,1>& inv_std,
+                       const T accuracy )
+{
 
+  T log_phi = T(0);
 
+  for (unsigned int axis=0; axis<3; axis++) {
 
+    // intergral +/- accuracy, the 0.5 is applied as a log
+    log_phi += log_erf_difference((d(axis)-accuracy) * inv_std(axis),
+                                  (d(axis)+accuracy) * inv_std(axis));
 
+  }
 
+  // we don't want a NaN!
+  assert(!std::isnan(log_phi));
 
+  return log_phi - T(3.*M_LN2);
+}
 
 
 
+// return log(exp(a)+exp(b)) without overflow
+template <typename T>
+inline T log_add(const T a, const T b)
+{
+  if (a < b) return log_add(b, a);
+  if (b == -std::numeric_limits<T>::infinity()) return a;
+  return a + std::log1p(std::exp(b-a));
+}
 
 
 
+// Sequential Bayesian update of one column (track) of the belief matrix, in
+// log space, given the log probability of assigning the track to object obj.
+//
+// In probability space the update sets the posterior of obj and scales every
+// other entry of the column by
+//
+//   update = 1 + (prior-posterior)/(1-prior)
+//          = P(not assign)*(1-P(assign)) / (PrDP*(1-prior))
+//
+// Since the scaling is the same for every other entry, it is accumulated in a
+// running log shift which is added to the column once all objects have been
+// visited. The stored value of obj is offset by the current shift, so that the
+// update is O(1) rather than O(n). A probability of assignment of exactly one
+// would set the update to zero, which the shift cannot represent, so the
+// probability is limited to just below one.
+template <typename T>
+inline void log_bayes_update(T* column,
+                             T &shift,
+                             const size_t obj,
+                             const T log_prob_assign,
+                             const T log_prob_not_assign)
+{
+  static const T log_max = std::log1p(-std::numeric_limits<T>::epsilon());
+  T log_assign = std::min(log_prob_assign, log_max);
+  T log_prior = column[obj] + shift;
+  T log_joint = log_assign + log_prior;
+  T log_not = log_prob_not_assign + std::log1p(-std::exp(log_assign));
+  T log_PrDP = log_add(log_joint, log_not);
+
+  shift += log_not - log_PrDP - std::log1p(-std::exp(log_prior));
+  column[obj] = log_joint - log_PrDP - shift;
+}
 
 
 
+// the quantities of a track prediction used to score candidate linkages, in
+// the scalar type of the belief matrix
+template <typename T>
+struct BeliefPrediction
+{
+  Eigen::Matrix<T,3,1> mu;
+  Eigen::Matrix<T,3,1> inv_std;
+  Eigen::Matrix<T,3,3> gate;
+  T log_decay;
+  bool metaphase;
+};
+
+
+
+// copy the settings from another tracker, used to set up the parts for
+// parallel tracking and to share a configuration between datasets
+void BayesianTracker::copy_settings(const BayesianTracker &a_tracker)
+{
+  motion_model = a_tracker.motion_model;
+  object_model = a_tracker.object_model;
+  prob_not_assign = a_tracker.prob_not_assign;
+  accuracy = a_tracker.accuracy;
+  max_lost = a_tracker.max_lost;
+  max_search_radius = a_tracker.max_search_radius;
+  gate_probability = a_tracker.gate_probability;
+  gate_threshold = a_tracker.gate_threshold;
+  precision = a_tracker.precision;
+  frame_times = a_tracker.frame_times;
+}
 
 
 
@@ -181,7 +296,7 @@ unsigned int BayesianTracker::set_motion_model(
   Eigen::MatrixXd A = Eigen::Map<RowMajMat>(A_raw, states, states);
 
   //set up a new motion model
-  motion_model = MotionModel( A, H, P, R, Q );
+  motion_model = MotionModel( A, H, P, R, Q, dt );
 
   return SUCCESS;
 
@@ -202,9 +317,8 @@ unsigned int BayesianTracker::append(const PyTrackObject& new_object){
   // update the imaging volume with this new measurement
   volume.update(p);
 
-  // add a new object and maintain a set of frame numbers...
-  objects.push_back( p );
-  frames_set.insert( p->t );
+  // add a new object and maintain the range of frame numbers...
+  queue_object( p );
 
   // set this flag to true
   initialised = true;
@@ -213,6 +327,75 @@ unsigned int BayesianTracker::append(const PyTrackObject& new_object){
 
 
 
+// queue an object for tracking
+void BayesianTracker::queue_object(const TrackObjectPtr &a_obj)
+{
+  objects.push_back( a_obj );
+  min_frame = std::min(min_frame, a_obj->t);
+  max_frame = std::max(max_frame, a_obj->t);
+}
+
+
+
+// sort the objects by frame in linear time with an LSD radix sort on the frame
+// number, relative to the first frame. This uses memory in proportion to the
+// number of objects, however sparse the frame numbers are. Objects in the
+// same frame stay in the order in which they were queued
+void BayesianTracker::index_frames()
+{
+  frames.clear();
+  frame_index.clear();
+  if (objects.empty()) return;
+
+  // sort on each digit in turn, stopping once the remaining digits of every
+  // frame number are zero
+  std::vector<TrackObjectPtr> sorted(objects.size());
+  std::vector<size_t> count(FRAME_RADIX+1);
+  const unsigned int range = max_frame-min_frame;
+  for (unsigned int shift=0; shift<32 && (shift==0 || (range >> shift) > 0);
+       shift+=FRAME_RADIX_BITS) {
+
+    // count the objects with each digit, the running total is then the
+    // position of the first object with each digit
+    std::fill(count.begin(), count.end(), 0);
+    for (size_t i=0; i<objects.size(); i++) {
+      count[((objects[i]->t-min_frame) >> shift) % FRAME_RADIX + 1]++;
+    }
+    for (size_t d=1; d<count.size(); d++) {
+      count[d] += count[d-1];
+    }
+
+    for (size_t i=0; i<objects.size(); i++) {
+      size_t d = ((objects[i]->t-min_frame) >> shift) % FRAME_RADIX;
+      sorted[count[d]++] = std::move(objects[i]);
+    }
+    objects.swap(sorted);
+  }
+
+  // store the frames which contain objects, and the position of the first
+  // object of each of them
+  for (size_t i=0; i<objects.size(); i++) {
+    if (i == 0 || objects[i]->t != objects[i-1]->t) {
+      frames.push_back(objects[i]->t);
+      frame_index.push_back(i);
+    }
+  }
+  frame_index.push_back(objects.size());
+}
+
+
+
+// position of the first object in a frame
+size_t BayesianTracker::frame_begin(const unsigned int a_frame) const
+{
+  if (frame_index.empty()) return 0;
+  size_t f = std::lower_bound(frames.begin(), frames.end(), a_frame) -
+             frames.begin();
+  return frame_index[f];
+}
+
+
+
 // track all objects
 void BayesianTracker::track_all() {
 
@@ -220,8 +403,13 @@ void BayesianTracker::track_all() {
     statistics.error = ERROR_no_tracks;
   }
 
-  // iterate over the whole set
-  while (!statistics.complete){
+  // iterate over the whole set, stop if we hit an error or are cancelled
+  while (!statistics.complete && statistics.error == ERROR_none){
+    if (progress.cancelled) {
+      statistics.error = ERROR_cancelled;
+      suspend();
+      break;
+    }
     step();
   }
 
@@ -229,6 +417,276 @@ void BayesianTracker::track_all() {
 
 
 
+// finalise the tracks found so far when the tracking is cancelled, keeping
+// the trailing dummies of the active tracks so that it can be resumed
+void BayesianTracker::suspend()
+{
+  for (size_t i=0; i<active.size(); i++) {
+    std::vector<TrackObjectPtr> &trk = active[i]->track;
+    size_t n = trk.size();
+    while (n > 1 && trk[n-1]->dummy) n--;
+    if (n == trk.size()) continue;
+
+    suspended.emplace_back(active[i],
+                           std::vector<TrackObjectPtr>(trk.begin()+n,
+                                                       trk.end()));
+    trk.resize(n);
+  }
+
+  tracks.finalise();
+  update_progress();
+}
+
+
+
+// put back the trailing dummies of the active tracks, before resuming the
+// tracking after it was cancelled
+void BayesianTracker::resume()
+{
+  for (size_t i=0; i<suspended.size(); i++) {
+    std::vector<TrackObjectPtr> &trk = suspended[i].first->track;
+    trk.insert(trk.end(), suspended[i].second.begin(),
+               suspended[i].second.end());
+  }
+  suspended.clear();
+}
+
+
+
+// check that the complete set of objects can be tracked by splitting it up
+// between several trackers
+bool BayesianTracker::ready_to_decompose()
+{
+  // this can only be used to track a complete set of objects from scratch
+  if (streaming) {
+    statistics.error = ERROR_stream_mixed_modes;
+    return false;
+  }
+
+  if (objects.empty()) {
+    statistics.error = ERROR_empty_queue;
+    return false;
+  }
+
+  if (current_frame != 0 || !tracks.empty()) {
+    statistics.error = ERROR_no_tracks;
+    return false;
+  }
+
+  return true;
+}
+
+
+
+// track each of the parts in parallel, returns false if any of the parts
+// could not be tracked. Parts without any objects are skipped
+bool BayesianTracker::track_parts(TrackerParts &a_parts,
+                                  const unsigned int a_threads)
+{
+  parallel_for(a_parts.size(), a_threads, [&a_parts](const size_t k) {
+    if (!a_parts[k]->objects.empty()) a_parts[k]->track_all();
+  });
+
+  for (size_t k=0; k<a_parts.size(); k++) {
+    if (!a_parts[k]->objects.empty() &&
+        a_parts[k]->statistics.error != ERROR_none) {
+      if (verbose) {
+        std::cout << "Part " << k << " could not be tracked, tracking the ";
+        std::cout << "complete set instead." << std::endl;
+      }
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+
+// gather the tracks and statistics of the parts, each part only counts the
+// lost tracks and conflicts in the part of the data it is responsible for
+std::vector<std::vector<TrackletPtr>> BayesianTracker::gather_parts(
+    const TrackerParts &a_parts)
+{
+  std::vector<std::vector<TrackletPtr>> part_tracks(a_parts.size());
+  for (size_t k=0; k<a_parts.size(); k++) {
+    for (size_t i=0; i<a_parts[k]->tracks.size(); i++) {
+      part_tracks[k].push_back( a_parts[k]->tracks[i] );
+    }
+    n_lost += a_parts[k]->n_lost;
+    n_conflicts += a_parts[k]->n_conflicts;
+  }
+  return part_tracks;
+}
+
+
+
+// give the stitched tracks their IDs and complete the tracking
+void BayesianTracker::complete_parts(const std::vector<TrackletPtr> &a_tracks)
+{
+  for (size_t i=0; i<a_tracks.size(); i++) {
+    a_tracks[i]->ID = get_new_ID();
+    tracks.push_back( a_tracks[i] );
+  }
+
+  index_frames();
+  n_objects = objects.size();
+  o_counter = n_objects;
+  current_frame = frames.back()+1;
+  tracks.finalise();
+
+  statistics.complete = true;
+  statistics.n_tracks = this->size();
+  statistics.n_lost = n_lost;
+  statistics.n_conflicts = n_conflicts;
+  update_progress();
+}
+
+
+
+// split the movie into overlapping temporal chunks, track them in parallel
+// using independent trackers and stitch the tracks back together
+unsigned int BayesianTracker::track_chunked(const unsigned int a_threads,
+                                            const unsigned int a_overlap)
+{
+  if (!ready_to_decompose()) return statistics.error;
+
+  // find the range of frames
+  unsigned int first = first_frame();
+  unsigned int last = last_frame();
+  unsigned int n_frames = last - first + 1;
+
+  // each chunk should be a good deal longer than the overlaps, otherwise just
+  // track the whole set as usual
+  unsigned int overlap = std::max(a_overlap, 1u);
+  unsigned int n_chunks = std::min(a_threads, n_frames / (4*overlap));
+  if (n_chunks < 2) {
+    track_all();
+    return statistics.error;
+  }
+
+  // sort the objects by frame
+  index_frames();
+
+  std::vector<unsigned int> boundaries(n_chunks+1);
+  for (size_t k=0; k<n_chunks; k++) {
+    boundaries[k] = first + (k*n_frames)/n_chunks;
+  }
+  boundaries[n_chunks] = last+1;
+
+  // set up a tracker for each chunk, the trackers share the objects
+  TrackerParts chunks(n_chunks);
+  for (size_t k=0; k<n_chunks; k++) {
+
+    chunks[k].reset( new BayesianTracker(false) );
+    chunks[k]->copy_settings(*this);
+    chunks[k]->volume = volume;
+
+    unsigned int start = k>0 ? boundaries[k]-std::min(overlap, boundaries[k]) : 0;
+    unsigned int end = boundaries[k+1]+overlap;
+
+    // only count the events in the frames that this chunk is responsible for
+    unsigned int own_start = boundaries[k], own_end = boundaries[k+1];
+    chunks[k]->responsible = [own_start, own_end](const unsigned int a_frame,
+                                                  const Eigen::Vector3d&) {
+      return a_frame >= own_start && a_frame < own_end;
+    };
+
+    for (size_t i=frame_begin(start), i_end=frame_begin(end); i<i_end; i++) {
+      chunks[k]->queue_object( objects[i] );
+    }
+    chunks[k]->initialised = true;
+  }
+
+  // track the chunks in parallel, if any of them could not be tracked, track
+  // the whole set instead
+  if (!track_parts(chunks, a_threads)) {
+    track_all();
+    return statistics.error;
+  }
+
+  // stitch the chunks together
+  std::vector<TrackletPtr> stitched = stitch_chunks(gather_parts(chunks),
+                                                    boundaries,
+                                                    overlap);
+  complete_parts(stitched);
+
+  if (verbose && DEBUG) {
+    std::cout << "Stitched " << n_chunks << " chunks into " << stitched.size();
+    std::cout << " tracks." << std::endl;
+  }
+
+  return statistics.error;
+}
+
+
+
+// split the imaging volume into tiles in x and y, each of which is tracked
+// with a halo of max_search_radius around it, track the tiles in parallel
+// using independent trackers and stitch the tracks back together
+unsigned int BayesianTracker::track_tiled(const unsigned int a_tiles_x,
+                                          const unsigned int a_tiles_y,
+                                          const unsigned int a_threads)
+{
+  if (!ready_to_decompose()) return statistics.error;
+
+  TileGrid grid(volume, a_tiles_x, a_tiles_y);
+  if (grid.size() < 2) {
+    track_all();
+    return statistics.error;
+  }
+
+  // set up a tracker for each tile, the trackers share the objects
+  TrackerParts tiles(grid.size());
+  for (size_t k=0; k<grid.size(); k++) {
+    tiles[k].reset( new BayesianTracker(false) );
+    tiles[k]->copy_settings(*this);
+    tiles[k]->volume = volume;
+    tiles[k]->initialised = true;
+
+    // only count the events inside the tile, not in its halo
+    tiles[k]->responsible = [grid, k](const unsigned int,
+                                      const Eigen::Vector3d &a_position) {
+      return grid.row(a_position(1))*grid.nx + grid.column(a_position(0)) == k;
+    };
+  }
+
+  // give each object to every tile whose halo it lies in
+  const double halo = max_search_radius;
+  for (size_t i=0; i<objects.size(); i++) {
+    const TrackObjectPtr &obj = objects[i];
+    unsigned int c_lo = grid.column(obj->x - halo);
+    unsigned int c_hi = grid.column(obj->x + halo);
+    unsigned int r_lo = grid.row(obj->y - halo);
+    unsigned int r_hi = grid.row(obj->y + halo);
+    for (unsigned int r=r_lo; r<=r_hi; r++) {
+      for (unsigned int c=c_lo; c<=c_hi; c++) {
+        tiles[r*grid.nx + c]->queue_object( obj );
+      }
+    }
+  }
+
+  // track the tiles in parallel, if any of them could not be tracked, track
+  // the whole set instead
+  if (!track_parts(tiles, a_threads)) {
+    track_all();
+    return statistics.error;
+  }
+
+  // stitch the tiles together
+  std::vector<TrackletPtr> stitched = stitch_tiles(gather_parts(tiles), grid);
+  complete_parts(stitched);
+
+  if (verbose && DEBUG) {
+    std::cout << "Stitched " << grid.size() << " tiles into ";
+    std::cout << stitched.size() << " tracks." << std::endl;
+  }
+
+  return statistics.error;
+}
+
+
+
 // initialise the first frame
 unsigned int BayesianTracker::initialise() {
 
@@ -247,14 +705,10 @@ unsigned int BayesianTracker::initialise() {
     return ERROR_no_tracks;
   }
 
-  // sort the objects vector by time
-  std::sort( objects.begin(), objects.end(), compare_obj_time );
+  // sort the objects by frame
+  index_frames();
 
   // NOTE: should check that we have some frames which can be tracked
-  // start by converting the set to a vector
-  std::vector<unsigned int> f(frames_set.begin(), frames_set.end());
-  frames = f;
-
   bool useable_frames = false;
   for (size_t n=1; n<frames.size(); n++) {
     if ( (frames[n] - frames[n-1]) <= max_lost) {
@@ -283,14 +737,9 @@ unsigned int BayesianTracker::initialise() {
   current_frame = frames.front();
 
   // set up the first tracklets based on the first set of objects
-  while ( objects[o_counter]->t == current_frame && o_counter != n_objects ) {
+  for (size_t i_end=frame_begin(current_frame+1); o_counter<i_end; o_counter++) {
     // add a new tracklet
-    TrackletPtr trk = std::make_shared<Tracklet>( get_new_ID(),
-                                                  objects[o_counter],
-                                                  max_lost,
-                                                  this->motion_model);
-    tracks.push_back( trk );
-    o_counter++;
+    new_tracklet( objects[o_counter] );
   }
 
   // add one to the iteration
@@ -308,6 +757,9 @@ void BayesianTracker::step(const unsigned int steps)
   // make sure that we have steps greater than zero
   assert(steps>0);
 
+  // continue the tracks of a cancelled run
+  resume();
+
   // reset the step counter
   unsigned int step = 0;
 
@@ -325,97 +777,667 @@ void BayesianTracker::step(const unsigned int steps)
   }
 
 
-  while (step < steps && current_frame<frames.back()) {
+  while (step < steps && o_counter < n_objects) {
+
+    // skip straight to the next frame with objects, any empty frames are
+    // bridged by predicting the tracks across the gap
+    current_frame = objects[o_counter]->t;
+
+    // get the objects found in this frame
+    size_t o_end = frame_begin(current_frame+1);
+    new_objects.assign( objects.begin()+o_counter, objects.begin()+o_end );
+    o_counter = o_end;
+
+    // do the Bayesian updates and linking
+    update_active(current_frame);
+    process_frame(current_frame);
+
+    // update the iteration counter
+    step++;
+    current_frame++;
+
+    // move any finished tracks to the archive
+    if (retirement_window > 0) retire();
+
+    // write a checkpoint
+    auto_checkpoint();
+
+    // let anyone polling know how far we have got
+    update_progress();
+
+  }
+
+  // have we finished?
+  if (o_counter >= n_objects)
+  {
+    statistics.complete = true;
+    //clean();
+    tracks.finalise();
+    update_progress();
+  }
+
+  //return statistics;
+
+}
+
+
+
+// publish the progress of the tracking
+void BayesianTracker::update_progress()
+{
+  progress.current_frame.store(current_frame, std::memory_order_relaxed);
+  progress.n_active.store(statistics.n_active, std::memory_order_relaxed);
+  progress.n_tracks.store(this->size(), std::memory_order_relaxed);
+  progress.t_update_belief.store(statistics.t_update_belief,
+                                 std::memory_order_relaxed);
+  progress.t_update_link.store(statistics.t_update_link,
+                               std::memory_order_relaxed);
+  progress.complete.store(statistics.complete, std::memory_order_release);
+}
+
+
+
+// take a snapshot of the progress of the tracking
+void BayesianTracker::get_progress(PyTrackProgress* a_progress) const
+{
+  a_progress->complete = progress.complete.load(std::memory_order_acquire);
+  a_progress->current_frame = progress.current_frame.load(
+                                                    std::memory_order_relaxed);
+  a_progress->n_active = progress.n_active.load(std::memory_order_relaxed);
+  a_progress->n_tracks = progress.n_tracks.load(std::memory_order_relaxed);
+  a_progress->t_update_belief = progress.t_update_belief.load(
+                                                    std::memory_order_relaxed);
+  a_progress->t_update_link = progress.t_update_link.load(
+                                                    std::memory_order_relaxed);
+}
 
-    // update the list of active tracks
-    update_active();
 
-    // clear the list of objects
-    new_objects.clear();
 
-    // loop over all tracks found in this frame
-    while ( objects[o_counter]->t == current_frame && o_counter != n_objects) {
-      // store a reference to this object
-      new_objects.push_back( objects[o_counter] );
-      o_counter++;
+// track the objects in new_objects using the active tracks
+void BayesianTracker::process_frame(const unsigned int a_frame)
+{
+  processing_frame = a_frame;
+
+  // set up some counters
+  size_t n_active = active.size();
+  size_t n_obs = new_objects.size();
+  unsigned long n_allocations = allocation_count();
+
+  // the gate hit rate is reported for each frame
+  gate_tested = 0;
+  gate_passed = 0;
+  statistics.n_belief_allocations = 0;
+
+  // if we have an empty frame, append dummies to everthing
+  if (new_objects.empty()) {
+    for (size_t i=0; i<n_active; i++) {
+      queue_dummy( active[i] );
     }
+    flush_appends();
+  } else if (precision == PRECISION_single) {
+    // do the Bayesian updates and linking at the requested precision
+    update_belief<float>(scratch_single, n_active, n_obs);
+  } else {
+    update_belief<double>(scratch_double, n_active, n_obs);
+  }
 
-    // set up some counters
-    size_t n_active = active.size();
-    size_t n_obs = new_objects.size();
+  // the number of heap allocations made in this frame
+  statistics.n_allocations = allocation_count() - n_allocations;
+}
 
-    // if we have an empty frame, append dummies to everthing and continue
-    if (new_objects.empty()) {
-      //std::cout << "Frame " << current_frame << " is empty..." << std::endl;
-      for (size_t i=0; i<n_active; i++) {
-        active[i]->append_dummy();
-      }
-      step++;
-      current_frame++;
-      continue;
+
+
+// make the belief matrix using the scalar type T and link the tracks. The
+// matrices are mapped onto the scratch buffers, which only grow, so frames of
+// the same (or smaller) size do not allocate any memory in the belief stage.
+// Linking and storing the results (new tracks, dummies and the growth of the
+// track histories) may still allocate
+template <typename T>
+void BayesianTracker::update_belief(BeliefScratch<T> &a_scratch,
+                                    const size_t n_active,
+                                    const size_t n_obs)
+{
+  unsigned long n_allocations = allocation_count();
+
+  // make some space for the belief matrix
+  a_scratch.belief.resize((n_obs+1)*n_active);
+  BeliefMap<T> belief(a_scratch.belief.data(), n_obs+1, n_active);
+
+  // the object positions, in the scalar type of the belief matrix
+  a_scratch.positions.resize(3*n_obs);
+  PositionMap<T> positions(a_scratch.positions.data(), 3, n_obs);
+  for (size_t obj=0; obj != n_obs; obj++) {
+    positions.col(obj) = new_objects[obj]->position().cast<T>();
+  }
+
+  // do we want to do a fast update?
+  if (FAST_COST_UPDATE) {
+      local_objects.reserve(n_obs);
+      cost_FAST<T>(belief, positions, n_active, n_obs);
+  } else {
+      cost<T>(belief, positions, n_active, n_obs);
+  }
+
+  // the number of heap allocations made by the belief stage, which should be
+  // zero once the buffers are large enough for the frame
+  statistics.n_belief_allocations = allocation_count() - n_allocations;
+
+  // now that we have the complete belief matrix, we want to associate
+  // do naive linking
+  link<T>(belief, n_active, n_obs);
+}
+
+
+
+// streaming mode, track one frame of objects as it arrives
+unsigned int BayesianTracker::stream(const PyTrackObject* a_objects,
+                                     const unsigned int a_n_objects,
+                                     const unsigned int a_frame,
+                                     unsigned int* a_track_IDs)
+{
+  // we can't mix streaming with appending all of the objects up front
+  if (!objects.empty()) {
+    statistics.error = ERROR_stream_mixed_modes;
+    return ERROR_stream_mixed_modes;
+  }
+
+  // frames must arrive in order
+  if (streaming && a_frame < current_frame) {
+    statistics.error = ERROR_stream_out_of_order;
+    return ERROR_stream_out_of_order;
+  }
+
+  // the frame is valid, so clear the error left by a previously rejected one
+  if (statistics.error == ERROR_stream_out_of_order) {
+    statistics.error = ERROR_none;
+  }
+
+  // make the new track objects, these are only stored in the tracklets
+  new_objects.clear();
+  for (size_t i=0; i<a_n_objects; i++) {
+    TrackObjectPtr p = std::make_shared<TrackObject>(a_objects[i]);
+    volume.update(p);
+    new_objects.push_back( p );
+  }
+
+  if (!streaming) {
+    // this is the first frame, start a tracklet for every object
+    for (size_t i=0; i<a_n_objects; i++) {
+      a_track_IDs[i] = new_tracklet( new_objects[i] )->ID;
     }
 
-    // make some space for the belief matrix
-    Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic> belief;
+    streaming = true;
+    initialised = true;
+    current_frame = a_frame+1;
+    return SUCCESS;
+  }
 
-    // now do the Bayesian updates
-    belief.setZero(n_obs+1, n_active);
+  // now track this frame, any empty frames since the last one are counted as
+  // lost by update_active and the tracks are predicted across the gap
+  update_active(a_frame);
+  process_frame(a_frame);
+  current_frame = a_frame+1;
 
+  // move any finished tracks to the archive
+  if (retirement_window > 0) retire();
 
-    // do we want to do a fast update?
-    if (FAST_COST_UPDATE) {
-        cost_FAST(belief, n_active, n_obs);
-    } else {
-        cost(belief, n_active, n_obs);
+  // write a checkpoint
+  auto_checkpoint();
+
+  // return the tracklet assignments of the objects
+  for (size_t i=0; i<a_n_objects; i++) {
+    a_track_IDs[i] = assignments[i];
+  }
+
+  return SUCCESS;
+}
+
+
+
+// finish streaming
+void BayesianTracker::finalise()
+{
+  statistics.complete = true;
+  tracks.finalise();
+}
+
+
+
+// set the imaging volume [xlo, xhi, ylo, yhi, zlo, zhi]
+void BayesianTracker::set_volume(const double* a_volume)
+{
+  volume.min_xyz << a_volume[0], a_volume[2], a_volume[4];
+  volume.max_xyz << a_volume[1], a_volume[3], a_volume[5];
+}
+
+
+
+// set the acquisition times of the frames
+unsigned int BayesianTracker::set_frame_times(const double* a_times,
+                                              const unsigned int a_n_frames)
+{
+  for (size_t i=1; i<a_n_frames; i++) {
+    if (a_times[i] < a_times[i-1]) return ERROR_frame_times_not_increasing;
+  }
+  frame_times.assign(a_times, a_times+a_n_frames);
+  return SUCCESS;
+}
+
+
+
+// the time elapsed between two frames. Frames without an acquisition time are
+// a single time step of the motion model apart
+double BayesianTracker::elapsed(const unsigned int a_from,
+                                const unsigned int a_to) const
+{
+  if (a_from < frame_times.size() && a_to < frame_times.size()) {
+    return frame_times[a_to] - frame_times[a_from];
+  }
+  return (static_cast<double>(a_to) - a_from) * motion_model.time_step();
+}
+
+
+
+// set up retirement of finished tracks to an archive
+unsigned int BayesianTracker::set_retirement(const std::string &a_filename,
+                                             const unsigned int a_window)
+{
+  retirement_window = a_window;
+  if (a_window == 0) return SUCCESS;
+
+  std::shared_ptr<TrackArchive> archive = std::make_shared<TrackArchive>();
+  if (!archive->open(a_filename, this->motion_model)) {
+    retirement_window = 0;
+    return ERROR_file_IO;
+  }
+
+  tracks.set_archive(archive);
+  return SUCCESS;
+}
+
+
+
+// move the finished tracks to the archive, stopping the tracking if the
+// archive cannot be written
+void BayesianTracker::retire()
+{
+  tracks.retire(current_frame, retirement_window);
+  if (!tracks.good()) statistics.error = ERROR_file_IO;
+}
+
+
+
+// start a new file of finished tracks for a checkpoint, with all of the
+// tracks which are not active. Archived tracks are streamed through from the
+// archive one at a time
+bool BayesianTracker::start_checkpoint(const std::string &a_filename)
+{
+  finished.clear();
+  checkpoint_n_tracks = 0;
+  checkpoint_base.clear();
+
+  if (!checkpoint_tracks.open(a_filename + ".tracks")) return false;
+
+  std::set<const Tracklet*> live;
+  for (size_t i=0; i<active.size(); i++) live.insert(active[i].get());
+
+  for (size_t i=0; i<tracks.size(); i++) {
+    TrackletPtr trk = tracks[i];
+    if (!trk) {
+      checkpoint_tracks.close();
+      return false;
     }
+    if (live.count(trk.get())) continue;
+    trk->write(checkpoint_tracks);
+    checkpoint_n_tracks++;
+  }
+
+  checkpoint_base = a_filename;
+  checkpoint_revision = tracks.revision();
+  return true;
+}
 
-    // now that we have the complete belief matrix, we want to associate
-    // do naive linking
-    link(belief, n_active, n_obs);
 
-    // update the iteration counter
-    step++;
-    current_frame++;
 
+// write the state of the tracker to a checkpoint file. The finished tracks are
+// appended to the tracks file, which only needs to be started again if the
+// checkpoint file has changed or the finished tracks have been modified
+unsigned int BayesianTracker::checkpoint(const std::string &a_filename)
+{
+  if (a_filename != checkpoint_base ||
+      tracks.revision() != checkpoint_revision ||
+      !checkpoint_tracks.is_open() || !checkpoint_tracks.good()) {
+    if (!start_checkpoint(a_filename)) return ERROR_file_IO;
   }
 
-  // have we finished?
-  if (current_frame>=frames.back())
-  {
-    statistics.complete = true;
-    //clean();
-    tracks.finalise();
+  // append the tracks which have finished since the last checkpoint
+  for (size_t i=0; i<finished.size(); i++) {
+    finished[i]->write(checkpoint_tracks);
+    checkpoint_n_tracks++;
+  }
+  finished.clear();
+  if (!checkpoint_tracks.flush()) return ERROR_file_IO;
+
+  std::string tmp_filename = a_filename + ".tmp";
+
+  BinaryWriter writer;
+  if (!writer.open(tmp_filename)) return ERROR_file_IO;
+
+  // header
+  writer.write("BCHK", 4);
+  writer.write<uint32_t>(CHECKPOINT_VERSION);
+
+  // parameters and models
+  writer.write<uint32_t>(max_lost);
+  writer.write<double>(prob_not_assign);
+  writer.write<double>(accuracy);
+  writer.write<float>(max_search_radius);
+  writer.write<double>(gate_probability);
+  writer.write<double>(gate_threshold);
+  writer.write<uint32_t>(precision);
+  motion_model.write_model(writer);
+  object_model.write_model(writer);
+  writer.write_matrix(volume.min_xyz);
+  writer.write_matrix(volume.max_xyz);
+
+  // counters and statistics
+  writer.write<uint32_t>(current_frame);
+  writer.write<uint32_t>(new_ID);
+  writer.write<uint32_t>(n_lost);
+  writer.write<uint32_t>(n_conflicts);
+  writer.write<uint8_t>(initialised);
+  writer.write<uint8_t>(streaming);
+  writer.write(statistics);
+
+  // frame times
+  writer.write<uint64_t>(frame_times.size());
+  writer.write(frame_times.data(), frame_times.size()*sizeof(double));
+
+  // objects which have not been tracked yet, the others are stored with the
+  // tracks
+  size_t n_pending = initialised ? n_objects-o_counter : objects.size();
+  size_t first = objects.size()-n_pending;
+  writer.write<uint64_t>(n_pending);
+  for (size_t i=first; i<objects.size(); i++) {
+    write_track_object(writer, objects[i]);
   }
 
-  //return statistics;
+  // the extent of the tracks file which belongs to this checkpoint
+  writer.write<uint64_t>(checkpoint_n_tracks);
+  writer.write<uint64_t>(checkpoint_tracks.tell());
+
+  // the active tracks
+  writer.write<uint64_t>(active.size());
+  for (size_t i=0; i<active.size(); i++) {
+    active[i]->write(writer);
+  }
+
+  if (!writer.close()) return ERROR_file_IO;
+
+  // move the checkpoint into place
+  if (std::rename(tmp_filename.c_str(), a_filename.c_str()) != 0) {
+    return ERROR_file_IO;
+  }
 
+  if (verbose && DEBUG) {
+    std::cout << "Checkpoint at frame " << current_frame << std::endl;
+  }
+
+  return SUCCESS;
 }
 
 
 
-bool BayesianTracker::update_active()
+// restore the state of the tracker from a checkpoint file. Everything is read
+// into temporaries first, so the tracker is only changed if the complete
+// checkpoint could be read
+unsigned int BayesianTracker::restore(const std::string &a_filename)
 {
+  MappedFile file;
+  if (!file.open(a_filename)) return ERROR_file_IO;
+
+  BinaryReader reader(file.data(), file.size());
+
+  // check the header
+  char magic[4];
+  reader.read(magic, 4);
+  if (std::memcmp(magic, "BCHK", 4) != 0 ||
+      reader.read<uint32_t>() != CHECKPOINT_VERSION) {
+    return ERROR_file_IO;
+  }
+
+  // parameters and models
+  unsigned int r_max_lost = reader.read<uint32_t>();
+  double r_prob_not_assign = reader.read<double>();
+  double r_accuracy = reader.read<double>();
+  float r_max_search_radius = reader.read<float>();
+  double r_gate_probability = reader.read<double>();
+  double r_gate_threshold = reader.read<double>();
+  unsigned int r_precision = reader.read<uint32_t>();
+  MotionModel r_motion_model;
+  r_motion_model.read_model(reader);
+  ObjectModel r_object_model;
+  r_object_model.read_model(reader);
+  Eigen::MatrixXd r_min_xyz = reader.read_matrix();
+  Eigen::MatrixXd r_max_xyz = reader.read_matrix();
+
+  // counters and statistics
+  unsigned int r_current_frame = reader.read<uint32_t>();
+  unsigned int r_new_ID = reader.read<uint32_t>();
+  unsigned int r_n_lost = reader.read<uint32_t>();
+  unsigned int r_n_conflicts = reader.read<uint32_t>();
+  bool r_initialised = reader.read<uint8_t>();
+  bool r_streaming = reader.read<uint8_t>();
+  PyTrackInfo r_statistics = reader.read<PyTrackInfo>();
+
+  // frame times
+  size_t n_frame_times = reader.read<uint64_t>();
+  if (!reader.good() ||
+      n_frame_times*sizeof(double) > file.size()-reader.tell()) {
+    return ERROR_file_IO;
+  }
+  std::vector<double> r_frame_times(n_frame_times);
+  reader.read(r_frame_times.data(), n_frame_times*sizeof(double));
+
+  // objects which are still to be tracked
+  std::vector<TrackObjectPtr> r_objects;
+  size_t n_pending = reader.read<uint64_t>();
+  for (size_t i=0; i<n_pending && reader.good(); i++) {
+    r_objects.push_back( read_track_object(reader) );
+  }
+
+  // the finished tracks, from the tracks file
+  std::vector<TrackletPtr> r_tracks;
+  size_t n_finished = reader.read<uint64_t>();
+  uint64_t tracks_size = reader.read<uint64_t>();
+  if (!reader.good()) return ERROR_file_IO;
+
+  std::string tracks_filename = a_filename + ".tracks";
+  if (n_finished > 0) {
+    MappedFile tracks_file;
+    if (!tracks_file.open(tracks_filename) ||
+        tracks_file.size() < tracks_size) {
+      return ERROR_file_IO;
+    }
+    BinaryReader tracks_reader(tracks_file.data(), tracks_size);
+    for (size_t i=0; i<n_finished && tracks_reader.good(); i++) {
+      TrackletPtr trk = std::make_shared<Tracklet>();
+      trk->read(tracks_reader, r_motion_model);
+      r_tracks.push_back( trk );
+    }
+    if (!tracks_reader.good()) return ERROR_file_IO;
+  }
+
+  // the active tracks
+  std::vector<TrackletPtr> r_active;
+  size_t n_active = reader.read<uint64_t>();
+  for (size_t i=0; i<n_active && reader.good(); i++) {
+    TrackletPtr trk = std::make_shared<Tracklet>();
+    trk->read(reader, r_motion_model);
+    r_active.push_back( trk );
+  }
+
+  if (!reader.good()) return ERROR_file_IO;
+
+  // everything has been read, so update the tracker
+  max_lost = r_max_lost;
+  prob_not_assign = r_prob_not_assign;
+  accuracy = r_accuracy;
+  max_search_radius = r_max_search_radius;
+  gate_probability = r_gate_probability;
+  gate_threshold = r_gate_threshold;
+  precision = r_precision;
+  motion_model = r_motion_model;
+  object_model = r_object_model;
+  volume.min_xyz = r_min_xyz;
+  volume.max_xyz = r_max_xyz;
+
+  current_frame = r_current_frame;
+  new_ID = r_new_ID;
+  n_lost = r_n_lost;
+  n_conflicts = r_n_conflicts;
+  initialised = r_initialised;
+  streaming = r_streaming;
+  statistics = r_statistics;
+  frame_times.swap(r_frame_times);
+
+  objects.clear();
+  min_frame = std::numeric_limits<unsigned int>::max();
+  max_frame = 0;
+  for (size_t i=0; i<r_objects.size(); i++) {
+    queue_object( r_objects[i] );
+  }
+  if (initialised) index_frames();
+  n_objects = objects.size();
+  o_counter = 0;
+
+  // the tracks are ordered by ID, which is the order in which they were
+  // created
+  active.swap(r_active);
+  r_tracks.insert(r_tracks.end(), active.begin(), active.end());
+  std::sort(r_tracks.begin(), r_tracks.end(),
+            [](const TrackletPtr &a, const TrackletPtr &b) {
+              return a->ID < b->ID;
+            });
+  tracks = TrackManager();
+  for (size_t i=0; i<r_tracks.size(); i++) {
+    tracks.push_back( r_tracks[i] );
+  }
 
-  // TODO: MAKE INTERMEDIATE LIST OF TRACKS TO MINIMISE LOOPING OVER EVERYTHING
+  // retirement is not restored, it needs to be set up again
+  retirement_window = 0;
+
+  // carry on appending to the tracks file of this checkpoint, discarding any
+  // tracks written after it
+  finished.clear();
+  checkpoint_tracks.close();
+  checkpoint_base.clear();
+  if (truncate(tracks_filename.c_str(), tracks_size) == 0 &&
+      checkpoint_tracks.open(tracks_filename, true)) {
+    checkpoint_base = a_filename;
+    checkpoint_n_tracks = n_finished;
+    checkpoint_revision = tracks.revision();
+  }
+
+  return SUCCESS;
+}
+
+
+
+// append an object to a tracklet, or queue it for a batched update
+void BayesianTracker::queue_append(const TrackletPtr &a_trk,
+                                   const TrackObjectPtr &a_obj)
+{
+  if (!BATCH_MOTION_UPDATE) {
+    a_trk->append( a_obj, true, elapsed(a_trk->track.back()->t, a_obj->t) );
+    return;
+  }
+  queued_tracks.push_back( a_trk );
+  queued_objects.push_back( a_obj );
+}
 
-  // clear the active list
-  active.clear();
 
-  for (size_t i=0, trks_size=tracks.size(); i<trks_size; i++) {
+
+// append a dummy to a tracklet. The dummy is made from the prediction before
+// the update, as in Tracklet::append_dummy
+void BayesianTracker::queue_dummy(const TrackletPtr &a_trk)
+{
+  TrackObjectPtr dummy = a_trk->make_dummy(processing_frame,
+                     elapsed(a_trk->track.back()->t, processing_frame));
+  if (dummy) queue_append( a_trk, dummy );
+}
+
+
+
+// run the batched motion model updates, then append the objects
+void BayesianTracker::flush_appends()
+{
+  if (queued_tracks.empty()) return;
+
+  for (size_t i=0; i<queued_tracks.size(); i++) {
+    const TrackletPtr &trk = queued_tracks[i];
+    motion_batch.push( trk->get_motion_model(), queued_objects[i],
+                       elapsed(trk->track.back()->t, queued_objects[i]->t) );
+  }
+  motion_batch.run();
+
+  // the models are up to date, so append without updating them
+  for (size_t i=0; i<queued_tracks.size(); i++) {
+    queued_tracks[i]->append( queued_objects[i], false );
+  }
+
+  queued_tracks.clear();
+  queued_objects.clear();
+}
+
+
+
+// start a new tracklet from an object
+TrackletPtr BayesianTracker::new_tracklet(const TrackObjectPtr& a_obj)
+{
+  TrackletPtr trk = std::make_shared<Tracklet>( get_new_ID(),
+                                                a_obj,
+                                                max_lost,
+                                                this->motion_model );
+  tracks.push_back( trk );
+  active.push_back( trk );
+  return trk;
+}
+
+
+
+bool BayesianTracker::update_active(const unsigned int a_frame)
+{
+
+  // only tracks that were active in the last frame, or have been started
+  // since then, can still be active. Tracks never become active again once
+  // lost, so filter the active list in place rather than looping over every
+  // track. New tracks are appended to the list so the ordering is preserved.
+  size_t n_active = 0;
+
+  for (size_t i=0, trks_size=active.size(); i<trks_size; i++) {
 
     // check to see whether we have exceeded the bounds
-    if (!volume.inside( tracks[i]->position() )) {
-      tracks[i]->set_lost();
-      continue;
+    if (!volume.inside( active[i]->position() )) {
+      active[i]->set_lost();
     }
 
-    // if the track is still active, add it to the update list
-    if (tracks[i]->active()) {
-      active.push_back( tracks[i] );
+    // frames skipped since the track was last updated count as lost
+    active[i]->skip_to(a_frame);
+
+    // if the track is still active, keep it in the update list, otherwise it
+    // is finished and is written to the next checkpoint
+    if (active[i]->active()) {
+      active[n_active] = active[i];
+      n_active++;
+    } else if (checkpoint_tracks.is_open()) {
+      finished.push_back( active[i] );
     }
 
   }
 
+  active.resize(n_active);
+
   return true;
 
 }
@@ -451,8 +1473,114 @@ void BayesianTracker::debug_output(const unsigned int frm) const
 
 
 
-// make the cost matrix of all possible linkages
-void BayesianTracker::cost(Eigen::Ref<Eigen::MatrixXd> belief,
+// the chi-squared distribution with three degrees of freedom is exceeded with
+// probability erfc(sqrt(x/2)) + sqrt(2x/pi)*exp(-x/2), we invert this using
+// bisection since the function is monotonic
+double chi2_threshold(const double a_probability)
+{
+  if (a_probability <= 0.) return kInfinity;
+  if (a_probability >= 1.) return 0.;
+
+  double lo = 0., hi = 1000.;
+  for (unsigned int i=0; i<100; i++) {
+    double x = .5*(lo+hi);
+    double q = std::erfc(std::sqrt(.5*x)) +
+               std::sqrt(2.*x/M_PI) * std::exp(-.5*x);
+    if (q > a_probability) {
+      lo = x;
+    } else {
+      hi = x;
+    }
+  }
+  return .5*(lo+hi);
+}
+
+
+
+// the gate uses the positional covariance of the prediction, inflated by the
+// accuracy of the integration window used by probability_erf, so that the
+// gate never rejects an object which would have a reasonable score
+Eigen::Matrix3d BayesianTracker::gate_covariance(const PositionPrediction& a_prediction) const
+{
+  Eigen::Matrix3d covar = a_prediction.covar;
+  covar.diagonal().array() += accuracy*accuracy;
+  return covar;
+}
+
+
+
+// the search radius of a track is the radius of the sphere which encloses the
+// gate, set by the largest eigenvalue of the gating covariance. Tracks which
+// have been lost for a while have a larger covariance, and so search further,
+// but never beyond the maximum search radius. Without gating we fall back to
+// the maximum search radius
+double BayesianTracker::search_radius(const Eigen::Matrix3d& a_gate_covariance) const
+{
+  if (gate_probability <= 0.) return max_search_radius;
+
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+  solver.computeDirect(a_gate_covariance, Eigen::EigenvaluesOnly);
+  double radius = std::sqrt(gate_threshold * solver.eigenvalues().maxCoeff());
+  return std::min(radius, static_cast<double>(max_search_radius));
+}
+
+
+
+// calculate the scoring quantities of the prediction of a track
+template <typename T>
+void BayesianTracker::belief_prediction(const size_t trk,
+                                        BeliefPrediction<T> &a_prediction,
+                                        Eigen::Matrix3d &a_gate_covariance)
+{
+  // get the trk prediction
+  const TrackletPtr &track = active[trk];
+  PositionPrediction trk_prediction = track->predict(
+                        elapsed(track->track.back()->t, processing_frame));
+  a_gate_covariance = gate_covariance(trk_prediction);
+
+  a_prediction.mu = trk_prediction.mu.cast<T>();
+  a_prediction.inv_std = (trk_prediction.covar.diagonal().cwiseSqrt()
+                          * kRootTwo).cwiseInverse().cast<T>();
+  a_prediction.gate = a_gate_covariance.inverse().cast<T>();
+
+  // apply an exponential decay according to number of lost, drops to 50%
+  // at max lost, this is the same for all objects
+  a_prediction.log_decay = T(0);
+  if (PROB_ASSIGN_EXP_DECAY) {
+    a_prediction.log_decay = T(-M_LN2 * (double)active[trk]->lost /
+                               (double)max_lost);
+  }
+
+  // the track is currently in a metaphase state
+  a_prediction.metaphase = DISALLOW_METAPHASE_ANAPHASE_LINKING &&
+                           active[trk]->track.back()->label == STATE_metaphase;
+}
+
+
+
+// calculate the log probability of assigning a track to an object. Objects
+// outside of the gate are not scored, nor are anaphase objects if the track
+// is in metaphase
+template <typename T>
+T BayesianTracker::log_prob_assign(const BeliefPrediction<T> &a_prediction,
+                                   const Eigen::Matrix<T,3,1> &a_position,
+                                   const unsigned int a_label)
+{
+  Eigen::Matrix<T,3,1> d = a_position - a_prediction.mu;
+  if (!inside_gate(d, a_prediction.gate) ||
+      (a_prediction.metaphase && a_label == STATE_anaphase)) {
+    return -std::numeric_limits<T>::infinity();
+  }
+  return log_probability_erf(d, a_prediction.inv_std, T(accuracy)) +
+         a_prediction.log_decay;
+}
+
+
+
+// make the log belief matrix of all possible linkages
+template <typename T>
+void BayesianTracker::cost(BeliefMap<T> &belief,
+                           const PositionMap<T> &positions,
                            const size_t n_tracks,
                            const size_t n_objects)
 {
@@ -460,86 +1588,55 @@ void BayesianTracker::cost(Eigen::Ref<Eigen::MatrixXd> belief,
   std::clock_t t_update_start = std::clock();
 
   // set up some variables for Bayesian updates
-  Prediction trk_prediction;
-  double prob_assign = 0.;
-  double uniform_prior = 1. / (n_objects+1);
-  double prior_assign, PrDP, posterior, update;
+  BeliefPrediction<T> trk_prediction;
+  Eigen::Matrix3d trk_covar;
+  T shift;
+  T log_prob_not_assign = T(std::log(prob_not_assign));
 
   // set the uniform prior
-  belief.fill(uniform_prior);
-
-  // Posterior is a misnoma here because it is initially the prior, but
-  // becomes the posterior
-  Eigen::VectorXd v_posterior;
-  Eigen::VectorXd v_update = Eigen::VectorXd(n_objects+1);
+  belief.fill(T(-std::log(static_cast<double>(n_objects+1))));
 
   for (size_t trk=0; trk != n_tracks; trk++) {
 
     // get the trk prediction
-    trk_prediction = active[trk]->predict();
+    belief_prediction(trk, trk_prediction, trk_covar);
 
-    // make space for the update
-    // v_posterior = belief.col(trk);
-    v_posterior = belief.col(trk);
+    // the posterior is initially the prior
+    T* v_posterior = belief.col(trk).data();
+    shift = T(0);
 
     // loop through each candidate object
     for (size_t obj=0; obj != n_objects; obj++) {
 
-      // calculate the probability that this is the correct track
-      prob_assign = probability_erf(new_objects[obj]->position(),
-                                    trk_prediction,
-                                    this->accuracy);
-
-      // set the probability of assignment to zero if the track is currently
-      // in a metaphase state and the object to link to is anaphase
-      if (DISALLOW_METAPHASE_ANAPHASE_LINKING) {
-        if (active[trk]->track.back()->label == STATE_metaphase &&
-            new_objects[obj]->label == STATE_anaphase) {
-
-          // set the probability of assignment to zero
-          prob_assign = 0.0;
-        }
-      }
-
-      if (PROB_ASSIGN_EXP_DECAY) {
-        // apply an exponential decay according to number of lost
-        // drops to 50% at max lost
-        double a = std::pow(2, -(double)active[trk]->lost/(double)max_lost);
-        prob_assign = a*prob_assign;
-      }
-
       // now do the bayesian updates
-      // prior_assign = v_posterior(obj);
-      prior_assign = v_posterior(obj);
-      PrDP = prob_assign * prior_assign + prob_not_assign * (1.-prob_assign);
-      posterior = (prob_assign * (prior_assign / PrDP));
-      update = (1. + (prior_assign-posterior)/(1.-prior_assign));
-
-      v_update.fill(update);
-      v_update(obj) = 1.; // this means the posterior at obj will not be updated?
-
-      // do the update
-      v_posterior = v_posterior.array()*v_update.array();
-      v_posterior(obj) = posterior;
+      log_bayes_update(v_posterior, shift, obj,
+                       log_prob_assign(trk_prediction,
+                                       Eigen::Matrix<T,3,1>(positions.col(obj)),
+                                       new_objects[obj]->label),
+                       log_prob_not_assign);
 
     }
 
-    // now update the entire column (i.e. track)
-    //belief.col(trk) = belief.col(trk).cwiseProduct( v_posterior );
-    belief.col(trk) = v_posterior;
+    // now apply the accumulated update to the entire column (i.e. track)
+    belief.col(trk).array() += shift;
   }
 
   // set the timings
   double t_elapsed_ms = (std::clock() - t_update_start) /
                         (double) (CLOCKS_PER_SEC / 1000);
   statistics.t_update_belief = static_cast<float>(t_elapsed_ms);
+  statistics.gate_hit_rate = gate_tested > 0 ?
+                     static_cast<float>(gate_passed) / gate_tested : 0.f;
 
 }
 
 
 
-// make the cost matrix of all possible linkages
-void BayesianTracker::cost_FAST(Eigen::Ref<Eigen::MatrixXd> belief,
+// make the log belief matrix of all possible linkages, considering only the
+// objects in the neighbourhood of each track
+template <typename T>
+void BayesianTracker::cost_FAST(BeliefMap<T> &belief,
+                                const PositionMap<T> &positions,
                                 const size_t n_tracks,
                                 const size_t n_objects)
 {
@@ -547,101 +1644,66 @@ void BayesianTracker::cost_FAST(Eigen::Ref<Eigen::MatrixXd> belief,
   std::clock_t t_update_start = std::clock();
 
   // set up some variables for Bayesian updates
-  Prediction trk_prediction;
-  double prob_assign = 0.;
-  double uniform_prior = 1. / (n_objects+1);
-  double prior_assign, PrDP, posterior, update;
+  BeliefPrediction<T> trk_prediction;
+  Eigen::Matrix3d trk_covar;
+  T shift;
+  T log_prob_not_assign = T(std::log(prob_not_assign));
 
   // set the uniform prior
-  belief.fill(uniform_prior);
-
-  // Posterior is a misnoma here because it is initially the prior, but
-  // becomes the posterior
-  Eigen::VectorXd v_posterior;
-  Eigen::VectorXd v_update = Eigen::VectorXd(n_objects+1);
+  belief.fill(T(-std::log(static_cast<double>(n_objects+1))));
 
-  // make a bin map of the objects
-  ObjectBin m_cube = ObjectBin(max_search_radius, 1);
-  for (size_t obj=0; obj != n_objects; obj++) {
-    m_cube.add_object(new_objects[obj]);
-  }
+  // make a spatial index of the objects
+  object_tree.build(new_objects);
 
 
   // iterate over the tracks
   for (size_t trk=0; trk != n_tracks; trk++) {
 
     // get the trk prediction
-    trk_prediction = active[trk]->predict();
+    belief_prediction(trk, trk_prediction, trk_covar);
 
-    // make space for the update
-    // v_posterior = belief.col(trk);
-    v_posterior = belief.col(trk);
+    // the posterior is initially the prior
+    T* v_posterior = belief.col(trk).data();
+    shift = T(0);
 
-    // get the local objects for updating
-    std::vector<TrackObjectPtr_and_Index> local_objects;
-    local_objects = m_cube.get(active[trk], false);
+    // get the local objects for updating, searching around the prediction
+    // with a radius set by its uncertainty
+    object_tree.get(trk_prediction.mu.template cast<double>(),
+                    search_radius(trk_covar),
+                    local_objects);
     size_t n_local_objects = local_objects.size();
 
     // loop through each candidate object
     for (size_t obj=0; obj != n_local_objects; obj++) {
 
-      // calculate the probability that this is the correct track
-      prob_assign = probability_erf(local_objects[obj].first->position(),
-                                    trk_prediction,
-                                    this->accuracy);
-
-      // set the probability of assignment to zero if the track is currently
-      // in a metaphase state and the object to link to is anaphase
-      if (DISALLOW_METAPHASE_ANAPHASE_LINKING) {
-        if (active[trk]->track.back()->label == STATE_metaphase &&
-            local_objects[obj].first->label == STATE_anaphase) {
-
-          // set the probability of assignment to zero
-          prob_assign = 0.0;
-        }
-      }
-
-      if (PROB_ASSIGN_EXP_DECAY) {
-        // apply an exponential decay according to number of lost
-        // drops to 50% at max lost
-        double a = std::pow(2, -(double)active[trk]->lost/(double)max_lost);
-        prob_assign = a*prob_assign;
-      }
-
       // now do the bayesian updates
-      // prior_assign = v_posterior(obj);
-      prior_assign = v_posterior(local_objects[obj].second);
-      PrDP = prob_assign * prior_assign + prob_not_assign * (1.-prob_assign);
-      posterior = (prob_assign * (prior_assign / PrDP));
-      update = (1. + (prior_assign-posterior)/(1.-prior_assign));
-
-      v_update.fill(update);
-
-      // NOTE(arl): Is this necessary?
-      v_update(local_objects[obj].second) = 1.; // this means the posterior at obj will not be updated?
-
-      // do the update
-      v_posterior = v_posterior.array()*v_update.array();
-      v_posterior(local_objects[obj].second) = posterior;
+      size_t idx = local_objects[obj].second;
+      log_bayes_update(v_posterior, shift, idx,
+                       log_prob_assign(trk_prediction,
+                                       Eigen::Matrix<T,3,1>(positions.col(idx)),
+                                       local_objects[obj].first->label),
+                       log_prob_not_assign);
 
     }
 
-    // now update the entire column (i.e. track)
-    //belief.col(trk) = belief.col(trk).cwiseProduct( v_posterior );
-    belief.col(trk) = v_posterior;
+    // now apply the accumulated update to the entire column (i.e. track)
+    belief.col(trk).array() += shift;
   }
 
   // set the timings
   double t_elapsed_ms = (std::clock() - t_update_start) /
                         (double) (CLOCKS_PER_SEC / 1000);
   statistics.t_update_belief = static_cast<float>(t_elapsed_ms);
+  statistics.gate_hit_rate = gate_tested > 0 ?
+                     static_cast<float>(gate_passed) / gate_tested : 0.f;
 
 }
 
 
 
 // make the cost matrix of all possible linkages
-void BayesianTracker::link(Eigen::Ref<Eigen::MatrixXd> belief,
+template <typename T>
+void BayesianTracker::link(const BeliefMap<T> &belief,
                            const size_t n_tracks,
                            const size_t n_objects )
 {
@@ -649,102 +1711,58 @@ void BayesianTracker::link(Eigen::Ref<Eigen::MatrixXd> belief,
   // start a timer
   std::clock_t t_update_start = std::clock();
 
-  // set up some space for used objects
-  std::set<unsigned int> not_used;
-  for (size_t i=0; i<n_tracks; i++) {
-    not_used.insert(not_used.end(), i);
-  }
+  // find the best object for each track, and the best track for each object
+  resolve_links<T>(belief, links);
+  links.used.assign(n_tracks, false);
 
-  // make a track map
-  HypothesisMap<LinkHypothesis> map = HypothesisMap<LinkHypothesis>(n_objects);
+  // keep a record of which tracklet each object is assigned to
+  assignments.assign(n_objects, 0);
 
   for (size_t trk=0; trk<n_tracks; trk++) {
+    if (links.best_object[trk] != n_objects) continue;
 
-    // get the object with the best match for this track...
-    Eigen::MatrixXf::Index best_object;
-    double prob = belief.col(trk).maxCoeff(&best_object);
-
-    if (int(best_object) != int(n_objects)) {
-      // push this putative linkage to the map
-      map.push( best_object, LinkHypothesis(trk, prob) );
-
-    } else {
-      // this track is probably lost, append a dummy to the trajectory
-      active[trk]->append_dummy();
-      not_used.erase(trk);
-      n_lost++;
+    // this track is probably lost, append a dummy to the trajectory
+    queue_dummy( active[trk] );
+    links.used[trk] = true;
+    if (count_event(active[trk]->position())) n_lost++;
 
-      // update the statistics
-      statistics.p_lost = prob;
-    }
+    // update the statistics
+    statistics.p_lost = std::exp(static_cast<double>(belief(n_objects, trk)));
   }
 
-  // now loop through the map
-  for (size_t obj=0, map_size=map.size(); obj<map_size; obj++) {
-
-    unsigned int n_links = map[obj].size();
-
-    // this is a direct correspondence, make the mapping
-    if (n_links == 1) {
-      //  std::cout << map[trk].size() << std::endl;
-      LinkHypothesis lnk = map[obj][0];
-
-      unsigned int trk = lnk.first;
-
-      if (not_used.count(trk) < 1) {
-        // TODO(arl): make this error more useful
-        std::cout << "ERROR: Exhausted potential linkages." << std::endl;
-      }
-      active[trk]->append( new_objects[obj] );
-
-      // update the statistics
-      statistics.p_link = lnk.second;
+  // now loop through the objects
+  for (size_t obj=0; obj<n_objects; obj++) {
 
-      // since we've found a correspondence for this one, remove from set
-      not_used.erase(trk);
-    } else if (n_links < 1) {
+    if (links.count[obj] < 1) {
       // this object has no matches, add a new tracklet
-      TrackletPtr trk = std::make_shared<Tracklet>( get_new_ID(),
-                                                    new_objects[obj],
-                                                    max_lost,
-                                                    this->motion_model );
-      tracks.push_back( trk );
-
-    } else if ( n_links > 1) {
-      // conflict, get the best one
-      n_conflicts++;
-
-      unsigned int trk;
-      double prob = -1.;
-      for (size_t i=0; i<n_links; i++) {
-        if (map[obj][i].second > prob) {
-          prob = map[obj][i].second;
-          trk = map[obj][i].first;
-        }
-      }
-
-      if (not_used.count(trk) < 1) {
-        // TODO(arl): make this error more useful
-        std::cout << "ERROR: Exhausted potential linkages." << std::endl;
-      }
-
-      // update only this one
-      active[trk]->append( new_objects[obj] );
-
-      // since we've found a correspondence for this one, remove from
-      not_used.erase(trk);
+      assignments[obj] = new_tracklet( new_objects[obj] )->ID;
+      continue;
     }
-  }
 
+    if (links.count[obj] == 1) {
+      // this is a direct correspondence, update the statistics
+      statistics.p_link = std::exp(links.prob[obj]);
+    } else {
+      // conflict, the best one has already been chosen
+      if (count_event(new_objects[obj]->position())) n_conflicts++;
+    }
 
-  // get a vector of updates
-  std::vector<unsigned int> to_update(not_used.begin(), not_used.end());
+    // make the mapping, each track is the best for at most one object
+    unsigned int trk = links.track[obj];
+    queue_append( active[trk], new_objects[obj] );
+    assignments[obj] = active[trk]->ID;
+    links.used[trk] = true;
+  }
 
-  for (size_t i=0, update_size=to_update.size(); i<update_size; i++) {
-    // update these tracks
-    active[ to_update[i] ]->append_dummy();
+  // update the tracks which were not linked, including those which lost a
+  // conflict
+  for (size_t trk=0; trk<n_tracks; trk++) {
+    if (!links.used[trk]) queue_dummy( active[trk] );
   }
 
+  // run the motion model updates
+  flush_appends();
+
   // set the timings
   double t_elapsed_ms = (std::clock() - t_update_start) /
                         (double) (CLOCKS_PER_SEC / 1000);
@@ -34,26 +34,29 @@ Tracklet::Tracklet( const unsigned int new_ID,
 
   // starting a new tracklet
   ID = new_ID;
+  this->max_lost = max_lost;
   append( new_object, false );
 
 }
 
 
 
-void Tracklet::append(const TrackObjectPtr& new_object, bool update) {
+void Tracklet::append(const TrackObjectPtr& new_object,
+                      bool update,
+                      const double a_dt) {
 
   // append the new object to the end of the track
   track.push_back( new_object );
 
   // update the motion model and the prediction
   if (update) {
-    motion_model.update( new_object );
+    motion_model.update( new_object, a_dt );
   }
 
   // push back the prediction before the update
   prediction.push_back( this->predict() );
   // store the Kalman filter output
-  kalman.push_back( this->motion_model.predict() );
+  kalman.push_back( this->motion_model.predict_position() );
 
   // if this is a dummy object increment the lost counter
   if (new_object->dummy) {
@@ -68,11 +71,20 @@ void Tracklet::append(const TrackObjectPtr& new_object, bool update) {
 
 // append a dummy object to the tracklet
 void Tracklet::append_dummy() {
-  if (lost >= MAX_LOST)
-    return;
+  TrackObjectPtr dummy = make_dummy();
+  if (dummy) this->append( dummy );
+}
+
+
+
+// make a dummy object from the prediction
+TrackObjectPtr Tracklet::make_dummy(const unsigned int a_frame,
+                                    const double a_dt) const {
+  if (lost >= max_lost)
+    return TrackObjectPtr();
 
   // get the predicted new position
-  Prediction p = this->predict();
+  PositionPrediction p = this->predict(a_dt);
 
   // make a dummy track object by copying the last observation
   TrackObjectPtr dummy = std::make_shared<TrackObject>( *(this->track.back()) );
@@ -80,11 +92,10 @@ void Tracklet::append_dummy() {
   dummy->x = p.mu(0);
   dummy->y = p.mu(1);
   dummy->z = p.mu(2);
-  dummy->t = dummy->t+1; // NOTE(arl): is this valid assumption?
+  dummy->t = a_frame;
   dummy->ID = 0;
 
-  // append the dummy to the track
-  this->append( dummy );
+  return dummy;
 }
 
 
@@ -101,11 +112,183 @@ bool Tracklet::trim() {
 
 // make a prediction about the future state of the tracklet
 // TODO(arl): make this model agnostic
-Prediction Tracklet::predict() const {
-  Prediction p_out;
-  Prediction p = motion_model.predict();
+PositionPrediction Tracklet::predict(const double a_dt) const {
+  PositionPrediction p_out;
   //p_out.mu = position() + p.mu.tail(3); // add the displacement vector
-  p_out.mu = position() + motion_model.get_motion_vector();
-  p_out.covar = p.covar.block(0,0,3,3);
+  p_out.mu = position() + motion_model.get_motion_vector() * a_dt;
+
+  // the covariance is that of the filter after the last update, propagated
+  // forward by any time beyond a single step
+  if (motion_model.single_step(a_dt) || a_dt < motion_model.time_step()) {
+    p_out.covar = motion_model.predict_position().covar;
+  } else {
+    p_out.covar = motion_model.position_covariance(a_dt -
+                                                   motion_model.time_step());
+  }
   return p_out;
 }
+
+
+
+// make a new tracklet from part of this one, note that trim only removes
+// objects, so there are always at least as many predictions as objects
+std::shared_ptr<Tracklet> Tracklet::slice(const size_t a_first,
+                                          const size_t a_last) const
+{
+  assert(a_first <= a_last && a_last <= track.size());
+  std::shared_ptr<Tracklet> trk = std::make_shared<Tracklet>();
+  trk->max_lost = max_lost;
+  trk->extend(*this, a_first, a_last);
+  return trk;
+}
+
+
+
+// extend this tracklet with part of another
+void Tracklet::extend(const Tracklet &a_trk,
+                      const size_t a_first,
+                      const size_t a_last)
+{
+  assert(a_first <= a_last && a_last <= a_trk.track.size());
+  track.insert(track.end(), a_trk.track.begin()+a_first,
+                            a_trk.track.begin()+a_last);
+  kalman.insert(kalman.end(), a_trk.kalman.begin()+a_first,
+                              a_trk.kalman.begin()+a_last);
+  prediction.insert(prediction.end(), a_trk.prediction.begin()+a_first,
+                                      a_trk.prediction.begin()+a_last);
+  motion_model = a_trk.motion_model;
+  lost = a_trk.lost;
+  considered = a_trk.considered;
+}
+
+
+
+// write a track object
+void write_track_object(BinaryWriter &a_writer, const TrackObjectPtr &a_obj)
+{
+  a_writer.write<int32_t>(a_obj->ID);
+  a_writer.write<double>(a_obj->x);
+  a_writer.write<double>(a_obj->y);
+  a_writer.write<double>(a_obj->z);
+  a_writer.write<uint32_t>(a_obj->t);
+  a_writer.write<uint8_t>(a_obj->dummy);
+  a_writer.write<uint32_t>(a_obj->label);
+  a_writer.write<uint32_t>(a_obj->states);
+}
+
+
+
+// read a track object, note that the pointer to the class probabilities is
+// not stored
+TrackObjectPtr read_track_object(BinaryReader &a_reader)
+{
+  TrackObjectPtr obj = std::make_shared<TrackObject>();
+  obj->ID = a_reader.read<int32_t>();
+  obj->x = a_reader.read<double>();
+  obj->y = a_reader.read<double>();
+  obj->z = a_reader.read<double>();
+  obj->t = a_reader.read<uint32_t>();
+  obj->dummy = a_reader.read<uint8_t>();
+  obj->label = a_reader.read<uint32_t>();
+  obj->states = a_reader.read<uint32_t>();
+  obj->probability = NULL;
+  return obj;
+}
+
+
+
+// write a prediction, keeping only the positional part
+void write_prediction(BinaryWriter &a_writer,
+                      const PositionPrediction &a_prediction)
+{
+  for (unsigned int i=0; i<3; i++) {
+    a_writer.write<double>(a_prediction.mu(i));
+  }
+  for (unsigned int i=0; i<3; i++) {
+    for (unsigned int j=0; j<3; j++) {
+      a_writer.write<double>(a_prediction.covar(i,j));
+    }
+  }
+}
+
+
+
+// read a positional prediction
+PositionPrediction read_prediction(BinaryReader &a_reader)
+{
+  Eigen::Vector3d mu;
+  Eigen::Matrix3d covar;
+  for (unsigned int i=0; i<3; i++) {
+    mu(i) = a_reader.read<double>();
+  }
+  for (unsigned int i=0; i<3; i++) {
+    for (unsigned int j=0; j<3; j++) {
+      covar(i,j) = a_reader.read<double>();
+    }
+  }
+  return PositionPrediction(mu, covar);
+}
+
+
+
+// write the tracklet, its objects and the state of the motion model
+void Tracklet::write(BinaryWriter &a_writer) const
+{
+  a_writer.write<uint32_t>(ID);
+  a_writer.write<uint32_t>(root);
+  a_writer.write<uint32_t>(parent);
+  a_writer.write<uint32_t>(renamed_ID);
+  a_writer.write<uint32_t>(fate);
+  a_writer.write<uint32_t>(lost);
+  a_writer.write<uint32_t>(considered);
+  a_writer.write<uint32_t>(max_lost);
+  a_writer.write<uint32_t>(track.size());
+
+  for (size_t i=0; i<track.size(); i++) {
+    write_track_object(a_writer, track[i]);
+  }
+
+  for (size_t i=0; i<track.size(); i++) {
+    write_prediction(a_writer, kalman[i]);
+    write_prediction(a_writer, prediction[i]);
+  }
+
+  motion_model.write_state(a_writer);
+}
+
+
+
+// read the tracklet back
+void Tracklet::read(BinaryReader &a_reader, const MotionModel &a_model)
+{
+  ID = a_reader.read<uint32_t>();
+  root = a_reader.read<uint32_t>();
+  parent = a_reader.read<uint32_t>();
+  renamed_ID = a_reader.read<uint32_t>();
+  fate = a_reader.read<uint32_t>();
+  lost = a_reader.read<uint32_t>();
+  considered = a_reader.read<uint32_t>();
+  max_lost = a_reader.read<uint32_t>();
+  size_t n_objects = a_reader.read<uint32_t>();
+
+  // stop if the record is truncated
+  if (!a_reader.good()) return;
+
+  track.clear();
+  track.reserve(n_objects);
+  for (size_t i=0; i<n_objects; i++) {
+    track.push_back( read_track_object(a_reader) );
+  }
+
+  kalman.clear();
+  prediction.clear();
+  kalman.reserve(n_objects);
+  prediction.reserve(n_objects);
+  for (size_t i=0; i<n_objects; i++) {
+    kalman.push_back( read_prediction(a_reader) );
+    prediction.push_back( read_prediction(a_reader) );
+  }
+
+  motion_model = a_model;
+  motion_model.read_state(a_reader);
+}
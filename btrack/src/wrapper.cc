@@ -18,15 +18,24 @@
 
 // Interface class to coordinate the tracker, hypothesis engine and optimisation
 // Also provides a simple interface for the python facing code.
-InterfaceWrapper::InterfaceWrapper() {
-  std::cout << "Instantiating BTRACK interface wrapper" << std::endl;
-
-  // create a track manager instance, pass it to the tracker
-  tracker = BayesianTracker(true);
+InterfaceWrapper::InterfaceWrapper(const bool a_verbose) :
+                                   tracker(a_verbose) {
+  busy_stats.error = ERROR_tracking_in_progress;
 };
 
 InterfaceWrapper::~InterfaceWrapper() {
-  std::cout << "Deleting BTRACK interface wrapper" << std::endl;
+  // stop any asynchronous tracking before the tracker goes away
+  if (worker.joinable()) {
+    tracker.cancel();
+    worker.join();
+  }
+};
+
+// copy the configuration from another interface
+void InterfaceWrapper::copy_configuration(const InterfaceWrapper &a_source)
+{
+  if (running || a_source.running) return;
+  tracker.copy_settings(a_source.tracker);
 };
 
 // tracking and basic data handling
@@ -42,6 +51,7 @@ void InterfaceWrapper::set_motion_model(const unsigned int measurements,
                                         unsigned int max_lost,
                                         double prob_not_assign)
 {
+  if (running) return;
 
   // set the motion model of the tracker
   tracker.set_motion_model( measurements, states, A, H, P, Q, R, dt, accuracy,
@@ -51,39 +61,147 @@ void InterfaceWrapper::set_motion_model(const unsigned int measurements,
 // set the maximum search radius
 void InterfaceWrapper::set_max_search_radius(const float max_search_radius)
 {
+  if (running) return;
   tracker.set_max_search_radius(max_search_radius);
 }
 
+// set the probability floor used for gating
+void InterfaceWrapper::set_gating(const double gate_probability)
+{
+  if (running) return;
+  tracker.set_gating(gate_probability);
+}
+
+// set the precision of the belief matrix
+unsigned int InterfaceWrapper::set_precision(const unsigned int precision)
+{
+  if (running) return ERROR_tracking_in_progress;
+  return tracker.set_precision(precision);
+}
+
 // append a new object to the tracker
 void InterfaceWrapper::append(const PyTrackObject a_object)
 {
+  if (running) return;
   tracker.append( a_object );
 };
 
 // run the complete tracking
 const PyTrackInfo* InterfaceWrapper::track()
 {
+  if (running) return &busy_stats;
   tracker.track_all();
   return tracker.stats();
 };
 
+// start the tracking on a worker thread
+unsigned int InterfaceWrapper::track_async()
+{
+  if (running) return ERROR_tracking_in_progress;
+
+  // tidy up a previous run which nobody waited for
+  if (worker.joinable()) worker.join();
+
+  tracker.reset_cancel();
+  last_frame = tracker.last_frame();
+  t_start = std::chrono::steady_clock::now().time_since_epoch().count();
+  running = true;
+  worker = std::thread([this]() {
+    tracker.track_all();
+    t_finish = std::chrono::steady_clock::now().time_since_epoch().count();
+    running = false;
+  });
+
+  return ERROR_none;
+};
+
+// get the progress of the asynchronous tracking
+void InterfaceWrapper::get_progress(PyTrackProgress* a_progress) const
+{
+  tracker.get_progress(a_progress);
+  a_progress->last_frame = last_frame;
+  a_progress->running = running;
+
+  // the elapsed time stops when the tracking finishes
+  std::chrono::steady_clock::rep t_end = a_progress->running ?
+      std::chrono::steady_clock::now().time_since_epoch().count() :
+      t_finish.load();
+  std::chrono::steady_clock::duration t_run(t_end - t_start);
+  a_progress->t_elapsed = std::chrono::duration<float>(t_run).count();
+};
+
+// ask the asynchronous tracking to stop
+void InterfaceWrapper::cancel()
+{
+  tracker.cancel();
+};
+
+// wait for the asynchronous tracking to finish
+const PyTrackInfo* InterfaceWrapper::wait()
+{
+  if (worker.joinable()) worker.join();
+  return tracker.stats();
+};
+
+// run the tracking on temporal chunks in parallel
+const PyTrackInfo* InterfaceWrapper::track_chunked(const unsigned int a_threads,
+                                                   const unsigned int a_overlap)
+{
+  if (running) return &busy_stats;
+  tracker.track_chunked(a_threads, a_overlap);
+  return tracker.stats();
+};
+
+// run the tracking on spatial tiles in parallel
+const PyTrackInfo* InterfaceWrapper::track_tiled(const unsigned int a_tiles_x,
+                                                 const unsigned int a_tiles_y,
+                                                 const unsigned int a_threads)
+{
+  if (running) return &busy_stats;
+  tracker.track_tiled(a_tiles_x, a_tiles_y, a_threads);
+  return tracker.stats();
+};
+
 // track for n steps (interactive mode)
 const PyTrackInfo* InterfaceWrapper::step(const unsigned int a_steps)
 {
+  if (running) return &busy_stats;
   tracker.step(a_steps);
   return tracker.stats();
 };
 
+// track a single frame of objects (streaming mode)
+const PyTrackInfo* InterfaceWrapper::stream(const PyTrackObject* a_objects,
+                                            const unsigned int a_n_objects,
+                                            const unsigned int a_frame,
+                                            unsigned int* a_track_IDs)
+{
+  if (running) return &busy_stats;
+  tracker.stream(a_objects, a_n_objects, a_frame, a_track_IDs);
+  return tracker.stats();
+};
+
+// finish streaming
+void InterfaceWrapper::finalise()
+{
+  if (running) return;
+  tracker.finalise();
+};
+
 // return the length of a track by ID
 unsigned int InterfaceWrapper::track_length(const unsigned int a_ID) const
 {
-  return tracker.tracks[a_ID]->length();
+  if (running) return 0;
+  // a track which cannot be read back from the archive is empty
+  TrackletPtr trk = tracker.tracks[a_ID];
+  return trk ? trk->length() : 0;
 };
 
 // get a track by ID
 unsigned int InterfaceWrapper::get_track(double* output,
                                          const unsigned int a_ID) const
 {
+  if (running) return 0;
   unsigned int n_frames = track_length(a_ID);
   const unsigned int N = 3+1;
 
@@ -104,6 +222,7 @@ unsigned int InterfaceWrapper::get_track(double* output,
 unsigned int InterfaceWrapper::get_refs(int* output,
                                         const unsigned int a_ID) const
 {
+  if (running) return 0;
   unsigned int n_frames = track_length(a_ID);
   for (unsigned int i=0; i<n_frames; i++) {
     output[i] = tracker.tracks[a_ID]->track[i]->ID;
@@ -112,16 +231,21 @@ unsigned int InterfaceWrapper::get_refs(int* output,
 };
 
 unsigned int InterfaceWrapper::get_parent(const unsigned int a_ID) const {
-  return tracker.tracks[a_ID]->parent;
+  if (running) return 0;
+  TrackletPtr trk = tracker.tracks[a_ID];
+  return trk ? trk->parent : 0;
 }
 
 unsigned int InterfaceWrapper::get_fate(const unsigned int a_ID) const {
-  return tracker.tracks[a_ID]->fate;
+  if (running) return TYPE_undef;
+  TrackletPtr trk = tracker.tracks[a_ID];
+  return trk ? trk->fate : TYPE_undef;
 }
 
 unsigned int InterfaceWrapper::get_kalman_mu(double* output,
                                              const unsigned int a_ID) const
 {
+  if (running) return 0;
   // NOTE: This is grabbing the Kalman filter rather than the track!
   const unsigned int N = 3+1;
   unsigned int n_frames = track_length(a_ID);
@@ -137,6 +261,7 @@ unsigned int InterfaceWrapper::get_kalman_mu(double* output,
 unsigned int InterfaceWrapper::get_kalman_covar(double* output,
                                                 const unsigned int a_ID) const
 {
+  if (running) return 0;
   // NOTE: This is grabbing the Kalman filter rather than the track!
   const unsigned int N = 9+1;
   unsigned int n_frames = track_length(a_ID);
@@ -158,6 +283,7 @@ unsigned int InterfaceWrapper::get_kalman_covar(double* output,
 unsigned int InterfaceWrapper::get_kalman_pred(double* output,
                                                const unsigned int a_ID) const
 {
+  if (running) return 0;
   // NOTE: This is grabbing the Kalman filter rather than the track!
   const unsigned int N = 3+1;
   unsigned int n_frames = track_length(a_ID);
@@ -173,6 +299,7 @@ unsigned int InterfaceWrapper::get_kalman_pred(double* output,
 unsigned int InterfaceWrapper::get_label(unsigned int* output,
                                          const unsigned int a_ID) const
 {
+  if (running) return 0;
   // NOTE: This is grabbing the labels from the track!
   const unsigned int N = 1+1;
   unsigned int n_frames = track_length(a_ID);
@@ -186,6 +313,7 @@ unsigned int InterfaceWrapper::get_label(unsigned int* output,
 // return the imaging volume
 void InterfaceWrapper::get_volume(double* a_volume) const
 {
+  if (running) return;
   a_volume[0] = tracker.volume.min_xyz(0);
   a_volume[1] = tracker.volume.max_xyz(0);
   a_volume[2] = tracker.volume.min_xyz(1);
@@ -195,11 +323,80 @@ void InterfaceWrapper::get_volume(double* a_volume) const
 };
 
 
+// set the imaging volume
+void InterfaceWrapper::set_volume(const double* a_volume)
+{
+  if (running) return;
+  tracker.set_volume(a_volume);
+};
+
+
+
+// set the acquisition time of each frame
+unsigned int InterfaceWrapper::set_frame_times(const double* a_times,
+                                               const unsigned int a_n_frames)
+{
+  if (running) return ERROR_tracking_in_progress;
+  return tracker.set_frame_times(a_times, a_n_frames);
+};
+
+
+
+// retire finished tracks to an archive file
+unsigned int InterfaceWrapper::set_retirement(const char* a_filename,
+                                              const unsigned int a_window)
+{
+  if (running) return ERROR_tracking_in_progress;
+  return tracker.set_retirement(std::string(a_filename), a_window);
+};
+
+
+
+// write the state of the tracker to a checkpoint
+unsigned int InterfaceWrapper::checkpoint(const char* a_filename)
+{
+  if (running) return ERROR_tracking_in_progress;
+  return tracker.checkpoint(std::string(a_filename));
+};
+
+
+
+// restore the state of the tracker from a checkpoint
+unsigned int InterfaceWrapper::restore(const char* a_filename)
+{
+  if (running) return ERROR_tracking_in_progress;
+  return tracker.restore(std::string(a_filename));
+};
+
+
+
+// checkpoint periodically while tracking
+void InterfaceWrapper::set_checkpoint(const char* a_filename,
+                                      const unsigned int a_interval)
+{
+  if (running) return;
+  tracker.set_checkpoint(std::string(a_filename), a_interval);
+};
+
+
+
+// write the tracks to a binary track store
+unsigned int InterfaceWrapper::write_store(const char* a_filename) const
+{
+  if (running) return ERROR_tracking_in_progress;
+  return tracker.tracks.write_store(std::string(a_filename));
+};
+
+
+
 PyTrackObject InterfaceWrapper::get_dummy(const int a_ID)
 {
+  if (running) return PyTrackObject();
   // get a pointer to the track manager
   p_manager = &tracker.tracks;
-  return p_manager->get_dummy(a_ID)->get_pytrack_object();
+  TrackObjectPtr dummy = p_manager->get_dummy(a_ID);
+  if (!dummy) return PyTrackObject();
+  return dummy->get_pytrack_object();
 }
 
 
@@ -208,17 +405,33 @@ unsigned int InterfaceWrapper::create_hypotheses( const PyHypothesisParams a_par
                                                   const unsigned int a_start_n,
                                                   const unsigned int a_end_n )
 {
-  // set up a new hypothesis engine with the parameters supplied
-  h_engine = HypothesisEngine(a_start_n, a_end_n, a_params);
+  if (running) return 0;
+  // if the hypotheses have already been created with the same parameters,
+  // update them rather than starting again. Otherwise, set up a new
+  // hypothesis engine with the parameters supplied
+  const bool update = h_engine.compatible(a_params);
+  if (!update) {
+    h_engine = HypothesisEngine(a_start_n, a_end_n, a_params);
+  }
   h_engine.volume = tracker.volume;
 
-  // add all of the tracks to the engine
+  // add the tracks which overlap the frame range to the engine
+  h_engine.clear_tracks();
   for (size_t i=0; i<size(); i++) {
-  	h_engine.add_track(tracker.tracks[i]);
+    TrackletPtr trk = tracker.tracks[i];
+    if (!trk) continue;
+    if (trk->track.back()->t < a_start_n || trk->track.front()->t > a_end_n) {
+      continue;
+    }
+    h_engine.add_track(trk);
   }
 
   // create the hypotheses
-  h_engine.create();
+  if (update) {
+    h_engine.update(a_start_n, a_end_n);
+  } else {
+    h_engine.create();
+  }
 
   return h_engine.size();
 };
@@ -229,11 +442,19 @@ PyHypothesis InterfaceWrapper::get_hypothesis(const unsigned int a_ID)
   return h_engine.get_hypothesis(a_ID);
 };
 
+// get the number of hypotheses of each type
+void InterfaceWrapper::get_hypothesis_counts(unsigned int* a_before,
+                                             unsigned int* a_after)
+{
+  h_engine.counts(a_before, a_after);
+};
+
 
 // merge tracks based on hypothesis IDs
 void InterfaceWrapper::merge( unsigned int* a_hypotheses,
                               unsigned int n_hypotheses )
 {
+  if (running) return;
 
   // make a vector of hypotheses to merge
   std::vector<Hypothesis> merges;
@@ -248,7 +469,83 @@ void InterfaceWrapper::merge( unsigned int* a_hypotheses,
     merges.push_back( h_engine.m_hypotheses[idx] );
   }
 
-  // now run the merging
-  p_manager->merge(merges);
+  // now run the merging, the motion models are updated across any gaps using
+  // the acquisition times of the frames
+  p_manager->merge(merges, [this](const unsigned int a_from,
+                                  const unsigned int a_to) {
+    return tracker.elapsed(a_from, a_to);
+  });
+
+}
+
+
+// merge tracks using the hypotheses which have been decided before a frame,
+// those whose tracks end before it. A merge is decided by the end of its first
+// parent to end, so that a parent ending before the next window is never left
+// undecided. The other parent is then a fixed end in the next window. The
+// other hypotheses are decided by the end of their own track. The IDs of
+// these hypotheses are moved to the start of the list
+unsigned int InterfaceWrapper::merge_before( unsigned int* a_hypotheses,
+                                             unsigned int n_hypotheses,
+                                             const unsigned int a_frame )
+{
+  if (running) return 0;
+  unsigned int n_decided = 0;
+
+  for (size_t i=0; i<n_hypotheses; i++) {
+    const Hypothesis &h = h_engine.m_hypotheses[a_hypotheses[i]];
+    unsigned int t_end;
+    if (h.hypothesis == TYPE_Pmrge) {
+      t_end = std::min(h.trk_parent_one_ID->track.back()->t,
+                       h.trk_parent_two_ID->track.back()->t);
+    } else {
+      t_end = h.trk_ID->track.back()->t;
+    }
+    if (t_end >= a_frame) continue;
+    a_hypotheses[n_decided] = a_hypotheses[i];
+    n_decided++;
+  }
+
+  merge(a_hypotheses, n_decided);
+  return n_decided;
+}
+
+
+
+// track a batch of datasets in parallel
+unsigned int track_datasets(InterfaceWrapper** a_datasets,
+                            const unsigned int a_n_datasets,
+                            const unsigned int a_threads,
+                            const PyHypothesisParams* a_params,
+                            PyTrackInfo* a_stats)
+{
+  // none of the datasets can be tracking asynchronously
+  for (size_t i=0; i<a_n_datasets; i++) {
+    if (a_datasets[i]->running) return ERROR_tracking_in_progress;
+  }
+
+  // use the number of objects as the cost of each dataset
+  std::vector<double> costs(a_n_datasets);
+  for (size_t i=0; i<a_n_datasets; i++) {
+    costs[i] = static_cast<double>(a_datasets[i]->tracker.n_queued());
+  }
+
+  parallel_for(a_n_datasets, a_threads, [&](const size_t i) {
+    InterfaceWrapper* dataset = a_datasets[i];
+    dataset->tracker.track_all();
+    if (a_params != NULL &&
+        dataset->tracker.stats()->error == ERROR_none) {
+      dataset->create_hypotheses(*a_params,
+                                 dataset->tracker.first_frame(),
+                                 dataset->tracker.last_frame());
+    }
+  }, costs);
+
+  unsigned int error = ERROR_none;
+  for (size_t i=0; i<a_n_datasets; i++) {
+    a_stats[i] = *a_datasets[i]->tracker.stats();
+    if (error == ERROR_none) error = a_stats[i].error;
+  }
 
+  return error;
 }
@@ -113,6 +113,8 @@ def log_stats(stats):
     logger.info(' - Probabilities (Link: {0:.5f}, Lost:'
                 ' {1:.5f})'.format(stats['p_link'], stats['p_lost']))
 
+    logger.info(' - Gating (Hit rate: {0:.5f})'.format(stats['gate_hit_rate']))
+
     if stats['complete']:
         return
 
@@ -531,6 +533,98 @@ def import_HDF(filename):
 
 
 
+class TrackStore(object):
+    """ TrackStore
+
+    Read-only access to the binary track store (.btrk) written by the tracker.
+    The file is memory mapped, so individual tracks can be read without loading
+    the entire file.
+
+    Basic format of the file is:
+        header: magic ('BTRK'), version, number of tracks and objects, and the
+            byte offsets of the index and each of the columns
+        index: ID, parent, root, fate, offset, length for each track
+        columns: x, y, z (float64), t, label (uint32), ref (int32)
+
+    Args:
+        filename: the track store file
+
+    Members:
+        __len__: the number of tracks in the store
+        __getitem__: return a track as a btypes.Tracklet
+        refs: return the object references of a track
+
+    Notes:
+        The format is written in the native byte order of the machine that
+        ran the tracker.
+    """
+
+    HEADER = np.dtype([('magic','S4'), ('version','=u4'), ('n_tracks','=u8'),
+                       ('n_entries','=u8'), ('index','=u8'), ('x','=u8'),
+                       ('y','=u8'), ('z','=u8'), ('t','=u8'),
+                       ('label','=u8'), ('ref','=u8')])
+
+    INDEX = np.dtype([('ID','=u4'), ('parent','=u4'), ('root','=u4'),
+                      ('fate','=u4'), ('offset','=u8'), ('length','=u8')])
+
+    COLUMNS = (('x','=f8'), ('y','=f8'), ('z','=f8'), ('t','=u4'),
+               ('label','=u4'), ('ref','=i4'))
+
+    def __init__(self, filename):
+        header = np.memmap(filename, dtype=self.HEADER, mode='r', shape=(1,))[0]
+
+        if header['magic'] != b'BTRK':
+            raise IOError('{0:s} is not a track store'.format(filename))
+        if header['version'] != constants.TRACK_STORE_VERSION:
+            raise IOError('Track store version {0:d} not supported'.format(
+                          int(header['version'])))
+
+        self.filename = filename
+        n_tracks = int(header['n_tracks'])
+        n_entries = int(header['n_entries'])
+
+        self.index = np.memmap(filename, dtype=self.INDEX, mode='r',
+                               offset=int(header['index']), shape=(n_tracks,))
+
+        self._columns = {}
+        for col, dtype in self.COLUMNS:
+            if n_entries == 0:
+                self._columns[col] = np.zeros((0,), dtype=dtype)
+                continue
+            self._columns[col] = np.memmap(filename, dtype=dtype, mode='r',
+                                           offset=int(header[col]),
+                                           shape=(n_entries,))
+
+    def __len__(self):
+        return self.index.shape[0]
+
+    def column(self, col, index):
+        """ Return a column of data for a single track """
+        start = int(self.index[index]['offset'])
+        end = start + int(self.index[index]['length'])
+        return self._columns[col][start:end]
+
+    def refs(self, index):
+        """ Return the object references of a track, dummies are negative """
+        return self.column('ref', index).tolist()
+
+    def __getitem__(self, index):
+        """ Return a single track as a btypes.Tracklet """
+        txyz = np.column_stack([self.column(c, index) for c in 'txyz'])
+        trk = self.index[index]
+        return btypes.Tracklet(int(trk['ID']), txyz.astype('float'),
+                               labels=self.column('label', index),
+                               parent=int(trk['parent']),
+                               fate=int(trk['fate']))
+
+
+
+def import_store(filename):
+    """ Open a binary track store written by the tracker """
+    return TrackStore(filename)
+
+
+
 def ID_from_name(name):
     """ Return the object ID from a name.
 